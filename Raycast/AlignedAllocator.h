@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace Physics
+{
+    const size_t CACHE_LINE_SIZE = 64;
+
+    /// <summary>
+    /// A std::allocator that hands out memory aligned to ALIGN bytes (a power of two, at least sizeof(void*))
+    /// so arrays start on a cache line, or on a SIMD register boundary
+    /// </summary>
+    template <typename T, size_t ALIGN = CACHE_LINE_SIZE>
+    class AlignedAllocator {
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+            typedef AlignedAllocator<U, ALIGN> other;
+        };
+
+        AlignedAllocator() {}
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, ALIGN>&) {}
+
+        T* allocate(size_t count)
+        {
+            void* p = nullptr;
+#if defined(_WIN32)
+            p = _aligned_malloc(count * sizeof(T), ALIGN);
+#else
+            if (posix_memalign(&p, ALIGN, count * sizeof(T)) != 0)
+            {
+                p = nullptr;
+            }
+#endif
+            if (p == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T* p, size_t)
+        {
+#if defined(_WIN32)
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, ALIGN>&) const { return true; }
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, ALIGN>&) const { return false; }
+    };
+
+    template <typename T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+}
@@ -0,0 +1,865 @@
+#include "Bvh.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Physics {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // AABB
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    float AABB::GetSurfaceArea() const
+    {
+        if (false == IsValid())
+        {
+            return 0.0f;
+        }
+        Vector3 size = mMax - mMin;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    /// <summary>
+    /// The bounds of this box once it is transformed by an affine matrix
+    /// Each output axis is the center transformed plus the absolute value of the matrix applied to the half size (Arvo)
+    /// </summary>
+    /// <param name="mat">the transform to apply</param>
+    /// <returns>the axis aligned bounds of the transformed box</returns>
+    AABB AABB::Transform(const Matrix4& mat) const
+    {
+        if (false == IsValid())
+        {
+            return *this;
+        }
+        Vector3 center = Vector3::Transform(GetCenter(), mat);
+        Vector3 half = 0.5f * (mMax - mMin);
+        Vector3 extent(
+            Math::Abs(mat.mat[0][0]) * half.x + Math::Abs(mat.mat[1][0]) * half.y + Math::Abs(mat.mat[2][0]) * half.z,
+            Math::Abs(mat.mat[0][1]) * half.x + Math::Abs(mat.mat[1][1]) * half.y + Math::Abs(mat.mat[2][1]) * half.z,
+            Math::Abs(mat.mat[0][2]) * half.x + Math::Abs(mat.mat[1][2]) * half.y + Math::Abs(mat.mat[2][2]) * half.z
+        );
+        return AABB(center - extent, center + extent);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Bvh
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    namespace {
+        const int NUM_BINS = 16;
+        const float TRAVERSAL_COST = 1.0f;
+        const float INTERSECT_COST = 1.0f;
+        const int PARALLEL_CHUNK = 16384;       // primitives a thread bins or partitions at a time
+        const int MIN_PARALLEL_COUNT = 4096;    // smaller builds, and subtrees, are left to a single thread
+        const int SUBTREES_PER_THREAD = 8;      // how many subtrees the threads share, for balance
+
+        struct Bin {
+            AABB mBounds;
+            int mCount = 0;
+        };
+
+        /// <summary>
+        /// The bins of all 3 axes over a range
+        /// </summary>
+        struct AxisBins {
+            Bin mBins[3][NUM_BINS];
+        };
+
+        /// <summary>
+        /// The bounds of the primitives of a range, and of their centroids
+        /// </summary>
+        struct RangeBounds {
+            AABB mBounds;
+            AABB mCentroids;
+        };
+
+        struct BuildContext {
+            const AABB* mPrimBounds;
+            std::vector<Vector3> mCentroids;
+            int* mPrimOrder;
+            BvhNode* mNodes;
+            std::atomic<int> mNodeCount;    // children are handed out in pairs from here, by any thread
+            std::vector<int> mScratch;      // where parallel partitions gather the primitive order
+        };
+
+        float GetAxis(const Vector3& v, int axis)
+        {
+            return v.GetAsFloatPtr()[axis];
+        }
+
+        /// <summary>
+        /// Fold the range [0, count) into result: addFunc(T&, begin, end) adds a part of the range to a T and
+        /// mergeFunc(T& result, const T& part) merges the parts. With several threads each chunk fills a T of its own,
+        /// merged in order afterwards, otherwise (or if the range is small) addFunc fills result in one go.
+        /// </summary>
+        template <typename T, typename AddFunc, typename MergeFunc>
+        void ParallelReduce(int count, int threadCount, T& result, AddFunc addFunc, MergeFunc mergeFunc)
+        {
+            if (threadCount <= 1 || count < 2 * PARALLEL_CHUNK)
+            {
+                addFunc(result, 0, count);
+                return;
+            }
+            std::vector<T> parts((count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK);
+            ParallelFor((size_t)count, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    addFunc(parts[begin / PARALLEL_CHUNK], (int)begin, (int)end);
+                });
+            for (const T& part : parts)
+            {
+                mergeFunc(result, part);
+            }
+        }
+
+        RangeBounds GetRangeBounds(const BuildContext& ctx, int first, int count, int threadCount)
+        {
+            RangeBounds result;
+            ParallelReduce(count, threadCount, result,
+                [&](RangeBounds& range, int begin, int end)
+                {
+                    for (int i = first + begin; i < first + end; ++i)
+                    {
+                        int prim = ctx.mPrimOrder[i];
+                        range.mBounds.AddBox(ctx.mPrimBounds[prim]);
+                        range.mCentroids.AddPoint(ctx.mCentroids[prim]);
+                    }
+                },
+                [](RangeBounds& range, const RangeBounds& part)
+                {
+                    range.mBounds.AddBox(part.mBounds);
+                    range.mCentroids.AddBox(part.mCentroids);
+                });
+            return result;
+        }
+
+        /// <summary>
+        /// Find the cheapest binned SAH split of the range [first, first + count)
+        /// All 3 axes are binned in one pass over the range; bins only add up counts and bounds, so they come out the
+        /// same however many threads fill them, and so does the split.
+        /// </summary>
+        /// <returns>the cost of that split, or Infinity if the centroids cannot be separated</returns>
+        float FindSplit(const BuildContext& ctx, int first, int count, const AABB& centroidBounds, int threadCount, int* pAxis, float* pSplit)
+        {
+            float lo[3];
+            float scale[3];
+            bool canSplit = false;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                lo[axis] = GetAxis(centroidBounds.mMin, axis);
+                float hi = GetAxis(centroidBounds.mMax, axis);
+                scale[axis] = hi > lo[axis] ? NUM_BINS / (hi - lo[axis]) : 0.0f;
+                canSplit |= hi > lo[axis];
+            }
+            if (false == canSplit)
+            {
+                return Math::Infinity;
+            }
+
+            AxisBins bins;
+            ParallelReduce(count, threadCount, bins,
+                [&](AxisBins& part, int begin, int end)
+                {
+                    for (int i = first + begin; i < first + end; ++i)
+                    {
+                        int prim = ctx.mPrimOrder[i];
+                        const Vector3& centroid = ctx.mCentroids[prim];
+                        for (int axis = 0; axis < 3; ++axis)
+                        {
+                            if (scale[axis] > 0.0f)
+                            {
+                                int b = Math::Min(NUM_BINS - 1, (int)((GetAxis(centroid, axis) - lo[axis]) * scale[axis]));
+                                part.mBins[axis][b].mCount++;
+                                part.mBins[axis][b].mBounds.AddBox(ctx.mPrimBounds[prim]);
+                            }
+                        }
+                    }
+                },
+                [](AxisBins& result, const AxisBins& part)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        for (int b = 0; b < NUM_BINS; ++b)
+                        {
+                            result.mBins[axis][b].mCount += part.mBins[axis][b].mCount;
+                            result.mBins[axis][b].mBounds.AddBox(part.mBins[axis][b].mBounds);
+                        }
+                    }
+                });
+
+            float bestCost = Math::Infinity;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (false == (scale[axis] > 0.0f))
+                {
+                    continue;
+                }
+
+                // sweep from the right to get the area of every right hand side, then from the left
+                const Bin* pBins = bins.mBins[axis];
+                float rightArea[NUM_BINS - 1];
+                int rightCount[NUM_BINS - 1];
+                AABB box;
+                int sum = 0;
+                for (int i = NUM_BINS - 1; i > 0; --i)
+                {
+                    box.AddBox(pBins[i].mBounds);
+                    sum += pBins[i].mCount;
+                    rightArea[i - 1] = box.GetSurfaceArea();
+                    rightCount[i - 1] = sum;
+                }
+                box = AABB();
+                sum = 0;
+                for (int i = 0; i < NUM_BINS - 1; ++i)
+                {
+                    box.AddBox(pBins[i].mBounds);
+                    sum += pBins[i].mCount;
+                    if (sum == 0 || rightCount[i] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = box.GetSurfaceArea() * sum + rightArea[i] * rightCount[i];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        *pAxis = axis;
+                        *pSplit = lo[axis] + (i + 1) / scale[axis];
+                    }
+                }
+            }
+            return bestCost;
+        }
+
+        /// <summary>
+        /// Partition the primitive order of the range [first, first + count) around the split plane
+        /// One thread swaps in place. Several count the left primitives of each chunk, then copy every chunk's
+        /// primitives straight to their place through mScratch (a stable partition).
+        /// </summary>
+        /// <returns>the number of primitives on the left</returns>
+        int Partition(BuildContext& ctx, int first, int count, int axis, float split, int threadCount)
+        {
+            int* pOrder = ctx.mPrimOrder + first;
+            auto isLeft = [&](int prim) { return GetAxis(ctx.mCentroids[prim], axis) < split; };
+            if (threadCount <= 1 || count < 2 * PARALLEL_CHUNK)
+            {
+                int i = 0;
+                int j = count - 1;
+                while (i <= j)
+                {
+                    if (isLeft(pOrder[i]))
+                    {
+                        ++i;
+                    }
+                    else
+                    {
+                        std::swap(pOrder[i], pOrder[j]);
+                        --j;
+                    }
+                }
+                return i;
+            }
+
+            int chunkCount = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+            std::vector<int> leftStart(chunkCount + 1, 0);
+            ParallelFor((size_t)count, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    leftStart[begin / PARALLEL_CHUNK + 1] = (int)std::count_if(pOrder + begin, pOrder + end, isLeft);
+                });
+            for (int c = 0; c < chunkCount; ++c)
+            {
+                leftStart[c + 1] += leftStart[c];
+            }
+            int leftCount = leftStart[chunkCount];
+            int* pScratch = ctx.mScratch.data() + first;
+            ParallelFor((size_t)count, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    int c = (int)(begin / PARALLEL_CHUNK);
+                    int left = leftStart[c];
+                    int right = leftCount + (int)begin - leftStart[c];
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        int prim = pOrder[i];
+                        pScratch[isLeft(prim) ? left++ : right++] = prim;
+                    }
+                });
+            ParallelFor((size_t)count, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    std::copy(pScratch + begin, pScratch + end, pOrder + begin);
+                });
+            return leftCount;
+        }
+
+        /// <summary>
+        /// Fill in the node over the range [first, first + count), and split it if that pays off
+        /// </summary>
+        /// <returns>the number of primitives of its left child, or 0 if the node is a leaf</returns>
+        int SplitNode(BuildContext& ctx, int nodeIndex, int first, int count, int depth, int threadCount)
+        {
+            RangeBounds range = GetRangeBounds(ctx, first, count, threadCount);
+            BvhNode& node = ctx.mNodes[nodeIndex];
+            node.mBounds = range.mBounds;
+            node.mFirst = first;
+            node.mCount = count;
+            if (count <= 1 || depth >= Bvh::MAX_DEPTH)
+            {
+                return 0;
+            }
+
+            int axis = 0;
+            float split = 0.0f;
+            float splitCost = FindSplit(ctx, first, count, range.mCentroids, threadCount, &axis, &split);
+            if (splitCost == Math::Infinity)
+            {
+                return 0;
+            }
+            float area = range.mBounds.GetSurfaceArea();
+            splitCost = TRAVERSAL_COST + INTERSECT_COST * splitCost / Math::Max(area, 1e-30f);
+            // no cap on the leaf size: primitives that overlap so much no split pays off (objects spanning the
+            // world) are cheaper as one leaf than as a tower of nodes every ray enters anyway
+            if (splitCost >= INTERSECT_COST * count)
+            {
+                return 0;
+            }
+
+            int leftCount = Partition(ctx, first, count, axis, split, threadCount);
+            if (leftCount == 0 || leftCount == count)
+            {
+                return 0;
+            }
+            node.mFirst = ctx.mNodeCount.fetch_add(2, std::memory_order_relaxed);
+            node.mCount = 0;
+            return leftCount;
+        }
+
+        void BuildNode(BuildContext& ctx, int nodeIndex, int first, int count, int depth)
+        {
+            int leftCount = SplitNode(ctx, nodeIndex, first, count, depth, 1);
+            if (leftCount > 0)
+            {
+                int left = ctx.mNodes[nodeIndex].mFirst;
+                BuildNode(ctx, left, first, leftCount, depth + 1);
+                BuildNode(ctx, left + 1, first + leftCount, count - leftCount, depth + 1);
+            }
+        }
+
+        /// <summary>
+        /// Split the top of the tree with every thread binning and partitioning each node together, until the
+        /// ranges left are small enough to share out, then build those subtrees on one thread each, biggest first
+        /// </summary>
+        void BuildParallel(BuildContext& ctx, int primCount, int threadCount)
+        {
+            struct Subtree {
+                int mNode;
+                int mFirst;
+                int mCount;
+                int mDepth;
+            };
+            int subtreeSize = Math::Max(primCount / (SUBTREES_PER_THREAD * threadCount), MIN_PARALLEL_COUNT);
+            ctx.mScratch.resize(primCount);
+            std::vector<Subtree> top = { { 0, 0, primCount, 0 } };
+            std::vector<Subtree> subtrees;
+            while (false == top.empty())
+            {
+                Subtree cur = top.back();
+                top.pop_back();
+                if (cur.mCount <= subtreeSize)
+                {
+                    subtrees.push_back(cur);
+                    continue;
+                }
+                int leftCount = SplitNode(ctx, cur.mNode, cur.mFirst, cur.mCount, cur.mDepth, threadCount);
+                if (leftCount > 0)
+                {
+                    int left = ctx.mNodes[cur.mNode].mFirst;
+                    top.push_back({ left, cur.mFirst, leftCount, cur.mDepth + 1 });
+                    top.push_back({ left + 1, cur.mFirst + leftCount, cur.mCount - leftCount, cur.mDepth + 1 });
+                }
+            }
+
+            std::sort(subtrees.begin(), subtrees.end(), [](const Subtree& a, const Subtree& b) { return a.mCount > b.mCount; });
+            ParallelFor(subtrees.size(), 1, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        BuildNode(ctx, subtrees[i].mNode, subtrees[i].mFirst, subtrees[i].mCount, subtrees[i].mDepth);
+                    }
+                });
+        }
+    }
+
+    Bvh::Bvh()
+        : mExternalNodes(nullptr)
+        , mExternalCount(0)
+    {}
+
+    /// <summary>
+    /// Build the hierarchy over the given primitive bounds
+    /// With several threads, each node at the top of the tree is binned and partitioned by all of them, and the
+    /// subtrees below are then built in parallel. The splits are the very ones a single thread picks, so the tree
+    /// has the same SAH cost; only the order of the nodes, and of the primitives within a leaf, may differ.
+    /// </summary>
+    /// <param name="pPrimBounds">the bounds of each primitive</param>
+    /// <param name="primCount">the number of primitives</param>
+    /// <param name="threadCount">the threads to build with, counting the caller, <= 0 for one per core (small builds use one)</param>
+    void Bvh::Build(const AABB* pPrimBounds, int primCount, int threadCount)
+    {
+        Clear();
+        if (primCount <= 0)
+        {
+            return;
+        }
+        if (threadCount <= 0)
+        {
+            threadCount = GetDefaultThreadCount();
+        }
+        if (primCount < MIN_PARALLEL_COUNT)
+        {
+            threadCount = 1;
+        }
+
+        BuildContext ctx;
+        ctx.mPrimBounds = pPrimBounds;
+        ctx.mCentroids.resize(primCount);
+        mPrimOrder.resize(primCount);
+        ParallelFor((size_t)primCount, PARALLEL_CHUNK, threadCount,
+            [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    ctx.mCentroids[i] = pPrimBounds[i].GetCenter();
+                    mPrimOrder[i] = (int)i;
+                }
+            });
+        ctx.mPrimOrder = mPrimOrder.data();
+
+        // a binary tree over primCount leaves has at most 2 * primCount - 1 nodes
+        mNodes.resize(2 * primCount - 1);
+        ctx.mNodes = mNodes.data();
+        ctx.mNodeCount = 1;
+        if (threadCount <= 1)
+        {
+            BuildNode(ctx, 0, 0, primCount, 0);
+        }
+        else
+        {
+            BuildParallel(ctx, primCount, threadCount);
+        }
+        mNodes.resize(ctx.mNodeCount.load());
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Bvh linear build
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    namespace {
+        const int RADIX_BITS = 11;
+        const int RADIX_SIZE = 1 << RADIX_BITS;
+
+        /// <summary>
+        /// Spread the low 10 bits of v out to every third bit
+        /// </summary>
+        uint32_t SpreadBits(uint32_t v)
+        {
+            v &= 0x3ff;
+            v = (v | (v << 16)) & 0x030000ff;
+            v = (v | (v << 8)) & 0x0300f00f;
+            v = (v | (v << 4)) & 0x030c30c3;
+            v = (v | (v << 2)) & 0x09249249;
+            return v;
+        }
+
+        /// <summary>
+        /// Spread the low 21 bits of v out to every third bit
+        /// </summary>
+        uint64_t SpreadBits(uint64_t v)
+        {
+            v &= 0x1fffff;
+            v = (v | (v << 32)) & 0x001f00000000ffffull;
+            v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+            v = (v | (v << 8)) & 0x100f00f00f00f00full;
+            v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+            v = (v | (v << 2)) & 0x1249249249249249ull;
+            return v;
+        }
+
+        /// <summary>
+        /// The Morton code of a point of the unit cube, 10 (uint32_t) or 21 (uint64_t) bits per axis
+        /// </summary>
+        template <typename Code>
+        Code GetMortonCode(const Vector3& unit)
+        {
+            const int BITS_PER_AXIS = sizeof(Code) == 4 ? 10 : 21;
+            const float CELLS = (float)(1 << BITS_PER_AXIS);
+            auto cell = [&](float f) { return (Code)Math::Min(Math::Max(f * CELLS, 0.0f), CELLS - 1.0f); };
+            return (SpreadBits(cell(unit.x)) << 2) | (SpreadBits(cell(unit.y)) << 1) | SpreadBits(cell(unit.z));
+        }
+
+        int CountLeadingZeros(uint64_t v)
+        {
+#if defined(_MSC_VER)
+            unsigned long bit;
+            return _BitScanReverse64(&bit, v) ? 63 - (int)bit : 64;
+#else
+            return v != 0 ? __builtin_clzll(v) : 64;
+#endif
+        }
+
+        /// <summary>
+        /// Sort the keys, and the values with them, by their low bits with a least significant digit radix sort
+        /// Every pass counts the digits of each chunk, then scatters the chunks in order, so the sort is stable and
+        /// gives the same result however many threads run it. Passes where every key has the same digit are skipped.
+        /// </summary>
+        template <typename Code>
+        void RadixSort(std::vector<Code>& keys, std::vector<int>& values, int bits, int threadCount)
+        {
+            int count = (int)keys.size();
+            int chunkCount = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+            std::vector<Code> keysOut(count);
+            std::vector<int> valuesOut(count);
+            std::vector<int> offsets((size_t)chunkCount * RADIX_SIZE);
+            for (int shift = 0; shift < bits; shift += RADIX_BITS)
+            {
+                std::fill(offsets.begin(), offsets.end(), 0);
+                ParallelFor((size_t)count, PARALLEL_CHUNK, threadCount,
+                    [&](size_t begin, size_t end)
+                    {
+                        int* pCounts = &offsets[begin / PARALLEL_CHUNK * RADIX_SIZE];
+                        for (size_t i = begin; i < end; ++i)
+                        {
+                            pCounts[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+                        }
+                    });
+
+                // turn the counts into where each chunk writes each digit: digit by digit, chunk by chunk
+                bool sameDigit = false;
+                int sum = 0;
+                for (int d = 0; d < RADIX_SIZE; ++d)
+                {
+                    int digitStart = sum;
+                    for (int c = 0; c < chunkCount; ++c)
+                    {
+                        int n = offsets[(size_t)c * RADIX_SIZE + d];
+                        offsets[(size_t)c * RADIX_SIZE + d] = sum;
+                        sum += n;
+                    }
+                    sameDigit |= sum - digitStart == count;
+                }
+                if (sameDigit)
+                {
+                    continue;
+                }
+
+                ParallelFor((size_t)count, PARALLEL_CHUNK, threadCount,
+                    [&](size_t begin, size_t end)
+                    {
+                        int* pOffsets = &offsets[begin / PARALLEL_CHUNK * RADIX_SIZE];
+                        for (size_t i = begin; i < end; ++i)
+                        {
+                            int dst = pOffsets[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+                            keysOut[dst] = keys[i];
+                            valuesOut[dst] = values[i];
+                        }
+                    });
+                keys.swap(keysOut);
+                values.swap(valuesOut);
+            }
+        }
+
+        /// <summary>
+        /// A radix tree over sorted Morton codes (Karras, "Maximizing Parallelism in the Construction of BVHs,
+        /// Octrees, and k-d Trees"), every internal node of which is found on its own, so all of them at once
+        /// Internal node i covers a range of the sorted codes that starts or ends at i, and splits it where the
+        /// highest bit of the codes changes. Equal codes are told apart by their position.
+        /// </summary>
+        template <typename Code>
+        class RadixTree {
+        public:
+            RadixTree(const std::vector<Code>& codes)
+                : mCodes(codes.data())
+                , mCount((int)codes.size())
+            {}
+
+            /// <summary>
+            /// The children of internal node i: each one is either the leaf of a sorted code or another internal node
+            /// </summary>
+            void GetChildren(int i, int* pLeft, bool* pLeftLeaf, int* pRight, bool* pRightLeaf) const
+            {
+                // the direction of the range, and the prefix its far end must share with i
+                int d = GetPrefix(i, i + 1) > GetPrefix(i, i - 1) ? 1 : -1;
+                int minPrefix = GetPrefix(i, i - d);
+
+                // find the far end j with an exponential then a binary search
+                int maxLength = 2;
+                while (GetPrefix(i, i + maxLength * d) > minPrefix)
+                {
+                    maxLength *= 2;
+                }
+                int length = 0;
+                for (int t = maxLength / 2; t >= 1; t /= 2)
+                {
+                    if (GetPrefix(i, i + (length + t) * d) > minPrefix)
+                    {
+                        length += t;
+                    }
+                }
+                int j = i + length * d;
+
+                // the split is the last code still sharing more than the prefix of the whole range with i
+                int nodePrefix = GetPrefix(i, j);
+                int split = 0;
+                for (int t = length; t > 1; )
+                {
+                    t = (t + 1) / 2;
+                    if (GetPrefix(i, i + (split + t) * d) > nodePrefix)
+                    {
+                        split += t;
+                    }
+                }
+                int gamma = i + split * d + Math::Min(d, 0);
+
+                *pLeft = gamma;
+                *pLeftLeaf = Math::Min(i, j) == gamma;
+                *pRight = gamma + 1;
+                *pRightLeaf = Math::Max(i, j) == gamma + 1;
+            }
+
+        private:
+            /// <summary>
+            /// The length of the prefix the codes at i and j share, with their positions appended, -1 if j is outside
+            /// </summary>
+            int GetPrefix(int i, int j) const
+            {
+                if (j < 0 || j >= mCount)
+                {
+                    return -1;
+                }
+                if (mCodes[i] != mCodes[j])
+                {
+                    return CountLeadingZeros((uint64_t)(mCodes[i] ^ mCodes[j]));
+                }
+                return 64 + CountLeadingZeros((uint64_t)(i ^ j));
+            }
+
+            const Code* mCodes;
+            int mCount;
+        };
+
+        /// <summary>
+        /// Sort the primitives along a Morton curve and emit a radix tree over them, one primitive per leaf
+        /// The children of internal node i go to nodes 2i + 1 and 2i + 2, so siblings sit next to each other and every
+        /// node knows its place without waiting on any other. The bounds are then gathered from the leaves up: at each
+        /// internal node the second child to finish (counted by an atomic) merges both and carries on towards the root.
+        /// </summary>
+        /// <returns>the depth of the tree</returns>
+        template <typename Code>
+        int BuildRadixTree(const AABB* pPrimBounds, int primCount, int threadCount, std::vector<BvhNode>& nodes, std::vector<int>& primOrder)
+        {
+            AABB centroidBounds;
+            ParallelReduce(primCount, threadCount, centroidBounds,
+                [&](AABB& bounds, int begin, int end)
+                {
+                    for (int i = begin; i < end; ++i)
+                    {
+                        bounds.AddPoint(pPrimBounds[i].GetCenter());
+                    }
+                },
+                [](AABB& bounds, const AABB& part) { bounds.AddBox(part); });
+            Vector3 extent = centroidBounds.mMax - centroidBounds.mMin;
+            Vector3 scale(
+                extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                extent.z > 0.0f ? 1.0f / extent.z : 0.0f
+            );
+
+            std::vector<Code> codes(primCount);
+            primOrder.resize(primCount);
+            ParallelFor((size_t)primCount, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        Vector3 offset = pPrimBounds[i].GetCenter() - centroidBounds.mMin;
+                        codes[i] = GetMortonCode<Code>(Vector3(offset.x * scale.x, offset.y * scale.y, offset.z * scale.z));
+                        primOrder[i] = (int)i;
+                    }
+                });
+            RadixSort(codes, primOrder, sizeof(Code) == 4 ? 30 : 63, threadCount);
+
+            nodes.resize(2 * primCount - 1);
+            if (primCount == 1)
+            {
+                nodes[0] = { pPrimBounds[0], 0, 1 };
+                return 0;
+            }
+
+            // the node each internal node went to, and the internal node above each node
+            int internalCount = primCount - 1;
+            std::vector<int> internalNode(internalCount);
+            std::vector<int> parent(nodes.size());
+            RadixTree<Code> tree(codes);
+            internalNode[0] = 0;
+            nodes[0] = { AABB(), 1, 0 };
+            ParallelFor((size_t)internalCount, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    for (int i = (int)begin; i < (int)end; ++i)
+                    {
+                        int child[2];
+                        bool isLeaf[2];
+                        tree.GetChildren(i, &child[0], &isLeaf[0], &child[1], &isLeaf[1]);
+                        for (int c = 0; c < 2; ++c)
+                        {
+                            int node = 2 * i + 1 + c;
+                            parent[node] = i;
+                            if (isLeaf[c])
+                            {
+                                nodes[node] = { pPrimBounds[primOrder[child[c]]], child[c], 1 };
+                            }
+                            else
+                            {
+                                nodes[node] = { AABB(), 2 * child[c] + 1, 0 };
+                                internalNode[child[c]] = node;
+                            }
+                        }
+                    }
+                });
+
+            std::vector<int> height(internalCount);
+            std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[internalCount]);
+            for (int i = 0; i < internalCount; ++i)
+            {
+                visits[i].store(0, std::memory_order_relaxed);
+            }
+            ParallelFor(nodes.size() - 1, PARALLEL_CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    for (size_t leaf = begin + 1; leaf < end + 1; ++leaf)
+                    {
+                        if (nodes[leaf].mCount == 0)
+                        {
+                            continue;
+                        }
+                        int i = parent[leaf];
+                        while (visits[i].fetch_add(1, std::memory_order_acq_rel) == 1)
+                        {
+                            int node = internalNode[i];
+                            const BvhNode& left = nodes[2 * i + 1];
+                            const BvhNode& right = nodes[2 * i + 2];
+                            nodes[node].mBounds = left.mBounds;
+                            nodes[node].mBounds.AddBox(right.mBounds);
+                            height[i] = 1 + Math::Max(left.mCount > 0 ? 0 : height[left.mFirst / 2],
+                                right.mCount > 0 ? 0 : height[right.mFirst / 2]);
+                            if (node == 0)
+                            {
+                                break;
+                            }
+                            i = parent[node];
+                        }
+                    }
+                });
+            return height[0];
+        }
+    }
+
+    /// <summary>
+    /// Build the hierarchy over the given primitive bounds in linear time, for worlds that move too much to refit
+    /// The primitives are sorted along a Morton curve of their centers (a parallel radix sort) and the tree is the
+    /// radix tree of their codes, each internal node found independently (LBVH). That is several times faster than
+    /// Build() and runs on every thread from start to end, but splits at the middle of space rather than where the SAH
+    /// says, so casts are somewhat slower. Each leaf holds one primitive. A tree deeper than MAX_DEPTH (possible with
+    /// very unevenly spread primitives) is thrown away for Build().
+    /// </summary>
+    /// <param name="pPrimBounds">the bounds of each primitive</param>
+    /// <param name="primCount">the number of primitives</param>
+    /// <param name="code">30 bit codes sort faster, 63 bit codes separate primitives in much denser clusters</param>
+    /// <param name="threadCount">the threads to build with, counting the caller, <= 0 for one per core (small builds use one)</param>
+    void Bvh::BuildLinear(const AABB* pPrimBounds, int primCount, MortonCode code, int threadCount)
+    {
+        Clear();
+        if (primCount <= 0)
+        {
+            return;
+        }
+        if (threadCount <= 0)
+        {
+            threadCount = GetDefaultThreadCount();
+        }
+        if (primCount < MIN_PARALLEL_COUNT)
+        {
+            threadCount = 1;
+        }
+
+        int depth = code == MortonCode::Bits30 ?
+            BuildRadixTree<uint32_t>(pPrimBounds, primCount, threadCount, mNodes, mPrimOrder) :
+            BuildRadixTree<uint64_t>(pPrimBounds, primCount, threadCount, mNodes, mPrimOrder);
+        if (depth > MAX_DEPTH)
+        {
+            Build(pPrimBounds, primCount, threadCount);
+        }
+    }
+
+    void Bvh::Clear()
+    {
+        mNodes.clear();
+        mPrimOrder.clear();
+        mExternalNodes = nullptr;
+        mExternalCount = 0;
+    }
+
+    /// <summary>
+    /// Walk nodes kept elsewhere, such as a mapped SceneCache file, instead of building them
+    /// They must stay valid until the next Build or Clear. There is no primitive order, so the owner's data
+    /// must already be in the leaf order of the nodes.
+    /// </summary>
+    /// <param name="pNodes">the nodes, laid out as Build lays them out, root first</param>
+    /// <param name="nodeCount">the number of nodes</param>
+    void Bvh::SetExternalNodes(const BvhNode* pNodes, int nodeCount)
+    {
+        Clear();
+        if (nodeCount > 0)
+        {
+            mExternalNodes = pNodes;
+            mExternalCount = nodeCount;
+        }
+    }
+
+    /// <summary>
+    /// The SAH cost of the whole tree, relative to the root. Useful to compare builders.
+    /// </summary>
+    float Bvh::GetSahCost() const
+    {
+        if (IsEmpty())
+        {
+            return 0.0f;
+        }
+        const BvhNode* pNodes = GetNodes();
+        float cost = 0.0f;
+        for (int i = 0; i < GetNodeCount(); ++i)
+        {
+            const BvhNode& node = pNodes[i];
+            float area = node.mBounds.GetSurfaceArea();
+            cost += node.mCount > 0 ? INTERSECT_COST * area * node.mCount : TRAVERSAL_COST * area;
+        }
+        return cost / Math::Max(pNodes[0].mBounds.GetSurfaceArea(), 1e-30f);
+    }
+
+    /// <summary>
+    /// 1/dir per component. Zero components map to a huge finite value instead of infinity so the
+    /// slab test never computes 0 * infinity
+    /// </summary>
+    Vector3 Bvh::GetInvDir(const Vector3& dir)
+    {
+        const float BIG = 1e30f;
+        return Vector3(
+            dir.x != 0.0f ? 1.0f / dir.x : BIG,
+            dir.y != 0.0f ? 1.0f / dir.y : BIG,
+            dir.z != 0.0f ? 1.0f / dir.z : BIG
+        );
+    }
+}
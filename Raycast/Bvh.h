@@ -0,0 +1,220 @@
+#pragma once
+#include "Math.h"
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// An axis aligned bounding box
+    /// A default constructed AABB is empty (min at +infinity, max at -infinity) so it can be grown with AddPoint/AddBox
+    /// </summary>
+    class AABB {
+    public:
+        Vector3 mMin;
+        Vector3 mMax;
+        constexpr AABB()
+            : mMin(Math::Infinity)
+            , mMax(Math::NegInfinity)
+        {}
+
+        constexpr AABB(const Vector3& min, const Vector3& max)
+            : mMin(min)
+            , mMax(max)
+        {}
+
+        constexpr void AddPoint(const Vector3& p)
+        {
+            mMin.x = Math::Min(mMin.x, p.x);
+            mMin.y = Math::Min(mMin.y, p.y);
+            mMin.z = Math::Min(mMin.z, p.z);
+            mMax.x = Math::Max(mMax.x, p.x);
+            mMax.y = Math::Max(mMax.y, p.y);
+            mMax.z = Math::Max(mMax.z, p.z);
+        }
+
+        constexpr void AddBox(const AABB& box)
+        {
+            mMin.x = Math::Min(mMin.x, box.mMin.x);
+            mMin.y = Math::Min(mMin.y, box.mMin.y);
+            mMin.z = Math::Min(mMin.z, box.mMin.z);
+            mMax.x = Math::Max(mMax.x, box.mMax.x);
+            mMax.y = Math::Max(mMax.y, box.mMax.y);
+            mMax.z = Math::Max(mMax.z, box.mMax.z);
+        }
+
+        constexpr bool IsValid() const { return mMin.x <= mMax.x && mMin.y <= mMax.y && mMin.z <= mMax.z; }
+        Vector3 GetCenter() const { return 0.5f * (mMin + mMax); }
+        float GetSurfaceArea() const;
+        AABB Transform(const Matrix4& mat) const;
+
+        /// <summary>
+        /// Slab test of the segment from + t * dir, t in [0, maxFraction] against the box
+        /// invDir is 1/dir per component (see Bvh::GetInvDir)
+        /// </summary>
+        /// <param name="enter">OPTIONAL the fraction at which the segment enters the box (0 if it starts inside)</param>
+        /// <returns>true if the segment overlaps the box</returns>
+        bool RayCast(const Vector3& from, const Vector3& invDir, float maxFraction, float* enter = nullptr) const
+        {
+            float t1 = (mMin.x - from.x) * invDir.x;
+            float t2 = (mMax.x - from.x) * invDir.x;
+            float tMin = Math::Min(t1, t2);
+            float tMax = Math::Max(t1, t2);
+            t1 = (mMin.y - from.y) * invDir.y;
+            t2 = (mMax.y - from.y) * invDir.y;
+            tMin = Math::Max(tMin, Math::Min(t1, t2));
+            tMax = Math::Min(tMax, Math::Max(t1, t2));
+            t1 = (mMin.z - from.z) * invDir.z;
+            t2 = (mMax.z - from.z) * invDir.z;
+            tMin = Math::Max(tMin, Math::Min(t1, t2));
+            tMax = Math::Min(tMax, Math::Max(t1, t2));
+            tMin = Math::Max(tMin, 0.0f);
+            tMax = Math::Min(tMax, maxFraction);
+            if (enter)
+            {
+                *enter = tMin;
+            }
+            return tMin <= tMax;
+        }
+    };
+
+    /// <summary>
+    /// A node in a bounding volume hierarchy
+    /// Interior nodes have mCount == 0 and their two children are stored next to each other at mFirst and mFirst + 1
+    /// Leaf nodes reference mCount primitives starting at mFirst (in the Bvh's primitive order)
+    /// </summary>
+    struct BvhNode {
+        AABB mBounds;
+        int mFirst;
+        int mCount;
+    };
+
+    /// <summary>
+    /// A bounding volume hierarchy built with the surface area heuristic (binned), on every core for big builds
+    /// The Bvh only knows about the bounds of its primitives. After Build(), GetPrimOrder() maps the
+    /// leaf ranges back to the original primitive indices so the owner can reorder its own data.
+    /// BuildLinear() is the quick alternative to Build() for hierarchies rebuilt every frame (see BuildLinear).
+    /// Instead of being built, a Bvh can walk nodes kept elsewhere (see SetExternalNodes).
+    /// </summary>
+    class Bvh {
+    public:
+        static const int MAX_DEPTH = 48;
+
+        /// <summary>
+        /// The Morton codes BuildLinear sorts the primitives by
+        /// </summary>
+        enum class MortonCode {
+            Bits30,     // 10 bits per axis, 3 radix sort passes
+            Bits63,     // 21 bits per axis, 6 radix sort passes
+        };
+
+        Bvh();
+
+        void Build(const AABB* pPrimBounds, int primCount, int threadCount = 0);
+        void BuildLinear(const AABB* pPrimBounds, int primCount, MortonCode code = MortonCode::Bits30, int threadCount = 0);
+        void Clear();
+        void SetExternalNodes(const BvhNode* pNodes, int nodeCount);
+
+        bool IsEmpty() const { return GetNodeCount() == 0; }
+        const BvhNode* GetNodes() const { return mExternalNodes ? mExternalNodes : mNodes.data(); }
+        int GetNodeCount() const { return mExternalNodes ? mExternalCount : (int)mNodes.size(); }
+        const std::vector<int>& GetPrimOrder() const { return mPrimOrder; }
+        size_t GetMemorySize() const { return mNodes.size() * sizeof(BvhNode); }
+        float GetSahCost() const;
+
+        static Vector3 GetInvDir(const Vector3& dir);
+
+        /// <summary>
+        /// Walk the hierarchy front to back along the segment from -> to
+        /// leafFunc(first, count, maxFraction) is called for every leaf the segment reaches; it returns true
+        /// if it found a hit, in which case it must have lowered maxFraction to the fraction of that hit.
+        /// Subtrees that start beyond the current maxFraction are skipped.
+        /// A callback that drops maxFraction below zero ends the walk (any-hit queries).
+        /// </summary>
+        /// <returns>true if any call to leafFunc returned true</returns>
+        template <typename LeafFunc>
+        static bool RayCast(const BvhNode* pNodes, const Vector3& from, const Vector3& to, float& maxFraction, LeafFunc leafFunc)
+        {
+            Vector3 invDir = GetInvDir(to - from);
+            float enter;
+            if (false == pNodes[0].mBounds.RayCast(from, invDir, maxFraction, &enter))
+            {
+                return false;
+            }
+
+            struct StackEntry {
+                int mNode;
+                float mEnter;
+            };
+            StackEntry stack[MAX_DEPTH + 1];
+            int stackSize = 0;
+            int node = 0;
+            bool hit = false;
+            for (;;)
+            {
+                const BvhNode& cur = pNodes[node];
+                if (cur.mCount > 0)
+                {
+                    hit |= leafFunc(cur.mFirst, cur.mCount, maxFraction);
+                }
+                else
+                {
+                    float enterA, enterB;
+                    bool hitA = pNodes[cur.mFirst].mBounds.RayCast(from, invDir, maxFraction, &enterA);
+                    bool hitB = pNodes[cur.mFirst + 1].mBounds.RayCast(from, invDir, maxFraction, &enterB);
+                    if (hitA && hitB)
+                    {
+                        if (enterA <= enterB)
+                        {
+                            stack[stackSize++] = { cur.mFirst + 1, enterB };
+                            node = cur.mFirst;
+                        }
+                        else
+                        {
+                            stack[stackSize++] = { cur.mFirst, enterA };
+                            node = cur.mFirst + 1;
+                        }
+                        continue;
+                    }
+                    if (hitA || hitB)
+                    {
+                        node = hitA ? cur.mFirst : cur.mFirst + 1;
+                        continue;
+                    }
+                }
+
+                // pop the next subtree that is still in front of the closest hit
+                node = -1;
+                while (stackSize > 0)
+                {
+                    const StackEntry& entry = stack[--stackSize];
+                    if (entry.mEnter <= maxFraction)
+                    {
+                        node = entry.mNode;
+                        break;
+                    }
+                }
+                if (node < 0)
+                {
+                    break;
+                }
+            }
+            return hit;
+        }
+
+        template <typename LeafFunc>
+        bool RayCast(const Vector3& from, const Vector3& to, float& maxFraction, LeafFunc leafFunc) const
+        {
+            if (IsEmpty())
+            {
+                return false;
+            }
+            return RayCast(GetNodes(), from, to, maxFraction, leafFunc);
+        }
+
+    private:
+        std::vector<BvhNode> mNodes;
+        std::vector<int> mPrimOrder;
+        const BvhNode* mExternalNodes;  // not owned, replaces mNodes if set
+        int mExternalCount;
+    };
+}
@@ -0,0 +1,365 @@
+#include "DynamicTree.h"
+
+namespace Physics {
+
+    const int DynamicTree::NULL_NODE;
+
+    DynamicTree::DynamicTree()
+        : mRoot(NULL_NODE)
+        , mFreeList(NULL_NODE)
+        , mProxyCount(0)
+    {}
+
+    /// <summary>
+    /// Add a proxy for an object to the tree
+    /// </summary>
+    /// <param name="bounds">the tight bounds of the object, the tree stores a fat copy of them</param>
+    /// <param name="userData">returned to the ray cast callback for this proxy</param>
+    /// <returns>the id of the proxy, stable until it is destroyed</returns>
+    int DynamicTree::CreateProxy(const AABB& bounds, int userData)
+    {
+        int proxy = AllocateNode();
+        Node& node = mNodes[proxy];
+        node.mBounds = MakeFat(bounds);
+        node.mUserData = userData;
+        node.mHeight = 0;
+        InsertLeaf(proxy);
+        ++mProxyCount;
+        return proxy;
+    }
+
+    void DynamicTree::DestroyProxy(int proxy)
+    {
+        RemoveLeaf(proxy);
+        FreeNode(proxy);
+        --mProxyCount;
+    }
+
+    /// <summary>
+    /// Tell the tree the object behind a proxy has new bounds
+    /// If they still fit inside the proxy's fat bounds nothing happens, otherwise the proxy is re-inserted
+    /// </summary>
+    /// <param name="proxy">the proxy that moved</param>
+    /// <param name="bounds">the new tight bounds of the object</param>
+    /// <returns>true if the proxy had to be re-inserted</returns>
+    bool DynamicTree::MoveProxy(int proxy, const AABB& bounds)
+    {
+        const AABB& fat = mNodes[proxy].mBounds;
+        if (fat.mMin.x <= bounds.mMin.x && fat.mMin.y <= bounds.mMin.y && fat.mMin.z <= bounds.mMin.z &&
+            bounds.mMax.x <= fat.mMax.x && bounds.mMax.y <= fat.mMax.y && bounds.mMax.z <= fat.mMax.z)
+        {
+            return false;
+        }
+        RemoveLeaf(proxy);
+        mNodes[proxy].mBounds = MakeFat(bounds);
+        InsertLeaf(proxy);
+        return true;
+    }
+
+    void DynamicTree::Clear()
+    {
+        mNodes.clear();
+        mRoot = NULL_NODE;
+        mFreeList = NULL_NODE;
+        mProxyCount = 0;
+    }
+
+    AABB DynamicTree::MakeFat(const AABB& bounds)
+    {
+        Vector3 margin = FAT_MARGIN * (bounds.mMax - bounds.mMin);
+        return AABB(bounds.mMin - margin, bounds.mMax + margin);
+    }
+
+    int DynamicTree::AllocateNode()
+    {
+        int node = mFreeList;
+        if (node == NULL_NODE)
+        {
+            node = (int)mNodes.size();
+            mNodes.emplace_back();
+        }
+        else
+        {
+            mFreeList = mNodes[node].mParent;
+        }
+        Node& n = mNodes[node];
+        n.mParent = NULL_NODE;
+        n.mChild1 = NULL_NODE;
+        n.mChild2 = NULL_NODE;
+        n.mHeight = 0;
+        n.mUserData = -1;
+        return node;
+    }
+
+    void DynamicTree::FreeNode(int node)
+    {
+        mNodes[node].mParent = mFreeList;
+        mNodes[node].mHeight = -1;
+        mFreeList = node;
+    }
+
+    /// <summary>
+    /// Insert a leaf where it costs the least surface area (branch and bound down the tree on the SAH cost),
+    /// then refit and rebalance every ancestor
+    /// </summary>
+    void DynamicTree::InsertLeaf(int leaf)
+    {
+        if (mRoot == NULL_NODE)
+        {
+            mRoot = leaf;
+            mNodes[leaf].mParent = NULL_NODE;
+            return;
+        }
+
+        // find the best sibling
+        AABB leafBounds = mNodes[leaf].mBounds;
+        int index = mRoot;
+        while (false == mNodes[index].IsLeaf())
+        {
+            const Node& node = mNodes[index];
+            float area = node.mBounds.GetSurfaceArea();
+            AABB combined = node.mBounds;
+            combined.AddBox(leafBounds);
+            float combinedArea = combined.GetSurfaceArea();
+
+            // cost of making a new parent for this node and the new leaf
+            float cost = 2.0f * combinedArea;
+            // minimum cost of pushing the leaf further down the tree
+            float inheritanceCost = 2.0f * (combinedArea - area);
+
+            float childCost[2];
+            int children[2] = { node.mChild1, node.mChild2 };
+            for (int c = 0; c < 2; ++c)
+            {
+                const Node& child = mNodes[children[c]];
+                AABB box = child.mBounds;
+                box.AddBox(leafBounds);
+                childCost[c] = child.IsLeaf()
+                    ? box.GetSurfaceArea() + inheritanceCost
+                    : box.GetSurfaceArea() - child.mBounds.GetSurfaceArea() + inheritanceCost;
+            }
+
+            if (cost < childCost[0] && cost < childCost[1])
+            {
+                break;
+            }
+            index = childCost[0] < childCost[1] ? children[0] : children[1];
+        }
+        int sibling = index;
+
+        // create a new parent for the sibling and the leaf
+        int oldParent = mNodes[sibling].mParent;
+        int newParent = AllocateNode();
+        mNodes[newParent].mParent = oldParent;
+        mNodes[newParent].mBounds = leafBounds;
+        mNodes[newParent].mBounds.AddBox(mNodes[sibling].mBounds);
+        mNodes[newParent].mHeight = mNodes[sibling].mHeight + 1;
+        mNodes[newParent].mChild1 = sibling;
+        mNodes[newParent].mChild2 = leaf;
+        mNodes[sibling].mParent = newParent;
+        mNodes[leaf].mParent = newParent;
+        if (oldParent == NULL_NODE)
+        {
+            mRoot = newParent;
+        }
+        else if (mNodes[oldParent].mChild1 == sibling)
+        {
+            mNodes[oldParent].mChild1 = newParent;
+        }
+        else
+        {
+            mNodes[oldParent].mChild2 = newParent;
+        }
+
+        // walk back up fixing heights and bounds
+        index = mNodes[leaf].mParent;
+        while (index != NULL_NODE)
+        {
+            index = Balance(index);
+            Node& node = mNodes[index];
+            const Node& child1 = mNodes[node.mChild1];
+            const Node& child2 = mNodes[node.mChild2];
+            node.mHeight = 1 + Math::Max(child1.mHeight, child2.mHeight);
+            node.mBounds = child1.mBounds;
+            node.mBounds.AddBox(child2.mBounds);
+            index = node.mParent;
+        }
+    }
+
+    /// <summary>
+    /// Take a leaf out of the tree, its sibling replaces their parent
+    /// </summary>
+    void DynamicTree::RemoveLeaf(int leaf)
+    {
+        if (leaf == mRoot)
+        {
+            mRoot = NULL_NODE;
+            return;
+        }
+
+        int parent = mNodes[leaf].mParent;
+        int grandParent = mNodes[parent].mParent;
+        int sibling = mNodes[parent].mChild1 == leaf ? mNodes[parent].mChild2 : mNodes[parent].mChild1;
+        FreeNode(parent);
+        if (grandParent == NULL_NODE)
+        {
+            mRoot = sibling;
+            mNodes[sibling].mParent = NULL_NODE;
+            return;
+        }
+
+        if (mNodes[grandParent].mChild1 == parent)
+        {
+            mNodes[grandParent].mChild1 = sibling;
+        }
+        else
+        {
+            mNodes[grandParent].mChild2 = sibling;
+        }
+        mNodes[sibling].mParent = grandParent;
+
+        int index = grandParent;
+        while (index != NULL_NODE)
+        {
+            index = Balance(index);
+            Node& node = mNodes[index];
+            const Node& child1 = mNodes[node.mChild1];
+            const Node& child2 = mNodes[node.mChild2];
+            node.mBounds = child1.mBounds;
+            node.mBounds.AddBox(child2.mBounds);
+            node.mHeight = 1 + Math::Max(child1.mHeight, child2.mHeight);
+            index = node.mParent;
+        }
+    }
+
+    /// <summary>
+    /// If one child of node "a" is more than one level taller than the other, rotate the taller child up
+    /// </summary>
+    /// <returns>the node now at a's place in the tree</returns>
+    int DynamicTree::Balance(int iA)
+    {
+        Node& a = mNodes[iA];
+        if (a.IsLeaf() || a.mHeight < 2)
+        {
+            return iA;
+        }
+
+        int iB = a.mChild1;
+        int iC = a.mChild2;
+        Node& b = mNodes[iB];
+        Node& c = mNodes[iC];
+        int balance = c.mHeight - b.mHeight;
+
+        // rotate the taller child (c or b) up, keeping the best of its children in a
+        auto rotateUp = [&](int iUp, int iOther, bool upIsChild2) {
+            Node& up = mNodes[iUp];
+            Node& other = mNodes[iOther];
+            int iF = up.mChild1;
+            int iG = up.mChild2;
+            Node& f = mNodes[iF];
+            Node& g = mNodes[iG];
+
+            // swap "a" and "up"
+            up.mChild1 = iA;
+            up.mParent = a.mParent;
+            a.mParent = iUp;
+            if (up.mParent != NULL_NODE)
+            {
+                if (mNodes[up.mParent].mChild1 == iA)
+                {
+                    mNodes[up.mParent].mChild1 = iUp;
+                }
+                else
+                {
+                    mNodes[up.mParent].mChild2 = iUp;
+                }
+            }
+            else
+            {
+                mRoot = iUp;
+            }
+
+            // the taller grandchild stays under "up", the other one moves to "a"
+            int iKeep = f.mHeight > g.mHeight ? iF : iG;
+            int iMove = f.mHeight > g.mHeight ? iG : iF;
+            up.mChild2 = iKeep;
+            if (upIsChild2)
+            {
+                a.mChild2 = iMove;
+            }
+            else
+            {
+                a.mChild1 = iMove;
+            }
+            mNodes[iMove].mParent = iA;
+            a.mBounds = other.mBounds;
+            a.mBounds.AddBox(mNodes[iMove].mBounds);
+            up.mBounds = a.mBounds;
+            up.mBounds.AddBox(mNodes[iKeep].mBounds);
+            a.mHeight = 1 + Math::Max(other.mHeight, mNodes[iMove].mHeight);
+            up.mHeight = 1 + Math::Max(a.mHeight, mNodes[iKeep].mHeight);
+            return iUp;
+        };
+
+        if (balance > 1)
+        {
+            return rotateUp(iC, iB, true);
+        }
+        if (balance < -1)
+        {
+            return rotateUp(iB, iC, false);
+        }
+        return iA;
+    }
+
+    /// <summary>
+    /// Check the structure of the tree: parent links, heights and that every node's bounds contain its children
+    /// </summary>
+    /// <returns>true if the tree is consistent</returns>
+    bool DynamicTree::Validate() const
+    {
+        if (mRoot == NULL_NODE)
+        {
+            return mProxyCount == 0;
+        }
+        if (mNodes[mRoot].mParent != NULL_NODE)
+        {
+            return false;
+        }
+        return ValidateNode(mRoot) == mProxyCount;
+    }
+
+    /// <returns>the number of leaves under the node, or -1 if anything is wrong</returns>
+    int DynamicTree::ValidateNode(int index) const
+    {
+        const Node& node = mNodes[index];
+        if (node.IsLeaf())
+        {
+            return node.mHeight == 0 ? 1 : -1;
+        }
+        const Node& child1 = mNodes[node.mChild1];
+        const Node& child2 = mNodes[node.mChild2];
+        if (child1.mParent != index || child2.mParent != index)
+        {
+            return -1;
+        }
+        if (node.mHeight != 1 + Math::Max(child1.mHeight, child2.mHeight))
+        {
+            return -1;
+        }
+        AABB combined = child1.mBounds;
+        combined.AddBox(child2.mBounds);
+        if (false == Math::CloseEnough(combined.mMin, node.mBounds.mMin, 0.0f) ||
+            false == Math::CloseEnough(combined.mMax, node.mBounds.mMax, 0.0f))
+        {
+            return -1;
+        }
+        int left = ValidateNode(node.mChild1);
+        int right = ValidateNode(node.mChild2);
+        if (left < 0 || right < 0)
+        {
+            return -1;
+        }
+        return left + right;
+    }
+}
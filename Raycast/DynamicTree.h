@@ -0,0 +1,138 @@
+#pragma once
+#include "Bvh.h"
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// A dynamic AABB tree for objects that move
+    /// Every leaf (proxy) stores a "fat" AABB that is bigger than the object, so small moves that stay inside it cost nothing.
+    /// Leaves are inserted where they grow the tree's surface area the least, and the tree is kept balanced with rotations
+    /// on the way back up, so queries stay logarithmic no matter the order of inserts and removals.
+    /// </summary>
+    class DynamicTree {
+    public:
+        static const int NULL_NODE = -1;
+        // the fat AABB is the object's bounds grown by this fraction of its size on every side
+        static constexpr float FAT_MARGIN = 0.1f;
+        // the tree is height balanced (children differ by at most 1), so the height stays far below this
+        static const int MAX_STACK = 64;
+
+        DynamicTree();
+
+        int CreateProxy(const AABB& bounds, int userData);
+        void DestroyProxy(int proxy);
+        bool MoveProxy(int proxy, const AABB& bounds);
+        void Clear();
+
+        int GetUserData(int proxy) const { return mNodes[proxy].mUserData; }
+        const AABB& GetFatBounds(int proxy) const { return mNodes[proxy].mBounds; }
+        int GetHeight() const { return mRoot == NULL_NODE ? 0 : mNodes[mRoot].mHeight; }
+        int GetProxyCount() const { return mProxyCount; }
+        bool Validate() const;
+
+        /// <summary>
+        /// Walk the tree front to back along the segment from -> to
+        /// proxyFunc(userData, maxFraction) is called for every proxy whose fat bounds the segment reaches; it returns true
+        /// if it found a hit, in which case it must have lowered maxFraction to the fraction of that hit.
+        /// A callback that drops maxFraction below zero ends the walk (any-hit queries).
+        /// </summary>
+        /// <returns>true if any call to proxyFunc returned true</returns>
+        template <typename ProxyFunc>
+        bool RayCast(const Vector3& from, const Vector3& to, float& maxFraction, ProxyFunc proxyFunc) const
+        {
+            if (mRoot == NULL_NODE)
+            {
+                return false;
+            }
+            Vector3 invDir = Bvh::GetInvDir(to - from);
+            float enter;
+            if (false == mNodes[mRoot].mBounds.RayCast(from, invDir, maxFraction, &enter))
+            {
+                return false;
+            }
+
+            struct StackEntry {
+                int mNode;
+                float mEnter;
+            };
+            StackEntry stack[MAX_STACK];
+            int stackSize = 0;
+            int node = mRoot;
+            bool hit = false;
+            for (;;)
+            {
+                const Node& cur = mNodes[node];
+                if (cur.IsLeaf())
+                {
+                    hit |= proxyFunc(cur.mUserData, maxFraction);
+                }
+                else
+                {
+                    float enterA, enterB;
+                    bool hitA = mNodes[cur.mChild1].mBounds.RayCast(from, invDir, maxFraction, &enterA);
+                    bool hitB = mNodes[cur.mChild2].mBounds.RayCast(from, invDir, maxFraction, &enterB);
+                    if (hitA && hitB)
+                    {
+                        if (enterA <= enterB)
+                        {
+                            stack[stackSize++] = { cur.mChild2, enterB };
+                            node = cur.mChild1;
+                        }
+                        else
+                        {
+                            stack[stackSize++] = { cur.mChild1, enterA };
+                            node = cur.mChild2;
+                        }
+                        continue;
+                    }
+                    if (hitA || hitB)
+                    {
+                        node = hitA ? cur.mChild1 : cur.mChild2;
+                        continue;
+                    }
+                }
+
+                node = NULL_NODE;
+                while (stackSize > 0)
+                {
+                    const StackEntry& entry = stack[--stackSize];
+                    if (entry.mEnter <= maxFraction)
+                    {
+                        node = entry.mNode;
+                        break;
+                    }
+                }
+                if (node == NULL_NODE)
+                {
+                    break;
+                }
+            }
+            return hit;
+        }
+
+    private:
+        struct Node {
+            AABB mBounds;
+            int mParent;    // also the next free node when the node is on the free list
+            int mChild1;
+            int mChild2;
+            int mHeight;    // leaves are 0, free nodes are -1
+            int mUserData;
+            bool IsLeaf() const { return mChild1 == NULL_NODE; }
+        };
+
+        int AllocateNode();
+        void FreeNode(int node);
+        void InsertLeaf(int leaf);
+        void RemoveLeaf(int leaf);
+        int Balance(int node);
+        int ValidateNode(int node) const;
+        static AABB MakeFat(const AABB& bounds);
+
+        std::vector<Node> mNodes;
+        int mRoot;
+        int mFreeList;
+        int mProxyCount;
+    };
+}
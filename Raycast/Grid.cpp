@@ -0,0 +1,146 @@
+#include "Grid.h"
+#include <algorithm>
+
+namespace Physics {
+
+    namespace {
+        // target number of cells per primitive, and the most cell references we allow per primitive
+        // before the resolution is lowered (big primitives would otherwise fill every cell)
+        const float CELLS_PER_PRIM = 2.0f;
+        const size_t MAX_REFS_PER_PRIM = 64;
+
+        struct Mailbox {
+            std::vector<uint32_t> mStamps;
+            uint32_t mStamp = 0;
+        };
+
+        thread_local Mailbox s_mailbox;
+    }
+
+    Grid::Grid()
+        : mRes{ 0, 0, 0 }
+        , mCellSize{ 0.0f, 0.0f, 0.0f }
+        , mInvCellSize{ 0.0f, 0.0f, 0.0f }
+        , mPrimCount(0)
+    {}
+
+    /// <summary>
+    /// Build the grid over the given primitive bounds
+    /// The resolution follows the shape of the scene bounds, aiming for CELLS_PER_PRIM cells per primitive,
+    /// and is lowered until the total number of cell references fits in MAX_REFS_PER_PRIM per primitive
+    /// </summary>
+    /// <param name="pPrimBounds">the bounds of each primitive</param>
+    /// <param name="primCount">the number of primitives</param>
+    void Grid::Build(const AABB* pPrimBounds, int primCount)
+    {
+        Clear();
+        if (primCount <= 0)
+        {
+            return;
+        }
+        mPrimCount = primCount;
+        for (int i = 0; i < primCount; ++i)
+        {
+            mBounds.AddBox(pPrimBounds[i]);
+        }
+
+        Vector3 size = mBounds.mMax - mBounds.mMin;
+        const float* pSize = size.GetAsFloatPtr();
+        float maxSize = Math::Max(pSize[0], Math::Max(pSize[1], pSize[2]));
+        float volume = Math::Max(pSize[0], 1e-6f * maxSize) * Math::Max(pSize[1], 1e-6f * maxSize) * Math::Max(pSize[2], 1e-6f * maxSize);
+        float cellsPerUnit = cbrtf(CELLS_PER_PRIM * primCount / Math::Max(volume, 1e-30f));
+
+        const size_t maxRefs = MAX_REFS_PER_PRIM * primCount;
+        const float* pMin = mBounds.mMin.GetAsFloatPtr();
+        std::vector<int> range(6 * primCount);
+        for (;;)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                mRes[axis] = Math::Clamp((int)(pSize[axis] * cellsPerUnit), 1, MAX_RES);
+                mCellSize[axis] = pSize[axis] / mRes[axis];
+                mInvCellSize[axis] = mCellSize[axis] > 0.0f ? 1.0f / mCellSize[axis] : 0.0f;
+            }
+
+            // cell range covered by every primitive, and the total number of references that makes
+            size_t refs = 0;
+            for (int i = 0; i < primCount; ++i)
+            {
+                int* pRange = &range[6 * i];
+                size_t cells = 1;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    float lo = (pPrimBounds[i].mMin.GetAsFloatPtr()[axis] - pMin[axis]) * mInvCellSize[axis];
+                    float hi = (pPrimBounds[i].mMax.GetAsFloatPtr()[axis] - pMin[axis]) * mInvCellSize[axis];
+                    pRange[axis] = Math::Clamp((int)lo, 0, mRes[axis] - 1);
+                    pRange[axis + 3] = Math::Clamp((int)hi, 0, mRes[axis] - 1);
+                    cells *= pRange[axis + 3] - pRange[axis] + 1;
+                }
+                refs += cells;
+            }
+            bool atMinimum = mRes[0] == 1 && mRes[1] == 1 && mRes[2] == 1;
+            if (refs <= maxRefs || atMinimum)
+            {
+                break;
+            }
+            cellsPerUnit *= 0.5f;
+        }
+
+        // counting sort of the references into their cells
+        int cellCount = GetCellCount();
+        mCellStart.assign(cellCount + 1, 0);
+        for (int i = 0; i < primCount; ++i)
+        {
+            const int* pRange = &range[6 * i];
+            for (int z = pRange[2]; z <= pRange[5]; ++z)
+                for (int y = pRange[1]; y <= pRange[4]; ++y)
+                    for (int x = pRange[0]; x <= pRange[3]; ++x)
+                        mCellStart[(z * mRes[1] + y) * mRes[0] + x + 1]++;
+        }
+        for (int c = 0; c < cellCount; ++c)
+        {
+            mCellStart[c + 1] += mCellStart[c];
+        }
+        mRefs.resize(mCellStart[cellCount]);
+        std::vector<uint32_t> fill(mCellStart.begin(), mCellStart.end() - 1);
+        for (int i = 0; i < primCount; ++i)
+        {
+            const int* pRange = &range[6 * i];
+            for (int z = pRange[2]; z <= pRange[5]; ++z)
+                for (int y = pRange[1]; y <= pRange[4]; ++y)
+                    for (int x = pRange[0]; x <= pRange[3]; ++x)
+                        mRefs[fill[(z * mRes[1] + y) * mRes[0] + x]++] = (uint32_t)i;
+        }
+    }
+
+    void Grid::Clear()
+    {
+        mBounds = AABB();
+        mRes[0] = mRes[1] = mRes[2] = 0;
+        mPrimCount = 0;
+        mCellStart.clear();
+        mRefs.clear();
+    }
+
+    /// <summary>
+    /// Start a new query on this thread
+    /// Every query gets a fresh stamp, so marking a primitive as tested is a single store and nothing has to be cleared
+    /// </summary>
+    /// <param name="ppMailbox">filled in with the per thread mailbox, big enough for this grid</param>
+    /// <returns>the stamp for this query</returns>
+    uint32_t Grid::NewQuery(uint32_t** ppMailbox) const
+    {
+        Mailbox& mailbox = s_mailbox;
+        if (mailbox.mStamps.size() < (size_t)mPrimCount)
+        {
+            mailbox.mStamps.resize(mPrimCount, 0);
+        }
+        if (++mailbox.mStamp == 0)
+        {   // wrapped around, old stamps could collide
+            std::fill(mailbox.mStamps.begin(), mailbox.mStamps.end(), 0);
+            mailbox.mStamp = 1;
+        }
+        *ppMailbox = mailbox.mStamps.data();
+        return mailbox.mStamp;
+    }
+}
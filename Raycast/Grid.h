@@ -0,0 +1,132 @@
+#pragma once
+#include "Bvh.h"
+#include <cstdint>
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// A uniform spatial grid over a set of primitive bounds, walked with a 3D-DDA
+    /// Each cell lists every primitive whose bounds overlap it, stored compactly (cell start offsets + one array of references)
+    /// Primitives that span several cells are only handed to the caller once per query (mailboxing)
+    /// </summary>
+    class Grid {
+    public:
+        static const int MAX_RES = 128;
+
+        Grid();
+
+        void Build(const AABB* pPrimBounds, int primCount);
+        void Clear();
+
+        bool IsEmpty() const { return mCellStart.empty(); }
+        const AABB& GetBounds() const { return mBounds; }
+        int GetCellCount() const { return mRes[0] * mRes[1] * mRes[2]; }
+        size_t GetRefCount() const { return mRefs.size(); }
+
+        /// <summary>
+        /// Walk the cells along the segment from -> to, in order
+        /// primFunc(prim, maxFraction) is called once for every primitive in the visited cells; it returns true if
+        /// it found a hit, in which case it must have lowered maxFraction to the fraction of that hit.
+        /// The walk stops as soon as the closest hit is known to be inside the current cell.
+        /// A callback that drops maxFraction below zero ends the walk (any-hit queries).
+        /// </summary>
+        /// <returns>true if any call to primFunc returned true</returns>
+        template <typename PrimFunc>
+        bool RayCast(const Vector3& from, const Vector3& to, float& maxFraction, PrimFunc primFunc) const
+        {
+            if (IsEmpty())
+            {
+                return false;
+            }
+            Vector3 dir = to - from;
+            Vector3 invDir = Bvh::GetInvDir(dir);
+            float enter;
+            if (false == mBounds.RayCast(from, invDir, maxFraction, &enter))
+            {
+                return false;
+            }
+
+            // set up the DDA at the point the segment enters the grid
+            const float* pFrom = from.GetAsFloatPtr();
+            const float* pDir = dir.GetAsFloatPtr();
+            const float* pInvDir = invDir.GetAsFloatPtr();
+            const float* pMin = mBounds.mMin.GetAsFloatPtr();
+            int cell[3];
+            int step[3];
+            int stop[3];
+            float tNext[3];
+            float tDelta[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float p = pFrom[axis] + enter * pDir[axis];
+                int c = (int)((p - pMin[axis]) * mInvCellSize[axis]);
+                c = Math::Clamp(c, 0, mRes[axis] - 1);
+                cell[axis] = c;
+                if (pDir[axis] > 0.0f)
+                {
+                    step[axis] = 1;
+                    stop[axis] = mRes[axis];
+                    tNext[axis] = (pMin[axis] + (c + 1) * mCellSize[axis] - pFrom[axis]) * pInvDir[axis];
+                    tDelta[axis] = mCellSize[axis] * pInvDir[axis];
+                }
+                else if (pDir[axis] < 0.0f)
+                {
+                    step[axis] = -1;
+                    stop[axis] = -1;
+                    tNext[axis] = (pMin[axis] + c * mCellSize[axis] - pFrom[axis]) * pInvDir[axis];
+                    tDelta[axis] = -mCellSize[axis] * pInvDir[axis];
+                }
+                else
+                {
+                    step[axis] = 0;
+                    stop[axis] = -1;
+                    tNext[axis] = Math::Infinity;
+                    tDelta[axis] = Math::Infinity;
+                }
+            }
+
+            uint32_t* pMailbox = nullptr;
+            uint32_t stamp = NewQuery(&pMailbox);
+            bool hit = false;
+            for (;;)
+            {
+                int cellIndex = (cell[2] * mRes[1] + cell[1]) * mRes[0] + cell[0];
+                for (uint32_t r = mCellStart[cellIndex]; r < mCellStart[cellIndex + 1]; ++r)
+                {
+                    uint32_t prim = mRefs[r];
+                    if (pMailbox[prim] == stamp)
+                    {
+                        continue;
+                    }
+                    pMailbox[prim] = stamp;
+                    hit |= primFunc((int)prim, maxFraction);
+                }
+
+                int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+                if (maxFraction <= tNext[axis])
+                {   // nothing further along can be closer
+                    break;
+                }
+                cell[axis] += step[axis];
+                if (cell[axis] == stop[axis])
+                {
+                    break;
+                }
+                tNext[axis] += tDelta[axis];
+            }
+            return hit;
+        }
+
+    private:
+        uint32_t NewQuery(uint32_t** ppMailbox) const;
+
+        AABB mBounds;
+        int mRes[3];
+        float mCellSize[3];
+        float mInvCellSize[3];
+        int mPrimCount;
+        std::vector<uint32_t> mCellStart;
+        std::vector<uint32_t> mRefs;
+    };
+}
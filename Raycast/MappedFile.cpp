@@ -0,0 +1,108 @@
+#include "MappedFile.h"
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Physics {
+
+    MappedFile::MappedFile()
+        : mData(nullptr)
+        , mSize(0)
+#if defined(_WIN32)
+        , mFile(INVALID_HANDLE_VALUE)
+        , mMapping(nullptr)
+#endif
+    {}
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    /// <summary>
+    /// Map the whole of a file, closing whatever was mapped before
+    /// </summary>
+    /// <param name="path">the file to map</param>
+    /// <returns>false if the file cannot be opened or mapped, or is empty</returns>
+    bool MappedFile::Open(const char* path)
+    {
+        Close();
+#if defined(_WIN32)
+        mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (mFile == INVALID_HANDLE_VALUE || false == GetFileSizeEx(mFile, &size) || size.QuadPart <= 0)
+        {
+            Close();
+            return false;
+        }
+        mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mMapping == nullptr)
+        {
+            Close();
+            return false;
+        }
+        mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        if (mData == nullptr)
+        {
+            Close();
+            return false;
+        }
+        mSize = (size_t)size.QuadPart;
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* pData = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);  // the mapping keeps the file open
+        if (pData == MAP_FAILED)
+        {
+            return false;
+        }
+        mData = static_cast<const char*>(pData);
+        mSize = (size_t)info.st_size;
+#endif
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+#if defined(_WIN32)
+        if (mData != nullptr)
+        {
+            UnmapViewOfFile(mData);
+        }
+        if (mMapping != nullptr)
+        {
+            CloseHandle(mMapping);
+        }
+        if (mFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(mFile);
+        }
+        mFile = INVALID_HANDLE_VALUE;
+        mMapping = nullptr;
+#else
+        if (mData != nullptr)
+        {
+            munmap(const_cast<char*>(mData), mSize);
+        }
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+
+namespace Physics
+{
+    /// <summary>
+    /// A whole file mapped read only into memory, unmapped when the MappedFile goes away
+    /// The pages are only read from disk as they are touched, and the OS shares them between processes mapping the same file.
+    /// GetData() starts on a page boundary, so anything at an aligned offset in the file is aligned in memory too.
+    /// </summary>
+    class MappedFile {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const char* path);
+        void Close();
+
+        bool IsOpen() const { return mData != nullptr; }
+        const char* GetData() const { return mData; }
+        size_t GetSize() const { return mSize; }
+
+    private:
+        const char* mData;
+        size_t mSize;
+#if defined(_WIN32)
+        void* mFile;
+        void* mMapping;
+#endif
+    };
+}
@@ -16,10 +16,10 @@ const Vector3 Vector3::NegUnitZ(0.0f, 0.0f, -1.0f);
 const Vector3 Vector3::Infinity(Math::Infinity, Math::Infinity, Math::Infinity);
 const Vector3 Vector3::NegInfinity(Math::NegInfinity, Math::NegInfinity, Math::NegInfinity);
 
-static float m3Ident[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+static constexpr float m3Ident[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
 const Matrix3 Matrix3::Identity(m3Ident);
 
-static float m4Ident[4][4] = {{1.0f, 0.0f, 0.0f, 0.0f},
+static constexpr float m4Ident[4][4] = {{1.0f, 0.0f, 0.0f, 0.0f},
 							  {0.0f, 1.0f, 0.0f, 0.0f},
 							  {0.0f, 0.0f, 1.0f, 0.0f},
 							  {0.0f, 0.0f, 0.0f, 1.0f}};
@@ -39,6 +39,16 @@ Vector2 Vector2::Transform(const Vector2& vec, const Matrix3& mat, float w /*= 1
 
 Vector3 Vector3::Transform(const Vector3& vec, const Matrix4& mat, float w /*= 1.0f*/)
 {
+#if MATH_SSE
+	// the rows weighted by the components, summed in the same order as the scalar code
+	__m128 row = _mm_mul_ps(_mm_set1_ps(vec.x), _mm_loadu_ps(mat.mat[0]));
+	row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(vec.y), _mm_loadu_ps(mat.mat[1])));
+	row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(vec.z), _mm_loadu_ps(mat.mat[2])));
+	row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(w), _mm_loadu_ps(mat.mat[3])));
+	float out[4];
+	_mm_storeu_ps(out, row);
+	return Vector3(out[0], out[1], out[2]);
+#else
 	Vector3 retVal;
 	retVal.x = vec.x * mat.mat[0][0] + vec.y * mat.mat[1][0] + vec.z * mat.mat[2][0] +
 			   w * mat.mat[3][0];
@@ -48,6 +58,62 @@ Vector3 Vector3::Transform(const Vector3& vec, const Matrix4& mat, float w /*= 1
 			   w * mat.mat[3][2];
 	// ignore w since we aren't returning a new value for it...
 	return retVal;
+#endif
+}
+
+#if MATH_SSE
+// _mm_shuffle_ps(p, q, ...) taking p[i], p[j], q[k], q[l]
+#define MATH_SHUFFLE(p, q, i, j, k, l) _mm_shuffle_ps((p), (q), _MM_SHUFFLE(l, k, j, i))
+#endif
+
+void Vector3::TransformMany(const Vector3* pIn, Vector3* pOut, size_t count, const Matrix4& mat, float w /*= 1.0f*/)
+{
+	size_t i = 0;
+#if MATH_SSE
+	// 4 vectors at a time: 12 floats in 3 registers, shuffled to x, y and z of the 4, transformed
+	// a component at a time (in the same order as Transform), then shuffled back
+	__m128 m[4][3];
+	for (int r = 0; r < 4; r++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			m[r][c] = _mm_set1_ps(r == 3 ? w * mat.mat[r][c] : mat.mat[r][c]);
+		}
+	}
+	for (; i + 4 <= count; i += 4)
+	{
+		const float* pSrc = &pIn[i].x;
+		__m128 a = _mm_loadu_ps(pSrc);
+		__m128 b = _mm_loadu_ps(pSrc + 4);
+		__m128 c = _mm_loadu_ps(pSrc + 8);
+		__m128 x = MATH_SHUFFLE(a, MATH_SHUFFLE(b, c, 2, 2, 1, 1), 0, 3, 0, 2);
+		__m128 y = MATH_SHUFFLE(MATH_SHUFFLE(a, b, 1, 1, 0, 0), MATH_SHUFFLE(b, c, 3, 3, 2, 2), 0, 2, 0, 2);
+		__m128 z = MATH_SHUFFLE(MATH_SHUFFLE(a, b, 2, 2, 1, 1), MATH_SHUFFLE(c, c, 0, 0, 3, 3), 0, 2, 0, 2);
+
+		__m128 out[3];
+		for (int col = 0; col < 3; col++)
+		{
+			__m128 v = _mm_mul_ps(x, m[0][col]);
+			v = _mm_add_ps(v, _mm_mul_ps(y, m[1][col]));
+			v = _mm_add_ps(v, _mm_mul_ps(z, m[2][col]));
+			out[col] = _mm_add_ps(v, m[3][col]);
+		}
+		x = out[0];
+		y = out[1];
+		z = out[2];
+		a = MATH_SHUFFLE(MATH_SHUFFLE(x, y, 0, 0, 0, 0), MATH_SHUFFLE(z, x, 0, 0, 1, 1), 0, 2, 0, 2);
+		b = MATH_SHUFFLE(MATH_SHUFFLE(y, z, 1, 1, 1, 1), MATH_SHUFFLE(x, y, 2, 2, 2, 2), 0, 2, 0, 2);
+		c = MATH_SHUFFLE(MATH_SHUFFLE(z, x, 2, 2, 3, 3), MATH_SHUFFLE(y, z, 3, 3, 3, 3), 0, 2, 0, 2);
+		float* pDst = &pOut[i].x;
+		_mm_storeu_ps(pDst, a);
+		_mm_storeu_ps(pDst + 4, b);
+		_mm_storeu_ps(pDst + 8, c);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		pOut[i] = Transform(pIn[i], mat, w);
+	}
 }
 
 // This will transform the vector and renormalize the w component
@@ -196,6 +262,129 @@ void Matrix4::Invert()
 	}
 }
 
+// Write an affine inverse given the columns of its 3x3 block and its translation, negated
+// (straight into the matrix: going through a temporary array stalls on the copy back)
+static void SetAffineInverse(Matrix4& m, const Vector3& c0, const Vector3& c1, const Vector3& c2, const Vector3& negTrans)
+{
+	m.mat[0][0] = c0.x;
+	m.mat[0][1] = c1.x;
+	m.mat[0][2] = c2.x;
+	m.mat[0][3] = 0.0f;
+	m.mat[1][0] = c0.y;
+	m.mat[1][1] = c1.y;
+	m.mat[1][2] = c2.y;
+	m.mat[1][3] = 0.0f;
+	m.mat[2][0] = c0.z;
+	m.mat[2][1] = c1.z;
+	m.mat[2][2] = c2.z;
+	m.mat[2][3] = 0.0f;
+	m.mat[3][0] = -negTrans.x;
+	m.mat[3][1] = -negTrans.y;
+	m.mat[3][2] = -negTrans.z;
+	m.mat[3][3] = 1.0f;
+}
+
+// The inverse of the 3x3 block has the cross products of its rows as columns, over the determinant
+// The new translation is the old one, negated, through the inverse 3x3 block
+void Matrix4::InvertAffine()
+{
+#if MATH_SSE
+	// the same steps 4 wide: the last column is 0, so the 4th lane of every cross product is 0 too
+	__m128 r0 = _mm_loadu_ps(mat[0]);
+	__m128 r1 = _mm_loadu_ps(mat[1]);
+	__m128 r2 = _mm_loadu_ps(mat[2]);
+	__m128 trans = _mm_loadu_ps(mat[3]);
+	auto cross = [](__m128 a, __m128 b)
+	{
+		__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+		return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+	};
+	__m128 c0 = cross(r1, r2);
+	__m128 c1 = cross(r2, r0);
+	__m128 c2 = cross(r0, r1);
+	// the determinant in every lane
+	__m128 det = _mm_mul_ps(r0, c0);
+	det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+	det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+	c0 = _mm_mul_ps(c0, invDet);
+	c1 = _mm_mul_ps(c1, invDet);
+	c2 = _mm_mul_ps(c2, invDet);
+	// the columns c0, c1, c2 become rows
+	__m128 zero = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(c0, c1, c2, zero);
+	__m128 t = _mm_mul_ps(_mm_shuffle_ps(trans, trans, _MM_SHUFFLE(0, 0, 0, 0)), c0);
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_shuffle_ps(trans, trans, _MM_SHUFFLE(1, 1, 1, 1)), c1));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_shuffle_ps(trans, trans, _MM_SHUFFLE(2, 2, 2, 2)), c2));
+	t = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), t);
+	_mm_storeu_ps(mat[0], c0);
+	_mm_storeu_ps(mat[1], c1);
+	_mm_storeu_ps(mat[2], c2);
+	_mm_storeu_ps(mat[3], t);
+#else
+	Vector3 r0(mat[0][0], mat[0][1], mat[0][2]);
+	Vector3 r1(mat[1][0], mat[1][1], mat[1][2]);
+	Vector3 r2(mat[2][0], mat[2][1], mat[2][2]);
+	Vector3 trans(mat[3][0], mat[3][1], mat[3][2]);
+
+	Vector3 c0 = Vector3::Cross(r1, r2);
+	Vector3 c1 = Vector3::Cross(r2, r0);
+	Vector3 c2 = Vector3::Cross(r0, r1);
+	float invDet = 1.0f / Vector3::Dot(r0, c0);
+	// the translation through the unscaled block, while the divide is in flight
+	Vector3 invTrans(Vector3::Dot(trans, c0), Vector3::Dot(trans, c1), Vector3::Dot(trans, c2));
+
+	SetAffineInverse(*this, invDet * c0, invDet * c1, invDet * c2, invDet * invTrans);
+#endif
+}
+
+// Rotation times scale s: the inverse 3x3 block is the transpose over s squared
+void Matrix4::InvertUniformScale()
+{
+	Vector3 r0(mat[0][0], mat[0][1], mat[0][2]);
+	Vector3 r1(mat[1][0], mat[1][1], mat[1][2]);
+	Vector3 r2(mat[2][0], mat[2][1], mat[2][2]);
+	Vector3 trans(mat[3][0], mat[3][1], mat[3][2]);
+
+	float invScaleSq = 1.0f / r0.LengthSq();
+	// the columns of the inverse are the rows of the original
+	Vector3 invTrans(Vector3::Dot(trans, r0), Vector3::Dot(trans, r1), Vector3::Dot(trans, r2));
+
+	SetAffineInverse(*this, invScaleSq * r0, invScaleSq * r1, invScaleSq * r2, invScaleSq * invTrans);
+}
+
+Matrix4 Matrix4::CreateTRS(const Vector3& scale, const Quaternion& rotation, const Vector3& trans)
+{
+	Matrix4 retVal = CreateFromQuaternion(rotation);
+	for (int j = 0; j < 3; j++)
+	{
+		retVal.mat[0][j] *= scale.x;
+		retVal.mat[1][j] *= scale.y;
+		retVal.mat[2][j] *= scale.z;
+	}
+	retVal.mat[3][0] = trans.x;
+	retVal.mat[3][1] = trans.y;
+	retVal.mat[3][2] = trans.z;
+	return retVal;
+}
+
+// (S R T)^-1 = T^-1 R^T S^-1: the transposed rotation with column j divided by scale j,
+// and the negated translation through it
+Matrix4 Matrix4::CreateInverseTRS(const Vector3& scale, const Quaternion& rotation, const Vector3& trans)
+{
+	Matrix4 rot = CreateFromQuaternion(rotation);
+	Vector3 invScale(1.0f / scale.x, 1.0f / scale.y, 1.0f / scale.z);
+	Vector3 c0 = invScale.x * Vector3(rot.mat[0][0], rot.mat[0][1], rot.mat[0][2]);
+	Vector3 c1 = invScale.y * Vector3(rot.mat[1][0], rot.mat[1][1], rot.mat[1][2]);
+	Vector3 c2 = invScale.z * Vector3(rot.mat[2][0], rot.mat[2][1], rot.mat[2][2]);
+
+	Matrix4 retVal;
+	SetAffineInverse(retVal, c0, c1, c2, Vector3(Vector3::Dot(trans, c0), Vector3::Dot(trans, c1), Vector3::Dot(trans, c2)));
+	return retVal;
+}
+
 Matrix4 Matrix4::CreateFromQuaternion(const class Quaternion& q)
 {
 	float mat[4][4];
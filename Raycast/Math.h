@@ -4,27 +4,37 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
 #include <memory.h>
 #include <limits>
 
+// Matrix4 multiply, Vector3::Transform/TransformMany and Matrix4::InvertAffine use SSE2, which every x64
+// compiler targets. Define MATH_NO_SIMD (or PHYSICS_NO_SIMD) to force the scalar code.
+#if !defined(MATH_NO_SIMD) && !defined(PHYSICS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MATH_SSE 1
+#include <emmintrin.h>
+#else
+#define MATH_SSE 0
+#endif
+
 #define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
 
 namespace Math
 {
 	// NOLINTBEGIN
-	const float Pi = 3.1415926535f;
-	const float TwoPi = Pi * 2.0f;
-	const float PiOver2 = Pi / 2.0f;
-	const float Infinity = std::numeric_limits<float>::infinity();
-	const float NegInfinity = -std::numeric_limits<float>::infinity();
+	constexpr float Pi = 3.1415926535f;
+	constexpr float TwoPi = Pi * 2.0f;
+	constexpr float PiOver2 = Pi / 2.0f;
+	constexpr float Infinity = std::numeric_limits<float>::infinity();
+	constexpr float NegInfinity = -std::numeric_limits<float>::infinity();
 	// NOLINTEND
 
-	[[nodiscard]] inline float ToRadians(float degrees)
+	[[nodiscard]] constexpr float ToRadians(float degrees)
 	{
 		return degrees * Pi / 180.0f;
 	}
 
-	[[nodiscard]] inline float ToDegrees(float radians)
+	[[nodiscard]] constexpr float ToDegrees(float radians)
 	{
 		return radians * 180.0f / Pi;
 	}
@@ -35,19 +45,19 @@ namespace Math
 	}
 
 	template <typename T>
-	[[nodiscard]] T Max(const T& a, const T& b)
+	[[nodiscard]] constexpr T Max(const T& a, const T& b)
 	{
 		return (a < b ? b : a);
 	}
 
 	template <typename T>
-	[[nodiscard]] T Min(const T& a, const T& b)
+	[[nodiscard]] constexpr T Min(const T& a, const T& b)
 	{
 		return (a < b ? a : b);
 	}
 
 	template <typename T>
-	[[nodiscard]] T Clamp(const T& value, const T& lower, const T& upper)
+	[[nodiscard]] constexpr T Clamp(const T& value, const T& lower, const T& upper)
 	{
 		return Min(upper, Max(lower, value));
 	}
@@ -87,7 +97,7 @@ namespace Math
 		return 1.0f / Tan(angle);
 	}
 
-	[[nodiscard]] inline float Lerp(float a, float b, float f)
+	[[nodiscard]] constexpr float Lerp(float a, float b, float f)
 	{
 		return a + f * (b - a);
 	}
@@ -112,70 +122,70 @@ public:
 	float y;
 	// NOLINTEND
 
-	Vector2()
+	constexpr Vector2()
 	: x(0.0f)
 	, y(0.0f)
 	{
 	}
 
-	explicit Vector2(float inX, float inY)
+	constexpr explicit Vector2(float inX, float inY)
 	: x(inX)
 	, y(inY)
 	{
 	}
 
-	explicit Vector2(float inXY)
+	constexpr explicit Vector2(float inXY)
 	: x(inXY)
 	, y(inXY)
 	{
 	}
 
-	explicit Vector2(int inX, int inY)
+	constexpr explicit Vector2(int inX, int inY)
 	: x(static_cast<float>(inX))
 	, y(static_cast<float>(inY))
 	{
 	}
 
 	// Set both components in one line
-	void Set(float inX, float inY)
+	constexpr void Set(float inX, float inY)
 	{
 		x = inX;
 		y = inY;
 	}
 
 	// Vector addition (a + b)
-	[[nodiscard]] friend Vector2 operator+(const Vector2& a, const Vector2& b)
+	[[nodiscard]] friend constexpr Vector2 operator+(const Vector2& a, const Vector2& b)
 	{
 		return Vector2(a.x + b.x, a.y + b.y);
 	}
 
 	// Vector subtraction (a - b)
-	[[nodiscard]] friend Vector2 operator-(const Vector2& a, const Vector2& b)
+	[[nodiscard]] friend constexpr Vector2 operator-(const Vector2& a, const Vector2& b)
 	{
 		return Vector2(a.x - b.x, a.y - b.y);
 	}
 
 	// Component-wise multiplication
 	// (a.x * b.x, ...)
-	[[nodiscard]] friend Vector2 operator*(const Vector2& a, const Vector2& b)
+	[[nodiscard]] friend constexpr Vector2 operator*(const Vector2& a, const Vector2& b)
 	{
 		return Vector2(a.x * b.x, a.y * b.y);
 	}
 
 	// Scalar multiplication
-	[[nodiscard]] friend Vector2 operator*(const Vector2& vec, float scalar)
+	[[nodiscard]] friend constexpr Vector2 operator*(const Vector2& vec, float scalar)
 	{
 		return Vector2(vec.x * scalar, vec.y * scalar);
 	}
 
 	// Scalar multiplication
-	[[nodiscard]] friend Vector2 operator*(float scalar, const Vector2& vec)
+	[[nodiscard]] friend constexpr Vector2 operator*(float scalar, const Vector2& vec)
 	{
 		return Vector2(vec.x * scalar, vec.y * scalar);
 	}
 
 	// Scalar *=
-	Vector2& operator*=(float scalar)
+	constexpr Vector2& operator*=(float scalar)
 	{
 		x *= scalar;
 		y *= scalar;
@@ -183,7 +193,7 @@ public:
 	}
 
 	// Vector +=
-	Vector2& operator+=(const Vector2& right)
+	constexpr Vector2& operator+=(const Vector2& right)
 	{
 		x += right.x;
 		y += right.y;
@@ -191,7 +201,7 @@ public:
 	}
 
 	// Vector -=
-	Vector2& operator-=(const Vector2& right)
+	constexpr Vector2& operator-=(const Vector2& right)
 	{
 		x -= right.x;
 		y -= right.y;
@@ -199,7 +209,7 @@ public:
 	}
 
 	// Length squared of vector
-	[[nodiscard]] float LengthSq() const { return (x * x + y * y); }
+	[[nodiscard]] constexpr float LengthSq() const { return (x * x + y * y); }
 
 	// Length of vector
 	[[nodiscard]] float Length() const { return (Math::Sqrt(LengthSq())); }
@@ -221,19 +231,19 @@ public:
 	}
 
 	// Dot product between two vectors (a dot b)
-	[[nodiscard]] static float Dot(const Vector2& a, const Vector2& b)
+	[[nodiscard]] static constexpr float Dot(const Vector2& a, const Vector2& b)
 	{
 		return (a.x * b.x + a.y * b.y);
 	}
 
 	// Lerp from A to B by f
-	[[nodiscard]] static Vector2 Lerp(const Vector2& a, const Vector2& b, float f)
+	[[nodiscard]] static constexpr Vector2 Lerp(const Vector2& a, const Vector2& b, float f)
 	{
 		return a + f * (b - a);
 	}
 
 	// Reflect V about (normalized) N
-	[[nodiscard]] static Vector2 Reflect(const Vector2& v, const Vector2& n)
+	[[nodiscard]] static constexpr Vector2 Reflect(const Vector2& v, const Vector2& n)
 	{
 		return v - 2.0f * Vector2::Dot(v, n) * n;
 	}
@@ -267,28 +277,28 @@ public:
 	float z;
 	// NOLINTEND
 
-	Vector3()
+	constexpr Vector3()
 	: x(0.0f)
 	, y(0.0f)
 	, z(0.0f)
 	{
 	}
 
-	explicit Vector3(float inX, float inY, float inZ)
+	constexpr explicit Vector3(float inX, float inY, float inZ)
 	: x(inX)
 	, y(inY)
 	, z(inZ)
 	{
 	}
 
-	explicit Vector3(float inXYZ)
+	constexpr explicit Vector3(float inXYZ)
 	: x(inXYZ)
 	, y(inXYZ)
 	, z(inXYZ)
 	{
 	}
 
-	explicit Vector3(int inX, int inY, int inZ)
+	constexpr explicit Vector3(int inX, int inY, int inZ)
 	: x(static_cast<float>(inX))
 	, y(static_cast<float>(inY))
 	, z(static_cast<float>(inZ))
@@ -299,7 +309,7 @@ public:
 	const float* GetAsFloatPtr() const { return reinterpret_cast<const float*>(&x); }
 
 	// Set all three components in one line
-	void Set(float inX, float inY, float inZ)
+	constexpr void Set(float inX, float inY, float inZ)
 	{
 		x = inX;
 		y = inY;
@@ -307,37 +317,37 @@ public:
 	}
 
 	// Vector addition (a + b)
-	[[nodiscard]] friend Vector3 operator+(const Vector3& a, const Vector3& b)
+	[[nodiscard]] friend constexpr Vector3 operator+(const Vector3& a, const Vector3& b)
 	{
 		return Vector3(a.x + b.x, a.y + b.y, a.z + b.z);
 	}
 
 	// Vector subtraction (a - b)
-	[[nodiscard]] friend Vector3 operator-(const Vector3& a, const Vector3& b)
+	[[nodiscard]] friend constexpr Vector3 operator-(const Vector3& a, const Vector3& b)
 	{
 		return Vector3(a.x - b.x, a.y - b.y, a.z - b.z);
 	}
 
 	// Component-wise multiplication
-	[[nodiscard]] friend Vector3 operator*(const Vector3& left, const Vector3& right)
+	[[nodiscard]] friend constexpr Vector3 operator*(const Vector3& left, const Vector3& right)
 	{
 		return Vector3(left.x * right.x, left.y * right.y, left.z * right.z);
 	}
 
 	// Scalar multiplication
-	[[nodiscard]] friend Vector3 operator*(const Vector3& vec, float scalar)
+	[[nodiscard]] friend constexpr Vector3 operator*(const Vector3& vec, float scalar)
 	{
 		return Vector3(vec.x * scalar, vec.y * scalar, vec.z * scalar);
 	}
 
 	// Scalar multiplication
-	[[nodiscard]] friend Vector3 operator*(float scalar, const Vector3& vec)
+	[[nodiscard]] friend constexpr Vector3 operator*(float scalar, const Vector3& vec)
 	{
 		return Vector3(vec.x * scalar, vec.y * scalar, vec.z * scalar);
 	}
 
 	// Scalar *=
-	Vector3& operator*=(float scalar)
+	constexpr Vector3& operator*=(float scalar)
 	{
 		x *= scalar;
 		y *= scalar;
@@ -346,7 +356,7 @@ public:
 	}
 
 	// Vector +=
-	Vector3& operator+=(const Vector3& right)
+	constexpr Vector3& operator+=(const Vector3& right)
 	{
 		x += right.x;
 		y += right.y;
@@ -355,7 +365,7 @@ public:
 	}
 
 	// Vector -=
-	Vector3& operator-=(const Vector3& right)
+	constexpr Vector3& operator-=(const Vector3& right)
 	{
 		x -= right.x;
 		y -= right.y;
@@ -364,7 +374,7 @@ public:
 	}
 
 	// Length squared of vector
-	[[nodiscard]] float LengthSq() const { return (x * x + y * y + z * z); }
+	[[nodiscard]] constexpr float LengthSq() const { return (x * x + y * y + z * z); }
 
 	// Length of vector
 	[[nodiscard]] float Length() const { return (Math::Sqrt(LengthSq())); }
@@ -387,13 +397,13 @@ public:
 	}
 
 	// Dot product between two vectors (a dot b)
-	[[nodiscard]] static float Dot(const Vector3& a, const Vector3& b)
+	[[nodiscard]] static constexpr float Dot(const Vector3& a, const Vector3& b)
 	{
 		return (a.x * b.x + a.y * b.y + a.z * b.z);
 	}
 
 	// Cross product between two vectors (a cross b)
-	[[nodiscard]] static Vector3 Cross(const Vector3& a, const Vector3& b)
+	[[nodiscard]] static constexpr Vector3 Cross(const Vector3& a, const Vector3& b)
 	{
 		Vector3 temp;
 		temp.x = a.y * b.z - a.z * b.y;
@@ -403,19 +413,22 @@ public:
 	}
 
 	// Lerp from A to B by f
-	[[nodiscard]] static Vector3 Lerp(const Vector3& a, const Vector3& b, float f)
+	[[nodiscard]] static constexpr Vector3 Lerp(const Vector3& a, const Vector3& b, float f)
 	{
 		return a + f * (b - a);
 	}
 
 	// Reflect V about (normalized) N
-	[[nodiscard]] static Vector3 Reflect(const Vector3& v, const Vector3& n)
+	[[nodiscard]] static constexpr Vector3 Reflect(const Vector3& v, const Vector3& n)
 	{
 		return v - 2.0f * Vector3::Dot(v, n) * n;
 	}
 
 	[[nodiscard]] static Vector3 Transform(const Vector3& vec, const class Matrix4& mat,
 										   float w = 1.0f);
+	// Transform count vectors at once, pOut may be pIn. Gives exactly what Transform gives for each
+	static void TransformMany(const Vector3* pIn, Vector3* pOut, size_t count, const class Matrix4& mat,
+							  float w = 1.0f);
 	// This will transform the vector and renormalize the w component
 	[[nodiscard]] static Vector3 TransformWithPerspDiv(const Vector3& vec, const class Matrix4& mat,
 													   float w = 1.0f);
@@ -449,9 +462,17 @@ public:
 	float mat[3][3]; // NOLINT
 
 	// NOLINTBEGIN
-	Matrix3() { *this = Matrix3::Identity; }
+	constexpr Matrix3()
+	: mat{{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}
+	{
+	}
 
-	explicit Matrix3(float inMat[3][3]) { memcpy(mat, inMat, 9 * sizeof(float)); }
+	constexpr explicit Matrix3(const float inMat[3][3])
+	: mat{{inMat[0][0], inMat[0][1], inMat[0][2]},
+		  {inMat[1][0], inMat[1][1], inMat[1][2]},
+		  {inMat[2][0], inMat[2][1], inMat[2][2]}}
+	{
+	}
 	// NOLINTEND
 
 	// Cast to a const float pointer
@@ -501,7 +522,7 @@ public:
 	}
 
 	// Create a scale matrix with x and y scales
-	[[nodiscard]] static Matrix3 CreateScale(float xScale, float yScale)
+	[[nodiscard]] static constexpr Matrix3 CreateScale(float xScale, float yScale)
 	{
 		float temp[3][3] = {
 			{xScale, 0.0f, 0.0f},
@@ -511,13 +532,13 @@ public:
 		return Matrix3(temp);
 	}
 
-	[[nodiscard]] static Matrix3 CreateScale(const Vector2& scaleVector)
+	[[nodiscard]] static constexpr Matrix3 CreateScale(const Vector2& scaleVector)
 	{
 		return CreateScale(scaleVector.x, scaleVector.y);
 	}
 
 	// Create a scale matrix with a uniform factor
-	[[nodiscard]] static Matrix3 CreateScale(float scale) { return CreateScale(scale, scale); }
+	[[nodiscard]] static constexpr Matrix3 CreateScale(float scale) { return CreateScale(scale, scale); }
 
 	// Create a rotation matrix about the Z axis
 	// theta is in radians
@@ -532,7 +553,7 @@ public:
 	}
 
 	// Create a translation matrix (on the xy-plane)
-	[[nodiscard]] static Matrix3 CreateTranslation(const Vector2& trans)
+	[[nodiscard]] static constexpr Matrix3 CreateTranslation(const Vector2& trans)
 	{
 		float temp[3][3] = {
 			{1.0f, 0.0f, 0.0f},
@@ -552,9 +573,18 @@ public:
 	float mat[4][4]; // NOLINT
 
 	// NOLINTBEGIN
-	Matrix4() { *this = Matrix4::Identity; }
+	constexpr Matrix4()
+	: mat{{1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 0.0f, 1.0f}}
+	{
+	}
 
-	explicit Matrix4(float inMat[4][4]) { memcpy(mat, inMat, 16 * sizeof(float)); }
+	constexpr explicit Matrix4(const float inMat[4][4])
+	: mat{{inMat[0][0], inMat[0][1], inMat[0][2], inMat[0][3]},
+		  {inMat[1][0], inMat[1][1], inMat[1][2], inMat[1][3]},
+		  {inMat[2][0], inMat[2][1], inMat[2][2], inMat[2][3]},
+		  {inMat[3][0], inMat[3][1], inMat[3][2], inMat[3][3]}}
+	{
+	}
 	// NOLINTEND
 
 	// Cast to a const float pointer
@@ -564,6 +594,22 @@ public:
 	[[nodiscard]] friend Matrix4 operator*(const Matrix4& a, const Matrix4& b)
 	{
 		Matrix4 retVal;
+#if MATH_SSE
+		// each row of the result is the row of a weighting the rows of b (summed in the same order as below)
+		__m128 b0 = _mm_loadu_ps(b.mat[0]);
+		__m128 b1 = _mm_loadu_ps(b.mat[1]);
+		__m128 b2 = _mm_loadu_ps(b.mat[2]);
+		__m128 b3 = _mm_loadu_ps(b.mat[3]);
+		for (int i = 0; i < 4; i++)
+		{
+			__m128 row = _mm_mul_ps(_mm_set1_ps(a.mat[i][0]), b0);
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.mat[i][1]), b1));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.mat[i][2]), b2));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.mat[i][3]), b3));
+			_mm_storeu_ps(retVal.mat[i], row);
+		}
+		return retVal;
+#else
 		// row 0
 		retVal.mat[0][0] = a.mat[0][0] * b.mat[0][0] + a.mat[0][1] * b.mat[1][0] +
 						   a.mat[0][2] * b.mat[2][0] + a.mat[0][3] * b.mat[3][0];
@@ -617,6 +663,7 @@ public:
 						   a.mat[3][2] * b.mat[2][3] + a.mat[3][3] * b.mat[3][3];
 
 		return retVal;
+#endif
 	}
 
 	Matrix4& operator*=(const Matrix4& right)
@@ -628,6 +675,20 @@ public:
 	// Invert the matrix - super slow
 	void Invert();
 
+	// Invert a matrix whose last column is (0, 0, 0, 1) (any mix of scale, rotation,
+	// shear and translation) from its 3x3 block - a fraction of the cost of Invert()
+	void InvertAffine();
+
+	// Invert a rotation with a uniform scale and a translation (rigid when the scale is 1)
+	// The 3x3 block is just transposed and divided by the scale squared
+	void InvertUniformScale();
+
+	// Is the last column (0, 0, 0, 1), so InvertAffine() can be used?
+	[[nodiscard]] bool IsAffine() const
+	{
+		return mat[0][3] == 0.0f && mat[1][3] == 0.0f && mat[2][3] == 0.0f && mat[3][3] == 1.0f;
+	}
+
 	// Get the translation component of the matrix
 	[[nodiscard]] Vector3 GetTranslation() const
 	{
@@ -663,7 +724,7 @@ public:
 	}
 
 	// Create a scale matrix with x, y, and z scales
-	[[nodiscard]] static Matrix4 CreateScale(float xScale, float yScale, float zScale)
+	[[nodiscard]] static constexpr Matrix4 CreateScale(float xScale, float yScale, float zScale)
 	{
 		float temp[4][4] = {{xScale, 0.0f, 0.0f, 0.0f},
 							{0.0f, yScale, 0.0f, 0.0f},
@@ -672,13 +733,13 @@ public:
 		return Matrix4(temp);
 	}
 
-	[[nodiscard]] static Matrix4 CreateScale(const Vector3& scaleVector)
+	[[nodiscard]] static constexpr Matrix4 CreateScale(const Vector3& scaleVector)
 	{
 		return CreateScale(scaleVector.x, scaleVector.y, scaleVector.z);
 	}
 
 	// Create a scale matrix with a uniform factor
-	[[nodiscard]] static Matrix4 CreateScale(float scale)
+	[[nodiscard]] static constexpr Matrix4 CreateScale(float scale)
 	{
 		return CreateScale(scale, scale, scale);
 	}
@@ -722,7 +783,16 @@ public:
 	// Create a rotation matrix from a quaternion
 	[[nodiscard]] static Matrix4 CreateFromQuaternion(const class Quaternion& q);
 
-	[[nodiscard]] static Matrix4 CreateTranslation(const Vector3& trans)
+	// Scale, then rotate, then translate
+	// (the same as CreateScale(scale) * CreateFromQuaternion(rotation) * CreateTranslation(trans))
+	[[nodiscard]] static Matrix4 CreateTRS(const Vector3& scale, const class Quaternion& rotation,
+										   const Vector3& trans);
+
+	// The inverse of CreateTRS(scale, rotation, trans), built straight from the parts
+	[[nodiscard]] static Matrix4 CreateInverseTRS(const Vector3& scale, const class Quaternion& rotation,
+												  const Vector3& trans);
+
+	[[nodiscard]] static constexpr Matrix4 CreateTranslation(const Vector3& trans)
 	{
 		float temp[4][4] = {{1.0f, 0.0f, 0.0f, 0.0f},
 							{0.0f, 1.0f, 0.0f, 0.0f},
@@ -749,7 +819,7 @@ public:
 		return Matrix4(temp);
 	}
 
-	[[nodiscard]] static Matrix4 CreateOrtho(float width, float height, float near, float far)
+	[[nodiscard]] static constexpr Matrix4 CreateOrtho(float width, float height, float near, float far)
 	{
 		float temp[4][4] = {{2.0f / width, 0.0f, 0.0f, 0.0f},
 							{0.0f, 2.0f / height, 0.0f, 0.0f},
@@ -771,7 +841,7 @@ public:
 	}
 
 	// Create "Simple" View-Projection Matrix from Chapter 6
-	[[nodiscard]] static Matrix4 CreateSimpleViewProj(float width, float height)
+	[[nodiscard]] static constexpr Matrix4 CreateSimpleViewProj(float width, float height)
 	{
 		float temp[4][4] = {{2.0f / width, 0.0f, 0.0f, 0.0f},
 							{0.0f, 2.0f / height, 0.0f, 0.0f},
@@ -793,11 +863,23 @@ public:
 	float z;
 	float w;
 
-	Quaternion() { *this = Quaternion::Identity; }
+	constexpr Quaternion()
+	: x(0.0f)
+	, y(0.0f)
+	, z(0.0f)
+	, w(1.0f)
+	{
+	}
 
 	// This directly sets the quaternion components --
 	// don't use for axis/angle
-	explicit Quaternion(float inX, float inY, float inZ, float inW) { Set(inX, inY, inZ, inW); }
+	constexpr explicit Quaternion(float inX, float inY, float inZ, float inW)
+	: x(inX)
+	, y(inY)
+	, z(inZ)
+	, w(inW)
+	{
+	}
 	// NOLINTEND
 
 	// Construct the quaternion from an axis and angle
@@ -813,7 +895,7 @@ public:
 	}
 
 	// Directly set the internal components
-	void Set(float inX, float inY, float inZ, float inW)
+	constexpr void Set(float inX, float inY, float inZ, float inW)
 	{
 		x = inX;
 		y = inY;
@@ -828,7 +910,7 @@ public:
 		z *= -1.0f;
 	}
 
-	[[nodiscard]] float LengthSq() const { return (x * x + y * y + z * z + w * w); }
+	[[nodiscard]] constexpr float LengthSq() const { return (x * x + y * y + z * z + w * w); }
 
 	[[nodiscard]] float Length() const { return Math::Sqrt(LengthSq()); }
 
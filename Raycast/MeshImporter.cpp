@@ -0,0 +1,791 @@
+#include "MeshImporter.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+
+namespace Physics {
+
+    namespace {
+        /// <summary>
+        /// A file read through one fixed buffer: what has been read but not used yet is [mPos, mEnd)
+        /// </summary>
+        class ChunkReader {
+        public:
+            ChunkReader(const char* path, std::vector<char>& chunk)
+                : mFile(path, std::ios::binary)
+                , mBegin(chunk.data())
+                , mCapacity(chunk.size())
+                , mPos(chunk.data())
+                , mEnd(chunk.data())
+                , mBytesRead(0)
+                , mAtEnd(false)
+                , mFailed(false)
+            {}
+
+            bool IsOpen() const { return mFile.is_open(); }
+            bool HasFailed() const { return mFailed; }
+            size_t GetBytesRead() const { return mBytesRead; }
+
+            /// <summary>
+            /// Move what is left to the front of the buffer and read as much more as fits
+            /// </summary>
+            /// <returns>false if nothing more was read: at the end of the file, or if the buffer is full</returns>
+            bool Fill()
+            {
+                size_t left = mEnd - mPos;
+                std::memmove(mBegin, mPos, left);
+                mPos = mBegin;
+                mEnd = mBegin + left;
+                if (mAtEnd || left == mCapacity)
+                {
+                    return false;
+                }
+                mFile.read(mEnd, (std::streamsize)(mCapacity - left));
+                size_t count = (size_t)mFile.gcount();
+                mEnd += count;
+                mBytesRead += count;
+                mAtEnd = count < mCapacity - left;
+                return count > 0;
+            }
+
+            /// <summary>
+            /// The next line, without its end of line. The last line of a file may have none.
+            /// </summary>
+            /// <returns>false at the end of the file, or if a line does not fit in the buffer (HasFailed)</returns>
+            bool ReadLine(const char** ppLine, const char** ppEnd)
+            {
+                size_t searched = 0;
+                for (;;)
+                {
+                    const char* pNewline = static_cast<const char*>(std::memchr(mPos + searched, '\n', mEnd - mPos - searched));
+                    if (pNewline != nullptr)
+                    {
+                        *ppLine = mPos;
+                        *ppEnd = pNewline;
+                        mPos += pNewline - mPos + 1;
+                        return true;
+                    }
+                    searched = mEnd - mPos;
+                    if (false == Fill())
+                    {
+                        if (mAtEnd && mPos < mEnd)
+                        {
+                            *ppLine = mPos;
+                            *ppEnd = mEnd;
+                            mPos = mEnd;
+                            return true;
+                        }
+                        mFailed |= false == mAtEnd;
+                        return false;
+                    }
+                }
+            }
+
+            /// <summary>
+            /// The next size bytes, in place in the buffer
+            /// </summary>
+            /// <returns>null if the file ends first, or size is more than the buffer holds (HasFailed)</returns>
+            const char* Take(size_t size)
+            {
+                while ((size_t)(mEnd - mPos) < size)
+                {
+                    if (false == Fill())
+                    {
+                        mFailed = true;
+                        return nullptr;
+                    }
+                }
+                const char* pData = mPos;
+                mPos += size;
+                return pData;
+            }
+
+            bool Skip(size_t size)
+            {
+                while (size > 0)
+                {
+                    if (mPos == mEnd && false == Fill())
+                    {
+                        mFailed = true;
+                        return false;
+                    }
+                    size_t count = std::min(size, (size_t)(mEnd - mPos));
+                    mPos += count;
+                    size -= count;
+                }
+                return true;
+            }
+
+        private:
+            std::ifstream mFile;
+            char* mBegin;
+            size_t mCapacity;
+            char* mPos;
+            char* mEnd;
+            size_t mBytesRead;
+            bool mAtEnd;
+            bool mFailed;
+        };
+
+        bool IsSpace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        bool IsDigit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        const char* SkipSpace(const char* p, const char* end)
+        {
+            while (p < end && IsSpace(*p))
+            {
+                ++p;
+            }
+            return p;
+        }
+
+        /// <summary>
+        /// Parse an integer at p, after any spaces, and move p past it
+        /// </summary>
+        bool ParseInt(const char*& p, const char* end, long long* pValue)
+        {
+            p = SkipSpace(p, end);
+            bool negative = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                ++p;
+            }
+            if (p == end || false == IsDigit(*p))
+            {
+                return false;
+            }
+            long long value = 0;
+            for (; p < end && IsDigit(*p); ++p)
+            {
+                value = std::min(value * 10 + (*p - '0'), (long long)INT_MAX + 1);  // anything bigger is out of range anyway
+            }
+            *pValue = negative ? -value : value;
+            return true;
+        }
+
+        /// <summary>
+        /// Parse a decimal number (sign, digits, fraction, exponent) at p, after any spaces, and move p past it
+        /// The digits are gathered in an integer and scaled once in double, so the float is within rounding of strtof's
+        /// </summary>
+        bool ParseFloat(const char*& p, const char* end, float* pValue)
+        {
+            static const double POW10[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+            };
+            const int MAX_POW = sizeof(POW10) / sizeof(POW10[0]) - 1;
+            const uint64_t MAX_MANTISSA = 100000000000000000ull;
+
+            p = SkipSpace(p, end);
+            bool negative = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                ++p;
+            }
+            uint64_t mantissa = 0;
+            int exponent = 0;
+            int digits = 0;
+            for (; p < end && IsDigit(*p); ++p, ++digits)
+            {
+                if (mantissa < MAX_MANTISSA)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                }
+                else
+                {
+                    ++exponent;
+                }
+            }
+            if (p < end && *p == '.')
+            {
+                for (++p; p < end && IsDigit(*p); ++p, ++digits)
+                {
+                    if (mantissa < MAX_MANTISSA)
+                    {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        --exponent;
+                    }
+                }
+            }
+            if (digits == 0)
+            {
+                return false;
+            }
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                long long power;
+                ++p;
+                if (false == ParseInt(p, end, &power))
+                {
+                    return false;
+                }
+                exponent += (int)std::max(std::min(power, 1000ll), -1000ll);
+            }
+
+            double value = (double)mantissa;
+            while (exponent > MAX_POW)
+            {
+                value *= POW10[MAX_POW];
+                exponent -= MAX_POW;
+            }
+            while (exponent < -MAX_POW)
+            {
+                value /= POW10[MAX_POW];
+                exponent += MAX_POW;
+            }
+            value = exponent < 0 ? value / POW10[-exponent] : value * POW10[exponent];
+            *pValue = (float)(negative ? -value : value);
+            return true;
+        }
+
+        /// <summary>
+        /// Split a polygon in a fan of triangles
+        /// </summary>
+        bool AddPolygon(const std::vector<int>& polygon, std::vector<int>& indices)
+        {
+            if (polygon.size() < 3)
+            {
+                return false;
+            }
+            for (size_t i = 1; i + 1 < polygon.size(); ++i)
+            {
+                indices.push_back(polygon[0]);
+                indices.push_back(polygon[i]);
+                indices.push_back(polygon[i + 1]);
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// The corners of an OBJ "f" line: v, v/vt, v//vn or v/vt/vn, 1 based or negative for relative to the last vertex
+        /// </summary>
+        bool ParseObjFace(const char* p, const char* end, int vertCount, std::vector<int>& polygon)
+        {
+            polygon.clear();
+            for (;;)
+            {
+                p = SkipSpace(p, end);
+                if (p == end || *p == '#')
+                {
+                    return true;
+                }
+                long long index;
+                if (false == ParseInt(p, end, &index) || index == 0)
+                {
+                    return false;
+                }
+                while (p < end && false == IsSpace(*p))
+                {   // the texture and normal indices
+                    ++p;
+                }
+                index = index < 0 ? vertCount + index : index - 1;
+                if (index < 0 || index > INT_MAX)
+                {
+                    return false;
+                }
+                polygon.push_back((int)index);
+            }
+        }
+
+        /// <summary>
+        /// Every index refers to a vertex
+        /// </summary>
+        bool AreIndicesValid(const Mesh& mesh)
+        {
+            int vertCount = (int)mesh.mVerts.size();
+            return std::all_of(mesh.mIndices.begin(), mesh.mIndices.end(), [vertCount](int index) { return index >= 0 && index < vertCount; });
+        }
+
+        ///////////////////////////////////////////////////////////////////////////////////////////////
+        // PLY
+        ///////////////////////////////////////////////////////////////////////////////////////////////
+        enum class PlyType {
+            Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64,
+            Invalid,
+        };
+
+        struct PlyProperty {
+            PlyType mType;
+            PlyType mCountType;     // the type of a list's length, Invalid if the property is not a list
+            int mAxis;              // 0, 1 or 2 for the x, y and z of a vertex, otherwise -1
+            bool mIsIndices;        // the vertex indices of a face
+        };
+
+        struct PlyElement {
+            uint64_t mCount;
+            bool mIsVertex;
+            bool mIsFace;
+            std::vector<PlyProperty> mProperties;
+        };
+
+        /// <summary>
+        /// A word of a header line, not null terminated
+        /// </summary>
+        struct PlyWord {
+            const char* mText;
+            size_t mLength;
+
+            bool Is(const char* word) const
+            {
+                return std::strlen(word) == mLength && std::memcmp(word, mText, mLength) == 0;
+            }
+        };
+
+        PlyWord NextWord(const char*& p, const char* end)
+        {
+            p = SkipSpace(p, end);
+            PlyWord word = { p, 0 };
+            while (p < end && false == IsSpace(*p))
+            {
+                ++p;
+            }
+            word.mLength = p - word.mText;
+            return word;
+        }
+
+        PlyType GetPlyType(const PlyWord& word)
+        {
+            const struct {
+                const char* mName;
+                const char* mSizedName;
+                PlyType mType;
+            } types[] = {
+                { "char", "int8", PlyType::Int8 },
+                { "uchar", "uint8", PlyType::UInt8 },
+                { "short", "int16", PlyType::Int16 },
+                { "ushort", "uint16", PlyType::UInt16 },
+                { "int", "int32", PlyType::Int32 },
+                { "uint", "uint32", PlyType::UInt32 },
+                { "float", "float32", PlyType::Float32 },
+                { "double", "float64", PlyType::Float64 },
+            };
+            for (const auto& type : types)
+            {
+                if (word.Is(type.mName) || word.Is(type.mSizedName))
+                {
+                    return type.mType;
+                }
+            }
+            return PlyType::Invalid;
+        }
+
+        size_t GetPlySize(PlyType type)
+        {
+            switch (type)
+            {
+            case PlyType::Int8:
+            case PlyType::UInt8:
+                return 1;
+            case PlyType::Int16:
+            case PlyType::UInt16:
+                return 2;
+            case PlyType::Int32:
+            case PlyType::UInt32:
+            case PlyType::Float32:
+                return 4;
+            case PlyType::Float64:
+                return 8;
+            case PlyType::Invalid:
+                break;
+            }
+            return 0;
+        }
+
+        template <typename T>
+        double DecodeAs(const char* pBytes)
+        {
+            T value;
+            std::memcpy(&value, pBytes, sizeof(T));
+            return (double)value;
+        }
+
+        /// <summary>
+        /// A value of the file, swapping its bytes if the file's byte order is not ours
+        /// </summary>
+        double DecodePly(const char* pData, PlyType type, bool swap)
+        {
+            char bytes[8];
+            size_t size = GetPlySize(type);
+            std::memcpy(bytes, pData, size);
+            if (swap)
+            {
+                std::reverse(bytes, bytes + size);
+            }
+            switch (type)
+            {
+            case PlyType::Int8:
+                return DecodeAs<int8_t>(bytes);
+            case PlyType::UInt8:
+                return DecodeAs<uint8_t>(bytes);
+            case PlyType::Int16:
+                return DecodeAs<int16_t>(bytes);
+            case PlyType::UInt16:
+                return DecodeAs<uint16_t>(bytes);
+            case PlyType::Int32:
+                return DecodeAs<int32_t>(bytes);
+            case PlyType::UInt32:
+                return DecodeAs<uint32_t>(bytes);
+            case PlyType::Float32:
+                return DecodeAs<float>(bytes);
+            case PlyType::Float64:
+                return DecodeAs<double>(bytes);
+            case PlyType::Invalid:
+                break;
+            }
+            return 0.0;
+        }
+
+        bool IsBigEndian()
+        {
+            const uint16_t one = 1;
+            char first;
+            std::memcpy(&first, &one, 1);
+            return first == 0;
+        }
+
+        /// <summary>
+        /// The header of a PLY file, up to and including "end_header"
+        /// </summary>
+        bool ParsePlyHeader(ChunkReader& reader, std::vector<PlyElement>& elements, bool* pBigEndian)
+        {
+            const char* p;
+            const char* end;
+            if (false == reader.ReadLine(&p, &end) || false == NextWord(p, end).Is("ply"))
+            {
+                return false;
+            }
+            bool hasFormat = false;
+            for (;;)
+            {
+                if (false == reader.ReadLine(&p, &end))
+                {
+                    return false;
+                }
+                PlyWord keyword = NextWord(p, end);
+                if (keyword.Is("end_header"))
+                {
+                    return hasFormat;
+                }
+                if (keyword.Is("format"))
+                {   // ascii is not supported
+                    PlyWord format = NextWord(p, end);
+                    hasFormat = format.Is("binary_little_endian") || format.Is("binary_big_endian");
+                    *pBigEndian = format.Is("binary_big_endian");
+                    if (false == hasFormat)
+                    {
+                        return false;
+                    }
+                }
+                else if (keyword.Is("element"))
+                {
+                    PlyWord name = NextWord(p, end);
+                    long long count;
+                    if (false == ParseInt(p, end, &count) || count < 0 || count > INT_MAX)
+                    {
+                        return false;
+                    }
+                    PlyElement element;
+                    element.mCount = (uint64_t)count;
+                    element.mIsVertex = name.Is("vertex");
+                    element.mIsFace = name.Is("face");
+                    elements.push_back(element);
+                }
+                else if (keyword.Is("property"))
+                {
+                    if (elements.empty())
+                    {
+                        return false;
+                    }
+                    PlyProperty property = { PlyType::Invalid, PlyType::Invalid, -1, false };
+                    PlyWord type = NextWord(p, end);
+                    if (type.Is("list"))
+                    {
+                        property.mCountType = GetPlyType(NextWord(p, end));
+                        property.mType = GetPlyType(NextWord(p, end));
+                        if (property.mCountType == PlyType::Invalid)
+                        {
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        property.mType = GetPlyType(type);
+                    }
+                    if (property.mType == PlyType::Invalid)
+                    {
+                        return false;
+                    }
+                    PlyWord name = NextWord(p, end);
+                    PlyElement& element = elements.back();
+                    if (element.mIsVertex && property.mCountType == PlyType::Invalid && name.mLength == 1 && name.mText[0] >= 'x' && name.mText[0] <= 'z')
+                    {
+                        property.mAxis = name.mText[0] - 'x';
+                    }
+                    property.mIsIndices = element.mIsFace && property.mCountType != PlyType::Invalid &&
+                        (name.Is("vertex_indices") || name.Is("vertex_index"));
+                    element.mProperties.push_back(property);
+                }
+                // comment, obj_info and anything else are skipped
+            }
+        }
+
+        /// <summary>
+        /// The vertices of a PLY file: fixed size records, x, y and z are read where they sit in the buffer
+        /// </summary>
+        bool ReadPlyVertices(ChunkReader& reader, const PlyElement& element, bool swap, std::vector<Vector3>& verts)
+        {
+            size_t recordSize = 0;
+            size_t offset[3] = {};
+            PlyType type[3] = { PlyType::Invalid, PlyType::Invalid, PlyType::Invalid };
+            for (const PlyProperty& property : element.mProperties)
+            {
+                if (property.mCountType != PlyType::Invalid)
+                {   // lists in vertices are not supported
+                    return false;
+                }
+                if (property.mAxis >= 0)
+                {
+                    offset[property.mAxis] = recordSize;
+                    type[property.mAxis] = property.mType;
+                }
+                recordSize += GetPlySize(property.mType);
+            }
+            if (type[0] == PlyType::Invalid || type[1] == PlyType::Invalid || type[2] == PlyType::Invalid)
+            {
+                return false;
+            }
+            verts.reserve(verts.size() + element.mCount);
+            for (uint64_t i = 0; i < element.mCount; ++i)
+            {
+                const char* pRecord = reader.Take(recordSize);
+                if (pRecord == nullptr)
+                {
+                    return false;
+                }
+                verts.push_back(Vector3(
+                    (float)DecodePly(pRecord + offset[0], type[0], swap),
+                    (float)DecodePly(pRecord + offset[1], type[1], swap),
+                    (float)DecodePly(pRecord + offset[2], type[2], swap)));
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// The faces of a PLY file, or any other element, which is skipped
+        /// </summary>
+        bool ReadPlyElement(ChunkReader& reader, const PlyElement& element, bool swap, std::vector<int>& polygon, std::vector<int>& indices)
+        {
+            if (element.mIsFace)
+            {
+                indices.reserve(indices.size() + element.mCount * 3);
+            }
+            for (uint64_t i = 0; i < element.mCount; ++i)
+            {
+                for (const PlyProperty& property : element.mProperties)
+                {
+                    size_t size = GetPlySize(property.mType);
+                    if (property.mCountType == PlyType::Invalid)
+                    {
+                        if (false == reader.Skip(size))
+                        {
+                            return false;
+                        }
+                        continue;
+                    }
+                    const char* pCount = reader.Take(GetPlySize(property.mCountType));
+                    if (pCount == nullptr)
+                    {
+                        return false;
+                    }
+                    double count = DecodePly(pCount, property.mCountType, swap);
+                    if (false == (count >= 0.0 && count <= INT_MAX))
+                    {
+                        return false;
+                    }
+                    if (false == property.mIsIndices)
+                    {
+                        if (false == reader.Skip((size_t)count * size))
+                        {
+                            return false;
+                        }
+                        continue;
+                    }
+                    const char* pIndices = reader.Take((size_t)count * size);
+                    if (pIndices == nullptr)
+                    {
+                        return false;
+                    }
+                    polygon.clear();
+                    for (int c = 0; c < (int)count; ++c)
+                    {
+                        double index = DecodePly(pIndices + c * size, property.mType, swap);
+                        if (false == (index >= 0.0 && index <= INT_MAX))
+                        {
+                            return false;
+                        }
+                        polygon.push_back((int)index);
+                    }
+                    if (false == AddPolygon(polygon, indices))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // MeshImporter
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    /// <param name="chunkSize">the size of the one buffer the file is read through</param>
+    MeshImporter::MeshImporter(size_t chunkSize)
+        : mChunk(std::max(chunkSize, (size_t)16))
+        , mBytesRead(0)
+        , mSeconds(0.0)
+    {}
+
+    /// <summary>
+    /// Load an OBJ or PLY file, going by its extension
+    /// </summary>
+    bool MeshImporter::Load(const char* path, Mesh* pMesh)
+    {
+        const char* pExtension = std::strrchr(path, '.');
+        if (pExtension == nullptr)
+        {
+            return false;
+        }
+        char extension[5] = {};
+        for (int i = 0; i < 4 && pExtension[i] != 0; ++i)
+        {
+            extension[i] = (char)std::tolower((unsigned char)pExtension[i]);
+        }
+        if (std::strcmp(extension, ".obj") == 0)
+        {
+            return LoadObj(path, pMesh);
+        }
+        if (std::strcmp(extension, ".ply") == 0)
+        {
+            return LoadPly(path, pMesh);
+        }
+        return false;
+    }
+
+    /// <summary>
+    /// Load the vertices and faces of a Wavefront OBJ file
+    /// </summary>
+    /// <param name="path">the file to load</param>
+    /// <param name="pMesh">the mesh to fill, emptied first</param>
+    /// <returns>false if the file cannot be read, is malformed or has a face referring to a missing vertex</returns>
+    bool MeshImporter::LoadObj(const char* path, Mesh* pMesh)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        pMesh->mVerts.clear();
+        pMesh->mIndices.clear();
+        ChunkReader reader(path, mChunk);
+        bool ok = reader.IsOpen();
+        const char* p;
+        const char* end;
+        while (ok && reader.ReadLine(&p, &end))
+        {
+            p = SkipSpace(p, end);
+            if (end - p < 2 || false == IsSpace(p[1]))
+            {   // blank lines, comments and "vt", "vn", "usemtl"...
+                continue;
+            }
+            if (p[0] == 'v')
+            {
+                float xyz[3];
+                ++p;
+                ok = ParseFloat(p, end, &xyz[0]) && ParseFloat(p, end, &xyz[1]) && ParseFloat(p, end, &xyz[2]);
+                if (ok)
+                {
+                    pMesh->mVerts.push_back(Vector3(xyz[0], xyz[1], xyz[2]));
+                }
+            }
+            else if (p[0] == 'f')
+            {
+                ok = ParseObjFace(p + 1, end, (int)pMesh->mVerts.size(), mPolygon) && AddPolygon(mPolygon, pMesh->mIndices);
+            }
+        }
+        ok = ok && false == reader.HasFailed() && AreIndicesValid(*pMesh);
+
+        mBytesRead = reader.GetBytesRead();
+        mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+
+    /// <summary>
+    /// Load the vertices and faces of a binary PLY file
+    /// </summary>
+    /// <param name="path">the file to load</param>
+    /// <param name="pMesh">the mesh to fill, emptied first</param>
+    /// <returns>false if the file cannot be read, is ascii, malformed or has a face referring to a missing vertex</returns>
+    bool MeshImporter::LoadPly(const char* path, Mesh* pMesh)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        pMesh->mVerts.clear();
+        pMesh->mIndices.clear();
+        ChunkReader reader(path, mChunk);
+        std::vector<PlyElement> elements;
+        bool bigEndian = false;
+        bool ok = reader.IsOpen() && ParsePlyHeader(reader, elements, &bigEndian);
+        bool swap = bigEndian != IsBigEndian();
+        for (size_t e = 0; ok && e < elements.size(); ++e)
+        {
+            if (elements[e].mIsVertex)
+            {
+                ok = ReadPlyVertices(reader, elements[e], swap, pMesh->mVerts);
+            }
+            else
+            {
+                ok = ReadPlyElement(reader, elements[e], swap, mPolygon, pMesh->mIndices);
+            }
+        }
+        ok = ok && AreIndicesValid(*pMesh);
+
+        mBytesRead = reader.GetBytesRead();
+        mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+
+    /// <summary>
+    /// Load a mesh file (see Load) straight into a new soup
+    /// A Format::Indexed soup takes the mesh's vertices over, so only the indices exist twice while it is built.
+    /// A Format::Precomputed soup stores triangles of its own, so the whole mesh is held alongside them until it
+    /// is built: the peak is the mesh plus the soup. A Format::View soup would outlive the mesh it is a view of, so
+    /// it is not supported.
+    /// </summary>
+    /// <returns>the soup, or null if the file cannot be loaded or has no triangles</returns>
+    std::unique_ptr<TriangleSoup> MeshImporter::ImportSoup(const char* path, TriangleSoup::Format format)
+    {
+        Mesh mesh;
+        if (format == TriangleSoup::Format::View || false == Load(path, &mesh) || mesh.GetTriCount() == 0)
+        {
+            return nullptr;
+        }
+        if (format == TriangleSoup::Format::Indexed)
+        {
+            return std::unique_ptr<TriangleSoup>(new TriangleSoup(std::move(mesh.mVerts), mesh.GetTriCount(), mesh.mIndices.data()));
+        }
+        return std::unique_ptr<TriangleSoup>(new TriangleSoup((int)mesh.mVerts.size(), mesh.mVerts.data(), mesh.GetTriCount(), mesh.mIndices.data(), format));
+    }
+
+    /// <summary>
+    /// The speed of the last load, in MB (2^20 bytes) of file per second
+    /// </summary>
+    double MeshImporter::GetMBPerSecond() const
+    {
+        return mSeconds > 0.0 ? mBytesRead / (1024.0 * 1024.0) / mSeconds : 0.0;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "Physics.h"
+#include <memory>
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// The vertices and triangles read from a mesh file, ready to hand to a TriangleSoup
+    /// </summary>
+    struct Mesh {
+        std::vector<Vector3> mVerts;
+        std::vector<int> mIndices;  // 3 per triangle
+
+        int GetTriCount() const { return (int)mIndices.size() / 3; }
+    };
+
+    /// <summary>
+    /// Reads OBJ and binary PLY meshes a chunk at a time, for collision meshes of millions of triangles
+    /// The file goes through one buffer of chunkSize bytes, parsed in place: no line is copied into a string, and beyond
+    /// that buffer the importer only keeps the mesh it builds. Polygons are split into fans of triangles.
+    /// OBJ: only the positions of "v" lines and the first index of each "f" corner are used (relative indices work),
+    /// everything else is skipped. A line must fit in a chunk.
+    /// PLY: binary, either byte order, with x, y and z of any scalar type and "vertex_indices" (or "vertex_index")
+    /// lists of any index type; other properties and elements are skipped.
+    /// GetMBPerSecond() reports the speed of the last load, from opening the file to the finished mesh.
+    /// </summary>
+    class MeshImporter {
+    public:
+        static const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+
+        explicit MeshImporter(size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+        bool Load(const char* path, Mesh* pMesh);
+        bool LoadObj(const char* path, Mesh* pMesh);
+        bool LoadPly(const char* path, Mesh* pMesh);
+        std::unique_ptr<TriangleSoup> ImportSoup(const char* path, TriangleSoup::Format format = TriangleSoup::Format::Precomputed);
+
+        size_t GetBytesRead() const { return mBytesRead; }
+        double GetSeconds() const { return mSeconds; }
+        double GetMBPerSecond() const;
+
+    private:
+        std::vector<char> mChunk;
+        std::vector<int> mPolygon;  // the corners of the polygon being read
+        size_t mBytesRead;
+        double mSeconds;
+    };
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+
+namespace Physics
+{
+    /// <summary>
+    /// The link every item of an MpscQueue carries (the queue is intrusive, it never allocates)
+    /// </summary>
+    struct MpscNode {
+        std::atomic<MpscNode*> mNext{ nullptr };
+    };
+
+    /// <summary>
+    /// Lock-free multi-producer single-consumer queue (Dmitry Vyukov's intrusive design)
+    /// Push is wait-free, one atomic exchange, and can be called from any number of threads.
+    /// Pop must only be called by one thread at a time. It can return nullptr while a producer is half way
+    /// through a Push even though the queue is not empty; the item shows up on a later Pop.
+    /// </summary>
+    class MpscQueue {
+    public:
+        MpscQueue()
+            : mHead(&mStub)
+            , mTail(&mStub)
+        {}
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        void Push(MpscNode* pNode)
+        {
+            pNode->mNext.store(nullptr, std::memory_order_relaxed);
+            MpscNode* pPrev = mHead.exchange(pNode, std::memory_order_acq_rel);
+            // between these two lines the item is in the queue but not reachable yet
+            pPrev->mNext.store(pNode, std::memory_order_release);
+        }
+
+        MpscNode* Pop()
+        {
+            MpscNode* pTail = mTail;
+            MpscNode* pNext = pTail->mNext.load(std::memory_order_acquire);
+            if (pTail == &mStub)
+            {
+                if (pNext == nullptr)
+                {
+                    return nullptr;
+                }
+                mTail = pNext;
+                pTail = pNext;
+                pNext = pNext->mNext.load(std::memory_order_acquire);
+            }
+            if (pNext != nullptr)
+            {
+                mTail = pNext;
+                return pTail;
+            }
+            if (pTail != mHead.load(std::memory_order_acquire))
+            {
+                // a producer is linking a new item behind pTail
+                return nullptr;
+            }
+            // pTail is the last item, put the stub behind it so it can be handed out
+            Push(&mStub);
+            pNext = pTail->mNext.load(std::memory_order_acquire);
+            if (pNext != nullptr)
+            {
+                mTail = pNext;
+                return pTail;
+            }
+            return nullptr;
+        }
+
+    private:
+        std::atomic<MpscNode*> mHead;   // producers push here
+        MpscNode* mTail;                // the consumer pops here
+        MpscNode mStub;
+    };
+}
@@ -0,0 +1,103 @@
+#include "ObjArrays.h"
+
+namespace Physics {
+
+    /// <summary>
+    /// Make room for count objects without changing the count
+    /// </summary>
+    void ObjArrays::Reserve(int count)
+    {
+        mMinX.reserve(count);
+        mMinY.reserve(count);
+        mMinZ.reserve(count);
+        mMaxX.reserve(count);
+        mMaxY.reserve(count);
+        mMaxZ.reserve(count);
+        mWorld2Obj.reserve(count);
+    }
+
+    /// <summary>
+    /// Grow or shrink to count objects, new slots are empty
+    /// </summary>
+    void ObjArrays::Resize(int count)
+    {
+        int oldCount = GetCount();
+        mMinX.resize(count);
+        mMinY.resize(count);
+        mMinZ.resize(count);
+        mMaxX.resize(count);
+        mMaxY.resize(count);
+        mMaxZ.resize(count);
+        mWorld2Obj.resize(count);
+        for (int id = oldCount; id < count; ++id)
+        {
+            SetEmpty(id);
+        }
+    }
+
+    /// <summary>
+    /// Store the world bounds and inverse transform of an object
+    /// </summary>
+    void ObjArrays::Set(int id, const AABB& worldBounds, const Matrix4& world2Obj)
+    {
+        mMinX[id] = worldBounds.mMin.x;
+        mMinY[id] = worldBounds.mMin.y;
+        mMinZ[id] = worldBounds.mMin.z;
+        mMaxX[id] = worldBounds.mMax.x;
+        mMaxY[id] = worldBounds.mMax.y;
+        mMaxZ[id] = worldBounds.mMax.z;
+        CompactTransform& m = mWorld2Obj[id];
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                m.mRow[j][i] = world2Obj.mat[i][j];
+            }
+        }
+    }
+
+    /// <summary>
+    /// Clear a slot. Its bounds become a point at +infinity on every axis, which the slab test never reaches
+    /// (a default AABB would not do: its min - from and max - from are -infinity and +infinity, that passes)
+    /// </summary>
+    void ObjArrays::SetEmpty(int id)
+    {
+        mMinX[id] = mMinY[id] = mMinZ[id] = Math::Infinity;
+        mMaxX[id] = mMaxY[id] = mMaxZ[id] = Math::Infinity;
+        CompactTransform& m = mWorld2Obj[id];
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                m.mRow[j][i] = i == j ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Fill slot i with the bounds and inverse transform of object ids[i] of src, for loops that visit objects
+    /// in that order and would otherwise jump around src
+    /// </summary>
+    void ObjArrays::Gather(const ObjArrays& src, const std::vector<int>& ids)
+    {
+        int count = (int)ids.size();
+        mMinX.resize(count);
+        mMinY.resize(count);
+        mMinZ.resize(count);
+        mMaxX.resize(count);
+        mMaxY.resize(count);
+        mMaxZ.resize(count);
+        mWorld2Obj.resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            int id = ids[i];
+            mMinX[i] = src.mMinX[id];
+            mMinY[i] = src.mMinY[id];
+            mMinZ[i] = src.mMinZ[id];
+            mMaxX[i] = src.mMaxX[id];
+            mMaxY[i] = src.mMaxY[id];
+            mMaxZ[i] = src.mMaxZ[id];
+            mWorld2Obj[i] = src.mWorld2Obj[id];
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "AlignedAllocator.h"
+#include "Bvh.h"
+
+namespace Physics
+{
+    /// <summary>
+    /// The part of an inverse transform a point or normal needs, 48 bytes instead of a Matrix4's 64
+    /// Row j holds column j of the world to object Matrix4, so a point comes out of 3 dot products plus the 4th entry
+    /// </summary>
+    struct alignas(16) CompactTransform {
+        float mRow[3][4];
+    };
+
+    /// <summary>
+    /// The per object data the World reads in its hot loops, kept apart from the SoupObj themselves
+    /// The world bounds are split in 6 streams (min x, min y, ... max z) so a pass over the bounds of many objects only
+    /// reads bounds; the inverse transforms, only needed once an object's bounds are hit, sit in their own array.
+    /// Every array is indexed by object id (by slot in a copy made by Gather) and starts on a cache line. An empty slot has bounds no segment can hit.
+    /// Points and normals come out exactly as Vector3::Transform and SoupObj give them from the full matrices.
+    /// </summary>
+    class ObjArrays {
+    public:
+        int GetCount() const { return (int)mWorld2Obj.size(); }
+        void Reserve(int count);
+        void Resize(int count);
+        void Set(int id, const AABB& worldBounds, const Matrix4& world2Obj);
+        void SetEmpty(int id);
+        void Gather(const ObjArrays& src, const std::vector<int>& ids);
+
+        AABB GetBounds(int id) const
+        {
+            return AABB(Vector3(mMinX[id], mMinY[id], mMinZ[id]), Vector3(mMaxX[id], mMaxY[id], mMaxZ[id]));
+        }
+
+        /// <summary>
+        /// The slab test of AABB::RayCast against the world bounds of an object
+        /// </summary>
+        bool RayCastBounds(int id, const Vector3& from, const Vector3& invDir, float maxFraction) const
+        {
+            return GetBounds(id).RayCast(from, invDir, maxFraction);
+        }
+
+        /// <summary>
+        /// A world space point in the space of an object
+        /// </summary>
+        Vector3 PointToObj(int id, const Vector3& p) const
+        {
+            const CompactTransform& m = mWorld2Obj[id];
+            return Vector3(
+                p.x * m.mRow[0][0] + p.y * m.mRow[0][1] + p.z * m.mRow[0][2] + m.mRow[0][3],
+                p.x * m.mRow[1][0] + p.y * m.mRow[1][1] + p.z * m.mRow[1][2] + m.mRow[1][3],
+                p.x * m.mRow[2][0] + p.y * m.mRow[2][1] + p.z * m.mRow[2][2] + m.mRow[2][3]
+            );
+        }
+
+        /// <summary>
+        /// An object space normal in world space (through the inverse transpose, see SoupObj::NormalToWorld)
+        /// </summary>
+        Vector3 NormalToWorld(int id, const Vector3& n) const
+        {
+            const CompactTransform& m = mWorld2Obj[id];
+            Vector3 normal(
+                m.mRow[0][0] * n.x + m.mRow[1][0] * n.y + m.mRow[2][0] * n.z,
+                m.mRow[0][1] * n.x + m.mRow[1][1] * n.y + m.mRow[2][1] * n.z,
+                m.mRow[0][2] * n.x + m.mRow[1][2] * n.y + m.mRow[2][2] * n.z
+            );
+            return Vector3::Normalize(normal);
+        }
+
+    private:
+        AlignedVector<float> mMinX;
+        AlignedVector<float> mMinY;
+        AlignedVector<float> mMinZ;
+        AlignedVector<float> mMaxX;
+        AlignedVector<float> mMaxY;
+        AlignedVector<float> mMaxZ;
+        AlignedVector<CompactTransform> mWorld2Obj;
+    };
+}
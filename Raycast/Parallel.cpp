@@ -0,0 +1,92 @@
+#include "Parallel.h"
+
+namespace Physics {
+
+    ThreadPool& ThreadPool::GetInstance()
+    {
+        static ThreadPool s_pool;
+        return s_pool;
+    }
+
+    /// <summary>
+    /// Stop the workers, they are idle by now: every Run waits for the workers on its job
+    /// </summary>
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWake.notify_all();
+        for (std::thread& worker : mWorkers)
+        {
+            worker.join();
+        }
+    }
+
+    /// <summary>
+    /// Call pWork(pContext) on the calling thread and on up to helperCount workers, return once every call has
+    /// returned. pWork must return promptly once there's nothing left to do, as workers may join late.
+    /// </summary>
+    /// <param name="helperCount">how many workers may join, the pool grows to at least this many</param>
+    /// <param name="pWork">the job, called once per thread working on it</param>
+    /// <param name="pContext">passed to pWork</param>
+    void ThreadPool::Run(int helperCount, void (*pWork)(void*), void* pContext)
+    {
+        Job job = { pWork, pContext, helperCount, 0 };
+        if (helperCount > 0)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            while ((int)mWorkers.size() < helperCount)
+            {
+                mWorkers.emplace_back(&ThreadPool::WorkerMain, this);
+            }
+            mJobs.push_back(&job);
+        }
+        mWake.notify_all();
+
+        pWork(pContext);
+
+        if (helperCount > 0)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (job.mUnclaimed > 0)
+            {   // no worker is needed any more, take the job off the queue before they get to it
+                mJobs.erase(std::find(mJobs.begin(), mJobs.end(), &job));
+            }
+            mDone.wait(lock, [&]() { return job.mRunning == 0; });
+        }
+    }
+
+    int ThreadPool::GetWorkerCount()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return (int)mWorkers.size();
+    }
+
+    void ThreadPool::WorkerMain()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;)
+        {
+            mWake.wait(lock, [&]() { return mStop || false == mJobs.empty(); });
+            if (mJobs.empty())
+            {
+                return;
+            }
+            Job* pJob = mJobs.front();
+            if (--pJob->mUnclaimed == 0)
+            {
+                mJobs.pop_front();
+            }
+            ++pJob->mRunning;
+            lock.unlock();
+            pJob->mWork(pJob->mContext);
+            lock.lock();
+            if (--pJob->mRunning == 0)
+            {
+                mDone.notify_all();
+            }
+        }
+    }
+}
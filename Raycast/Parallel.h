@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// How many threads to use when the caller asks for "all of them" (threadCount <= 0)
+    /// </summary>
+    inline int GetDefaultThreadCount()
+    {
+        unsigned int count = std::thread::hardware_concurrency();
+        return count > 0 ? (int)count : 1;
+    }
+
+    /// <summary>
+    /// The worker threads behind ParallelFor, started on first use and kept until the program exits
+    /// Run hands a job to up to helperCount idle workers and works on it itself as well. It is safe to call from any
+    /// thread, including from inside a job: workers that haven't picked the job up by the time the caller finishes it
+    /// are taken off it, so a caller never waits on a worker that is busy elsewhere.
+    /// </summary>
+    class ThreadPool {
+    public:
+        static ThreadPool& GetInstance();
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void Run(int helperCount, void (*pWork)(void*), void* pContext);
+        int GetWorkerCount();
+
+    private:
+        struct Job {
+            void (*mWork)(void*);
+            void* mContext;
+            int mUnclaimed;     // how many more workers may still join
+            int mRunning;       // how many workers are in mWork right now
+        };
+
+        ThreadPool() = default;
+        void WorkerMain();
+
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mDone;
+        std::deque<Job*> mJobs;
+        std::vector<std::thread> mWorkers;
+        bool mStop = false;
+    };
+
+    /// <summary>
+    /// Run func(begin, end) over [0, count) in chunks of chunkSize, on up to threadCount threads
+    /// Threads grab the next chunk from a shared atomic counter, so uneven chunks balance themselves.
+    /// The calling thread works too, and the call returns once every chunk is done. The other threads come from
+    /// ThreadPool, so a call doesn't start any once the pool has grown to threadCount - 1 workers.
+    /// Every call of func gets exactly one chunk, [k * chunkSize, min((k + 1) * chunkSize, count)), whatever the
+    /// thread count (one thread included), so func can keep per chunk results at begin / chunkSize.
+    /// func must be safe to call from several threads at once on different ranges.
+    /// </summary>
+    /// <param name="count">the number of items</param>
+    /// <param name="chunkSize">how many items a thread takes at a time</param>
+    /// <param name="threadCount">how many threads to use, including the calling one (<= 0 for one per core)</param>
+    /// <param name="func">called as func(size_t begin, size_t end)</param>
+    template <typename Func>
+    void ParallelFor(size_t count, size_t chunkSize, int threadCount, Func func)
+    {
+        chunkSize = std::max<size_t>(chunkSize, 1);
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        if (threadCount <= 0)
+        {
+            threadCount = GetDefaultThreadCount();
+        }
+        threadCount = (int)std::min<size_t>((size_t)threadCount, chunkCount);
+        if (threadCount <= 1)
+        {
+            for (size_t begin = 0; begin < count; begin += chunkSize)
+            {
+                func(begin, std::min(begin + chunkSize, count));
+            }
+            return;
+        }
+
+        std::atomic<size_t> nextChunk(0);
+        auto work = [&]()
+        {
+            for (;;)
+            {
+                size_t chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+                if (chunk >= chunkCount)
+                {
+                    return;
+                }
+                size_t begin = chunk * chunkSize;
+                func(begin, std::min(begin + chunkSize, count));
+            }
+        };
+        ThreadPool::GetInstance().Run(threadCount - 1,
+            [](void* pContext) { (*static_cast<decltype(work)*>(pContext))(); }, &work);
+    }
+}
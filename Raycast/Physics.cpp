@@ -1,29 +1,36 @@
 #include "Physics.h"
+#include "Parallel.h"
+#include <algorithm>
 
 namespace Physics {
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    // LineSegment
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    LineSegment::LineSegment(const Vector3& from, const Vector3& to)
-        : mFrom(from)
-        , mTo(to)
-    {}
+    namespace {
+        /// <summary>
+        /// Keep the closest maxHits hits in pHits, as a heap with the farthest one on top
+        /// less(a, b) orders the hits by fraction, and must break ties the same way every time
+        /// </summary>
+        /// <returns>false if the hit was not kept because the heap is full of closer ones</returns>
+        template <typename Hit, typename Less>
+        bool KeepClosest(Hit* pHits, int& count, int maxHits, const Hit& hit, Less less)
+        {
+            if (count == maxHits)
+            {
+                if (false == less(hit, pHits[0]))
+                {
+                    return false;
+                }
+                std::pop_heap(pHits, pHits + count, less);
+                --count;
+            }
+            pHits[count++] = hit;
+            std::push_heap(pHits, pHits + count, less);
+            return true;
+        }
+    }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // Plane
     ///////////////////////////////////////////////////////////////////////////////////////////////
-    Plane::Plane(const Vector3& point, const Vector3& normal)
-        : mNormal(normal)
-    {
-        mD = -Vector3::Dot(point, mNormal);
-    }
-
-    Plane::Plane(const Vector3& normal, float d)
-        : mNormal(normal)
-        , mD(d)
-    {}
-
     /// <summary>
     /// Cast the LineSegment across the Plane and return true if it intersects
     /// LineSegments coming from behind the Plane do not count as intersections
@@ -33,28 +40,37 @@ namespace Physics {
     /// <returns>true if the LineSegment hits the Plane</returns>
     bool Plane::RayCast(const LineSegment& line, CastInfo* info) const
     {
-        // TODO
-        return false;
+        Vector3 dir = line.mTo - line.mFrom;
+        float denom = Vector3::Dot(dir, mNormal);
+        if (denom >= 0.0f)
+        {   // parallel or coming from behind
+            return false;
+        }
+        float t = -(Vector3::Dot(line.mFrom, mNormal) + mD) / denom;
+        if (t < 0.0f || t > 1.0f)
+        {
+            return false;
+        }
+        if (info)
+        {
+            info->mPoint = line.mFrom + t * dir;
+            info->mNormal = mNormal;
+            info->mFraction = t;
+        }
+        return true;
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // Triangle
     ///////////////////////////////////////////////////////////////////////////////////////////////
-    Triangle::Triangle(const Vector3& a, const Vector3& b, const Vector3& c)
-    {
-        mPoints[0] = a;
-        mPoints[1] = b;
-        mPoints[2] = c;
-    }
-
     /// <summary>
     /// Calculate and return the normal of the Triangle
     /// </summary>
     /// <returns>the normal of the Triangle</returns>
     Vector3 Triangle::GetNormal() const
     {
-        // TODO
-        return Vector3::Zero;
+        Vector3 normal = Vector3::Cross(mPoints[1] - mPoints[0], mPoints[2] - mPoints[0]);
+        return Vector3::Normalize(normal);
     }
 
     /// <summary>
@@ -75,8 +91,20 @@ namespace Physics {
     /// <returns>true if the LineSegment hits the Triangle</returns>
     bool Triangle::RayCast(const LineSegment& line, CastInfo* info) const
     {
-        // TODO
-        return false;
+        CastInfo planeInfo;
+        if (false == GetPlane().RayCast(line, &planeInfo))
+        {
+            return false;
+        }
+        if (false == IsPointInside(planeInfo.mPoint))
+        {
+            return false;
+        }
+        if (info)
+        {
+            *info = planeInfo;
+        }
+        return true;
     }
 
     /// <summary>
@@ -87,27 +115,214 @@ namespace Physics {
     /// <returns>true if p is inside the triangle</returns>
     bool Triangle::IsPointInside(const Vector3& p) const
     {
-        // TODO
-        return false;
+        Vector3 normal = Vector3::Cross(mPoints[1] - mPoints[0], mPoints[2] - mPoints[0]);
+        for (int i = 0; i < 3; ++i)
+        {
+            const Vector3& a = mPoints[i];
+            const Vector3& b = mPoints[(i + 1) % 3];
+            if (Vector3::Dot(Vector3::Cross(b - a, p - a), normal) < 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // TriangleSoup
     ///////////////////////////////////////////////////////////////////////////////////////////////
-    TriangleSoup::TriangleSoup(int vertCount, Vector3* pVerts, int numTri, int* pIndices)
-        : mTriCount(numTri)
+    TriangleSoup::TriangleSoup(int vertCount, Vector3* pVerts, int numTri, int* pIndices, Format format)
+        : mTriData(nullptr)
+        , mFormat(format)
+        , mIndexed()
+        , mTriCount(numTri)
+        , mIsBox(false)
     {
-        mTris = new Triangle[mTriCount]();
-        for (int i = 0; i < numTri; ++i)
+        if (mFormat == Format::View)
+        {   // the same bits, and int may alias unsigned int
+            mIndexed.mIndices32 = reinterpret_cast<const uint32_t*>(pIndices);
+            BuildView(vertCount, pVerts, mIndexed.mIndices32);
+            return;
+        }
+
+        // build the hierarchy once for the soup, and store the triangles in its leaf order
+        if (false == BuildBvh(vertCount, pVerts, pIndices))
         {
-            for (int j = 0; j < 3; ++j)
-                mTris[i].mPoints[j] = pVerts[pIndices[i*3 + j]];
+            return;
+        }
+        if (mFormat == Format::Indexed)
+        {
+            mVerts.assign(pVerts, pVerts + vertCount);
+            BuildIndexed(pIndices);
+        }
+        else
+        {
+            const std::vector<int>& order = mBvh.GetPrimOrder();
+            int stride = TriangleStreams::GetPaddedCount(mTriCount);
+            mTriData = new float[TriangleStreams::NUM_STREAMS * stride]();
+            for (int s = 0; s < TriangleStreams::NUM_STREAMS; ++s)
+            {
+                mStreams.mStream[s] = mTriData + s * stride;
+            }
+            for (int i = 0; i < mTriCount; ++i)
+            {
+                const int* pTri = pIndices + order[i] * 3;
+                TriangleStreams::SetTriangle(mTriData, stride, i, pVerts[pTri[0]], pVerts[pTri[1]], pVerts[pTri[2]]);
+            }
+        }
+        mIsBox = DetectBox(pVerts, pIndices);
+    }
+
+    /// <summary>
+    /// A Format::Indexed soup that takes the caller's vertices over rather than copying them, see MeshImporter::ImportSoup
+    /// </summary>
+    TriangleSoup::TriangleSoup(std::vector<Vector3>&& verts, int triCount, const int* pIndices)
+        : mTriData(nullptr)
+        , mFormat(Format::Indexed)
+        , mVerts(std::move(verts))
+        , mIndexed()
+        , mTriCount(triCount)
+        , mIsBox(false)
+    {
+        if (false == BuildBvh((int)mVerts.size(), mVerts.data(), pIndices))
+        {
+            std::vector<Vector3>().swap(mVerts);
+            return;
         }
+        BuildIndexed(pIndices);
+        mIsBox = DetectBox(mVerts.data(), pIndices);
     }
 
+    /// <summary>
+    /// Point mIndexed at mVerts and store the triangles' indices in the leaf order of mBvh, 16 bit if they fit
+    /// </summary>
+    void TriangleSoup::BuildIndexed(const int* pIndices)
+    {
+        const std::vector<int>& order = mBvh.GetPrimOrder();
+        mIndexed.mVerts = mVerts.data();
+        if (mVerts.size() <= 0x10000)
+        {
+            mIndices16.resize(mTriCount * 3);
+            for (int i = 0; i < mTriCount * 3; ++i)
+            {
+                mIndices16[i] = (uint16_t)pIndices[order[i / 3] * 3 + i % 3];
+            }
+            mIndexed.mIndices16 = mIndices16.data();
+        }
+        else
+        {
+            mIndices32.resize(mTriCount * 3);
+            for (int i = 0; i < mTriCount * 3; ++i)
+            {
+                mIndices32[i] = (uint32_t)pIndices[order[i / 3] * 3 + i % 3];
+            }
+            mIndexed.mIndices32 = mIndices32.data();
+        }
+    }
+
+    TriangleSoup::TriangleSoup(int vertCount, const Vector3* pVerts, int triCount, const uint16_t* pIndices)
+        : mTriData(nullptr)
+        , mFormat(Format::View)
+        , mIndexed()
+        , mTriCount(triCount)
+        , mIsBox(false)
+    {
+        mIndexed.mIndices16 = pIndices;
+        BuildView(vertCount, pVerts, pIndices);
+    }
+
+    TriangleSoup::TriangleSoup(int vertCount, const Vector3* pVerts, int triCount, const uint32_t* pIndices)
+        : mTriData(nullptr)
+        , mFormat(Format::View)
+        , mIndexed()
+        , mTriCount(triCount)
+        , mIsBox(false)
+    {
+        mIndexed.mIndices32 = pIndices;
+        BuildView(vertCount, pVerts, pIndices);
+    }
+
+    /// <summary>
+    /// A soup over triangles that were precomputed elsewhere (see TriangleSoupData), kept in place
+    /// </summary>
+    TriangleSoup::TriangleSoup(const float* pTriData, int stride, int triCount, const AABB& bounds, const Vector3* pVerts, const int* pIndices)
+        : mTriData(nullptr)
+        , mFormat(Format::Precomputed)
+        , mIndexed()
+        , mTriCount(triCount)
+        , mBounds(bounds)
+        , mIsBox(false)
+    {
+        for (int s = 0; s < TriangleStreams::NUM_STREAMS; ++s)
+        {
+            mStreams.mStream[s] = pTriData + s * stride;
+        }
+        mIsBox = DetectBox(pVerts, pIndices);
+    }
+
+    /// <summary>
+    /// An empty soup that owns nothing, for a SceneCache to point at the triangles and hierarchy of a mapped file
+    /// </summary>
+    TriangleSoup::TriangleSoup(int triCount, const AABB& bounds)
+        : mTriData(nullptr)
+        , mStreams()
+        , mFormat(Format::Precomputed)
+        , mIndexed()
+        , mTriCount(triCount)
+        , mBounds(bounds)
+        , mIsBox(false)
+    {}
+
     TriangleSoup::~TriangleSoup()
     {
-        delete[] mTris;
+        delete[] mTriData;
+    }
+
+    /// <summary>
+    /// Work out mBounds and build mBvh over the triangles, checking every index on the way
+    /// A soup with an index outside [0, vertCount) is left without triangles, so no cast ever reads past the
+    /// vertices (the buffers of a View may come straight from a file).
+    /// </summary>
+    /// <returns>false if an index is out of range</returns>
+    template <typename Index>
+    bool TriangleSoup::BuildBvh(int vertCount, const Vector3* pVerts, const Index* pIndices)
+    {
+        std::vector<AABB> triBounds(mTriCount);
+        for (int i = 0; i < mTriCount; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                // negative int indices wrap to huge unsigned ones
+                if ((uint32_t)pIndices[i*3 + j] >= (uint32_t)Math::Max(vertCount, 0))
+                {
+                    mTriCount = 0;
+                    mBounds = AABB();
+                    return false;
+                }
+                triBounds[i].AddPoint(pVerts[pIndices[i*3 + j]]);
+            }
+            mBounds.AddBox(triBounds[i]);
+        }
+        mBvh.Build(triBounds.data(), mTriCount);
+        return true;
+    }
+
+    /// <summary>
+    /// The rest of a Format::View constructor, once the index buffer is set in mIndexed
+    /// The triangles stay where they are, so the kernel looks each leaf position up in mTriOrder (kept apart from
+    /// mBvh, which CompressBvh clears)
+    /// </summary>
+    template <typename Index>
+    void TriangleSoup::BuildView(int vertCount, const Vector3* pVerts, const Index* pIndices)
+    {
+        if (false == BuildBvh(vertCount, pVerts, pIndices))
+        {
+            return;
+        }
+        mTriOrder = mBvh.GetPrimOrder();
+        mIndexed.mVerts = pVerts;
+        mIndexed.mOrder = mTriOrder.data();
+        mIsBox = DetectBox(pVerts, pIndices);
     }
 
     /// <summary>
@@ -119,8 +334,297 @@ namespace Physics {
     /// <returns>true if the LineSegment hits the soup</returns>
     bool TriangleSoup::RayCast(const LineSegment& line, CastInfo* info) const
     {
-        // TODO
-        return false;
+        return RayCast(line, 1.0f, info);
+    }
+
+    /// <summary>
+    /// Same as RayCast(line, info), but only hits up to (and including) maxFraction count
+    /// The soup's hierarchy is walked front to back, so the closer maxFraction is the less of the soup gets visited
+    /// </summary>
+    bool TriangleSoup::RayCast(const LineSegment& line, float maxFraction, CastInfo* info) const
+    {
+        Vector3 dir = line.mTo - line.mFrom;
+        int bestTri = -1;
+        float fraction = std::nextafter(maxFraction, 2.0f);
+        if (mIsBox)
+        {
+            CastInfo boxInfo;
+            if (false == mBox.RayCast(line.mFrom, dir, fraction, &boxInfo.mFraction, &boxInfo.mNormal))
+            {
+                return false;
+            }
+            if (info)
+            {
+                info->mPoint = line.mFrom + boxInfo.mFraction * dir;
+                info->mNormal = boxInfo.mNormal;
+                info->mFraction = boxInfo.mFraction;
+            }
+            return true;
+        }
+        WalkBvh(line, fraction,
+            [&](int first, int count, float& leafFraction)
+            {
+                int tri = CastTriangles([&](const auto& tris) { return RayCastTriangles(tris, first, count, line.mFrom, dir, leafFraction); });
+                if (tri < 0)
+                {
+                    return false;
+                }
+                bestTri = tri;
+                return true;
+            });
+        if (bestTri < 0)
+        {
+            return false;
+        }
+        if (info)
+        {
+            info->mPoint = line.mFrom + fraction * dir;
+            info->mNormal = GetTriNormal(bestTri);
+            info->mFraction = fraction;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Does the LineSegment hit the soup anywhere up to (and including) maxFraction?
+    /// Same hits as RayCast, but the walk ends at the first one found and no point or normal is worked out
+    /// </summary>
+    /// <param name="line">the LineSegment to check against the soup</param>
+    /// <param name="maxFraction">only hits up to this fraction of the line count</param>
+    /// <returns>true if the LineSegment hits the soup</returns>
+    bool TriangleSoup::IsOccluded(const LineSegment& line, float maxFraction) const
+    {
+        Vector3 dir = line.mTo - line.mFrom;
+        float fraction = std::nextafter(maxFraction, 2.0f);
+        if (mIsBox)
+        {
+            float boxFraction;
+            Vector3 boxNormal;
+            return mBox.RayCast(line.mFrom, dir, fraction, &boxFraction, &boxNormal);
+        }
+        bool occluded = false;
+        WalkBvh(line, fraction,
+            [&](int first, int count, float& leafFraction)
+            {
+                if (CastTriangles([&](const auto& tris) { return RayCastTrianglesAny(tris, first, count, line.mFrom, dir, leafFraction); }) < 0)
+                {
+                    return false;
+                }
+                occluded = true;
+                leafFraction = -1.0f;   // ends the walk
+                return true;
+            });
+        return occluded;
+    }
+
+    /// <summary>
+    /// Find every place the LineSegment crosses the soup up to (and including) maxFraction, closest first
+    /// Two triangles hit at the very same fraction (the line goes through an edge they share) count as one crossing
+    /// </summary>
+    /// <param name="line">the LineSegment to check against the soup</param>
+    /// <param name="maxFraction">only hits up to this fraction of the line count</param>
+    /// <param name="pInfos">maxHits entries, filled in with the hits sorted by mFraction</param>
+    /// <param name="maxHits">the most hits to return, the closest ones are kept</param>
+    /// <returns>how many hits were written to pInfos</returns>
+    int TriangleSoup::RayCastAll(const LineSegment& line, float maxFraction, CastInfo* pInfos, int maxHits) const
+    {
+        if (maxHits <= 0)
+        {
+            return 0;
+        }
+        if (mIsBox)
+        {   // a box is convex, it is entered once at most
+            return RayCast(line, maxFraction, pInfos) ? 1 : 0;
+        }
+        auto less = [](const CastInfo& a, const CastInfo& b) { return a.mFraction < b.mFraction; };
+        Vector3 dir = line.mTo - line.mFrom;
+        int count = 0;
+        float fraction = std::nextafter(maxFraction, 2.0f);
+        WalkBvh(line, fraction,
+            [&](int first, int num, float& leafFraction)
+            {
+                const int CHUNK = 16;
+                int tris[CHUNK];
+                float fractions[CHUNK];
+                for (int c = first; c < first + num; c += CHUNK)
+                {
+                    int hitCount = CastTriangles([&](const auto& soupTris)
+                        {
+                            return RayCastTrianglesAll(soupTris, c, Math::Min(CHUNK, first + num - c), line.mFrom, dir, leafFraction, tris, fractions);
+                        });
+                    for (int h = 0; h < hitCount; ++h)
+                    {
+                        bool duplicate = false;
+                        for (int i = 0; i < count && false == duplicate; ++i)
+                        {
+                            duplicate = pInfos[i].mFraction == fractions[h];
+                        }
+                        if (duplicate)
+                        {
+                            continue;
+                        }
+                        CastInfo info;
+                        info.mPoint = line.mFrom + fractions[h] * dir;
+                        info.mNormal = GetTriNormal(tris[h]);
+                        info.mFraction = fractions[h];
+                        KeepClosest(pInfos, count, maxHits, info, less);
+                    }
+                }
+                if (count == maxHits)
+                {   // only hits in front of the farthest one kept can still make the list
+                    leafFraction = pInfos[0].mFraction;
+                }
+                return false;
+            });
+        std::sort_heap(pInfos, pInfos + count, less);
+        return count;
+    }
+
+    /// <summary>
+    /// Swap the soup's hierarchy for its QuantizedBvh, half the size, for worlds with many big soups
+    /// Casts find the same hits. Call it before the soup is shared with other threads. A soup with more than 2^28
+    /// triangles keeps its Bvh.
+    /// </summary>
+    void TriangleSoup::CompressBvh()
+    {
+        if (mQuantizedBvh.IsEmpty() && false == mBvh.IsEmpty())
+        {
+            if (mQuantizedBvh.Build(mBvh))
+            {
+                mBvh.Clear();
+            }
+        }
+    }
+
+    /// <summary>
+    /// The memory the soup's triangles take, in its Format (the hierarchy is GetBvhMemorySize)
+    /// A View only counts what it owns, the order of its triangles, not the caller's buffers
+    /// </summary>
+    size_t TriangleSoup::GetTriMemorySize() const
+    {
+        if (mFormat != Format::Precomputed)
+        {
+            return mVerts.size() * sizeof(Vector3) + mIndices16.size() * sizeof(uint16_t) + mIndices32.size() * sizeof(uint32_t) +
+                mTriOrder.size() * sizeof(int);
+        }
+        return TriangleStreams::NUM_STREAMS * TriangleStreams::GetPaddedCount(mTriCount) * sizeof(float);
+    }
+
+    /// <summary>
+    /// The unit normal of a triangle, recovered from the last row of its transform, or from its vertices if it has none
+    /// </summary>
+    Vector3 TriangleSoup::GetTriNormal(int tri) const
+    {
+        if (mFormat != Format::Precomputed)
+        {
+            int index = (mIndexed.mOrder ? mIndexed.mOrder[tri] : tri) * 3;
+            Vector3 v[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                v[i] = mIndexed.mVerts[mIndexed.mIndices16 ? mIndexed.mIndices16[index + i] : mIndexed.mIndices32[index + i]];
+            }
+            return Vector3::Normalize(Vector3::Cross(v[1] - v[0], v[2] - v[0]));
+        }
+        Vector3 n(
+            mStreams.mStream[TriangleStreams::ROW_N_X][tri],
+            mStreams.mStream[TriangleStreams::ROW_N_Y][tri],
+            mStreams.mStream[TriangleStreams::ROW_N_Z][tri]
+        );
+        return Vector3::Normalize(n);
+    }
+
+    /// <summary>
+    /// Is the soup exactly an axis aligned box? That is 12 triangles with every vertex on a corner of the bounds,
+    /// 2 triangles facing out of each face that split it along a diagonal, and both with the same plane row.
+    /// If so, mBox gets the rows and normals of the triangles so the slab test reports what the triangles would.
+    /// </summary>
+    /// <returns>true if the soup is a box</returns>
+    template <typename Index>
+    bool TriangleSoup::DetectBox(const Vector3* pVerts, const Index* pIndices)
+    {
+        const int NUM_BOX_TRIS = 12;
+        if (mTriCount != NUM_BOX_TRIS || false == (mBounds.mMin.x < mBounds.mMax.x &&
+            mBounds.mMin.y < mBounds.mMax.y && mBounds.mMin.z < mBounds.mMax.z))
+        {
+            return false;
+        }
+
+        // triangles are in the leaf order of the hierarchy, or in index order without one
+        const int* pOrder = mBvh.IsEmpty() ? nullptr : mBvh.GetPrimOrder().data();
+        int faceTris[BoxShape::NUM_FACES] = {};
+        Vector3 faceRow[BoxShape::NUM_FACES];   // the plane row of the first triangle found on each face
+        float faceW[BoxShape::NUM_FACES];
+        int faceMissing[BoxShape::NUM_FACES];   // the corner of the face it does not use
+        for (int i = 0; i < mTriCount; ++i)
+        {
+            // each corner as 3 bits, set where the vertex is on the max side
+            const Index* pTri = pIndices + (pOrder ? pOrder[i] : i) * 3;
+            int corners[3];
+            for (int v = 0; v < 3; ++v)
+            {
+                const float* p = pVerts[pTri[v]].GetAsFloatPtr();
+                corners[v] = 0;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    if (p[axis] == mBounds.mMax.GetAsFloatPtr()[axis])
+                    {
+                        corners[v] |= 1 << axis;
+                    }
+                    else if (p[axis] != mBounds.mMin.GetAsFloatPtr()[axis])
+                    {
+                        return false;
+                    }
+                }
+            }
+            if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2])
+            {
+                return false;
+            }
+
+            // the face is the axis all 3 corners agree on
+            int same = ~(corners[0] ^ corners[1]) & ~(corners[0] ^ corners[2]) & 7;
+            if (same != 1 && same != 2 && same != 4)
+            {
+                return false;
+            }
+            int axis = same == 1 ? 0 : (same == 2 ? 1 : 2);
+            bool maxSide = (corners[0] & same) != 0;
+            int face = 2 * axis + (maxSide ? 1 : 0);
+
+            // facing out, with the normal along the axis only (the rows the Precomputed format would store)
+            Vector3 rows[3];
+            float rowW[3] = {};
+            TriangleStreams::GetRows(pVerts[pTri[0]], pVerts[pTri[1]], pVerts[pTri[2]], rows, rowW);
+            const Vector3& row = rows[2];
+            const float* pRow = row.GetAsFloatPtr();
+            if (pRow[(axis + 1) % 3] != 0.0f || pRow[(axis + 2) % 3] != 0.0f || (pRow[axis] > 0.0f) != maxSide || pRow[axis] == 0.0f)
+            {
+                return false;
+            }
+
+            // 3 corners of a face xor to the 4th one
+            int missing = corners[0] ^ corners[1] ^ corners[2];
+            float w = rowW[2];
+            if (faceTris[face] == 0)
+            {
+                faceRow[face] = row;
+                faceW[face] = w;
+                faceMissing[face] = missing;
+                mBox.SetFace(face, row, w, Vector3::Normalize(row));
+            }
+            else
+            {
+                // the second triangle has to be the other half of the face, on the same plane
+                int inPlane = 7 & ~same;
+                if (faceTris[face] > 1 || (missing ^ faceMissing[face]) != inPlane ||
+                    pRow[axis] != faceRow[face].GetAsFloatPtr()[axis] || w != faceW[face])
+                {
+                    return false;
+                }
+            }
+            ++faceTris[face];
+        }
+        return true;
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -128,12 +632,94 @@ namespace Physics {
     ///////////////////////////////////////////////////////////////////////////////////////////////
     SoupObj::SoupObj()
         : mSoup(nullptr)
+        , mType(ShapeType::None)
     {}
 
     SoupObj::SoupObj(const TriangleSoup* pSoup, const Matrix4& obj2World)
         : mSoup(pSoup)
-        , mObj2World(obj2World)
-    {}
+        , mType(pSoup ? ShapeType::Soup : ShapeType::None)
+    {
+        SetTransform(obj2World);
+    }
+
+    /// <summary>
+    /// An oriented box: the box from -halfExtents to halfExtents, placed by obj2World
+    /// </summary>
+    SoupObj SoupObj::CreateBox(const Vector3& halfExtents, const Matrix4& obj2World)
+    {
+        SoupObj obj;
+        obj.mType = ShapeType::Box;
+        obj.mShapeSize = halfExtents;
+        obj.SetTransform(obj2World);
+        return obj;
+    }
+
+    /// <summary>
+    /// A sphere around the origin of obj2World
+    /// </summary>
+    SoupObj SoupObj::CreateSphere(float radius, const Matrix4& obj2World)
+    {
+        SoupObj obj;
+        obj.mType = ShapeType::Sphere;
+        obj.mShapeSize = Vector3(radius, 0.0f, 0.0f);
+        obj.SetTransform(obj2World);
+        return obj;
+    }
+
+    /// <summary>
+    /// A capsule along the y axis of obj2World: the cylinder from -halfHeight to halfHeight, capped with half spheres
+    /// </summary>
+    SoupObj SoupObj::CreateCapsule(float halfHeight, float radius, const Matrix4& obj2World)
+    {
+        SoupObj obj;
+        obj.mType = ShapeType::Capsule;
+        obj.mShapeSize = Vector3(radius, halfHeight, 0.0f);
+        obj.SetTransform(obj2World);
+        return obj;
+    }
+
+    /// <summary>
+    /// The bounds of the object in its own space
+    /// </summary>
+    AABB SoupObj::GetLocalBounds() const
+    {
+        switch (mType)
+        {
+        case ShapeType::Soup:
+            return mSoup->GetBounds();
+        case ShapeType::Box:
+            return AABB(-1.0f * mShapeSize, mShapeSize);
+        case ShapeType::Sphere:
+            return AABB(Vector3(-mShapeSize.x, -mShapeSize.x, -mShapeSize.x), Vector3(mShapeSize.x, mShapeSize.x, mShapeSize.x));
+        case ShapeType::Capsule:
+        {
+            Vector3 extent(mShapeSize.x, mShapeSize.y + mShapeSize.x, mShapeSize.x);
+            return AABB(-1.0f * extent, extent);
+        }
+        case ShapeType::None:
+            break;
+        }
+        return AABB();
+    }
+
+    /// <summary>
+    /// Set the transform of the object, and work out its inverse and world space bounds
+    /// </summary>
+    /// <param name="obj2World">the new object to world transform</param>
+    void SoupObj::SetTransform(const Matrix4& obj2World)
+    {
+        mObj2World = obj2World;
+        mWorld2Obj = obj2World;
+        if (obj2World.IsAffine())
+        {
+            mWorld2Obj.InvertAffine();
+        }
+        else
+        {
+            mWorld2Obj.Invert();
+        }
+        mWorldBounds = GetLocalBounds().Transform(mObj2World);
+    }
 
     /// <summary>
     /// Cast the LineSegment across the soup and return true if it intersects
@@ -144,27 +730,445 @@ namespace Physics {
     /// <returns>true if the LineSegment hits the soup</returns>
     bool SoupObj::RayCast(const LineSegment& line, CastInfo* info) const
     {
-        // TODO
-        return false;
+        return RayCast(line, Bvh::GetInvDir(line.mTo - line.mFrom), 1.0f, info);
+    }
+
+    /// <summary>
+    /// Same as RayCast(line, info), for callers that already have the inverse direction of the line
+    /// and only care about hits up to maxFraction (hits past it may or may not be reported)
+    /// </summary>
+    bool SoupObj::RayCast(const LineSegment& line, const Vector3& invDir, float maxFraction, CastInfo* info) const
+    {
+        if (false == mWorldBounds.RayCast(line.mFrom, invDir, maxFraction))
+        {
+            return false;
+        }
+        LineSegment objLine(Vector3::Transform(line.mFrom, mWorld2Obj), Vector3::Transform(line.mTo, mWorld2Obj));
+        CastInfo objInfo;
+        if (false == RayCastLocal(objLine, maxFraction, &objInfo))
+        {
+            return false;
+        }
+        if (info)
+        {
+            // affine transforms keep the fraction
+            info->mPoint = Vector3::Lerp(line.mFrom, line.mTo, objInfo.mFraction);
+            info->mNormal = NormalToWorld(objInfo.mNormal);
+            info->mFraction = objInfo.mFraction;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Does the LineSegment hit the object anywhere? Cheaper than RayCast, see TriangleSoup::IsOccluded
+    /// </summary>
+    bool SoupObj::IsOccluded(const LineSegment& line) const
+    {
+        return IsOccluded(line, Bvh::GetInvDir(line.mTo - line.mFrom), 1.0f);
+    }
+
+    /// <summary>
+    /// Same as IsOccluded(line), for callers that already have the inverse direction of the line
+    /// and only care about hits up to (and including) maxFraction
+    /// </summary>
+    bool SoupObj::IsOccluded(const LineSegment& line, const Vector3& invDir, float maxFraction) const
+    {
+        if (false == mWorldBounds.RayCast(line.mFrom, invDir, maxFraction))
+        {
+            return false;
+        }
+        LineSegment objLine(Vector3::Transform(line.mFrom, mWorld2Obj), Vector3::Transform(line.mTo, mWorld2Obj));
+        return IsOccludedLocal(objLine, maxFraction);
+    }
+
+    /// <summary>
+    /// Every place the LineSegment crosses the object up to (and including) maxFraction, closest first
+    /// See TriangleSoup::RayCastAll, the hits are returned in world space
+    /// </summary>
+    /// <returns>how many hits were written to pInfos</returns>
+    int SoupObj::RayCastAll(const LineSegment& line, const Vector3& invDir, float maxFraction, CastInfo* pInfos, int maxHits) const
+    {
+        if (maxHits <= 0 || false == mWorldBounds.RayCast(line.mFrom, invDir, maxFraction))
+        {
+            return 0;
+        }
+        LineSegment objLine(Vector3::Transform(line.mFrom, mWorld2Obj), Vector3::Transform(line.mTo, mWorld2Obj));
+        int count = RayCastAllLocal(objLine, maxFraction, pInfos, maxHits);
+        for (int i = 0; i < count; ++i)
+        {
+            pInfos[i].mPoint = Vector3::Lerp(line.mFrom, line.mTo, pInfos[i].mFraction);
+            pInfos[i].mNormal = NormalToWorld(pInfos[i].mNormal);
+        }
+        return count;
+    }
+
+    /// <summary>
+    /// Cast a LineSegment already in object space against the soup or shape, hits up to (and including) maxFraction count
+    /// The Local functions are what the world space ones do once the line is in object space, World calls them directly
+    /// </summary>
+    /// <param name="objInfo">OPTIONAL filled in with the hit, in object space</param>
+    bool SoupObj::RayCastLocal(const LineSegment& objLine, float maxFraction, CastInfo* objInfo) const
+    {
+        if (mType == ShapeType::Soup)
+        {
+            return mSoup->RayCast(objLine, maxFraction, objInfo);
+        }
+
+        Vector3 dir = objLine.mTo - objLine.mFrom;
+        float fraction;
+        Vector3 normal;
+        float limit = std::nextafter(maxFraction, 2.0f);
+        bool hit = false;
+        switch (mType)
+        {
+        case ShapeType::Box:
+            hit = BoxShape(AABB(-1.0f * mShapeSize, mShapeSize)).RayCast(objLine.mFrom, dir, limit, &fraction, &normal);
+            break;
+        case ShapeType::Sphere:
+            hit = RayCastSphere(mShapeSize.x, objLine.mFrom, dir, limit, &fraction, &normal);
+            break;
+        case ShapeType::Capsule:
+            hit = RayCastCapsule(mShapeSize.y, mShapeSize.x, objLine.mFrom, dir, limit, &fraction, &normal);
+            break;
+        case ShapeType::Soup:
+        case ShapeType::None:
+            break;
+        }
+        if (hit && objInfo)
+        {
+            objInfo->mPoint = objLine.mFrom + fraction * dir;
+            objInfo->mNormal = normal;
+            objInfo->mFraction = fraction;
+        }
+        return hit;
+    }
+
+    /// <summary>
+    /// Does a LineSegment already in object space hit the soup or shape up to (and including) maxFraction?
+    /// </summary>
+    bool SoupObj::IsOccludedLocal(const LineSegment& objLine, float maxFraction) const
+    {
+        if (mType == ShapeType::Soup)
+        {
+            return mSoup->IsOccluded(objLine, maxFraction);
+        }
+        return RayCastLocal(objLine, maxFraction, nullptr);
+    }
+
+    /// <summary>
+    /// Every place a LineSegment already in object space crosses the soup or shape, closest first, in object space
+    /// </summary>
+    /// <returns>how many hits were written to pInfos</returns>
+    int SoupObj::RayCastAllLocal(const LineSegment& objLine, float maxFraction, CastInfo* pInfos, int maxHits) const
+    {
+        if (mType == ShapeType::Soup)
+        {
+            return mSoup->RayCastAll(objLine, maxFraction, pInfos, maxHits);
+        }
+        // the analytic shapes are convex, they are entered once at most
+        return maxHits > 0 && RayCastLocal(objLine, maxFraction, pInfos) ? 1 : 0;
+    }
+
+    /// <summary>
+    /// Take a normal from object to world space. Normals go through the inverse transpose of obj2World
+    /// </summary>
+    Vector3 SoupObj::NormalToWorld(const Vector3& n) const
+    {
+        const Matrix4& world2Obj = mWorld2Obj;
+        Vector3 normal(
+            world2Obj.mat[0][0] * n.x + world2Obj.mat[0][1] * n.y + world2Obj.mat[0][2] * n.z,
+            world2Obj.mat[1][0] * n.x + world2Obj.mat[1][1] * n.y + world2Obj.mat[1][2] * n.z,
+            world2Obj.mat[2][0] * n.x + world2Obj.mat[2][1] * n.y + world2Obj.mat[2][2] * n.z
+        );
+        return Vector3::Normalize(normal);
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // World
     ///////////////////////////////////////////////////////////////////////////////////////////////
-    World::World()
+    World::World(AccelMode mode)
+        : mMode(mode)
+        , mAccelDirty(false)
     {}
 
     World::~World()
     {}
 
+    /// <summary>
+    /// Make room for objCount objects, so adding them one at a time does not grow the arrays over and over
+    /// </summary>
+    void World::Reserve(int objCount)
+    {
+        mObj.reserve(objCount);
+        mProxy.reserve(objCount);
+        mHot.Reserve(objCount);
+    }
+
     /// <summary>
     /// Add an object to the world.
     /// Feel free to edit this function if you want to
     /// </summary>
     /// <param name="obj">the object being added</param>
-    void World::AddObj(const SoupObj& obj)
+    /// <returns>the id of the object, used to move or remove it later</returns>
+    int World::AddObj(const SoupObj& obj)
     {
-        mObj.push_back(obj);
+        int id;
+        if (mFreeIds.empty())
+        {
+            id = (int)mObj.size();
+            mObj.push_back(obj);
+            mProxy.push_back(DynamicTree::NULL_NODE);
+            mHot.Resize((int)mObj.size());
+        }
+        else
+        {
+            id = mFreeIds.back();
+            mFreeIds.pop_back();
+            mObj[id] = obj;
+        }
+        if (false == obj.IsEmpty())
+        {
+            mHot.Set(id, obj.GetWorldBounds(), obj.GetWorld2Obj());
+        }
+
+        if (mMode == AccelMode::Dynamic && false == mAccelDirty)
+        {   // like Build(), the tree only holds objects with a shape
+            if (false == obj.IsEmpty())
+            {
+                mProxy[id] = mTree.CreateProxy(obj.GetWorldBounds(), id);
+            }
+        }
+        else
+        {
+            mAccelDirty = true;
+        }
+        return id;
+    }
+
+    /// <summary>
+    /// Add many objects at once (loading a level): the arrays grow once, and the acceleration structure is built
+    /// once, by the next cast or Build(), instead of being updated for every object (even in AccelMode::Dynamic).
+    /// Objects get the ids AddObj would give them one after the other, reused ids first.
+    /// </summary>
+    /// <param name="pObjs">the objects being added</param>
+    /// <param name="count">how many objects</param>
+    /// <param name="pIds">OPTIONAL count entries, filled in with the id of each object</param>
+    void World::AddObjs(const SoupObj* pObjs, int count, int* pIds)
+    {
+        int reused = Math::Min(count, (int)mFreeIds.size());
+        int oldCount = (int)mObj.size();
+        int newCount = oldCount + count - reused;
+        mObj.resize(newCount);
+        mProxy.resize(newCount, DynamicTree::NULL_NODE);
+        mHot.Resize(newCount);
+        for (int i = 0; i < count; ++i)
+        {
+            int id = i < reused ? mFreeIds[mFreeIds.size() - 1 - i] : oldCount + i - reused;
+            mObj[id] = pObjs[i];
+            if (false == pObjs[i].IsEmpty())
+            {
+                mHot.Set(id, pObjs[i].GetWorldBounds(), pObjs[i].GetWorld2Obj());
+            }
+            if (pIds)
+            {
+                pIds[i] = id;
+            }
+        }
+        mFreeIds.resize(mFreeIds.size() - reused);
+        if (count > 0)
+        {
+            mAccelDirty = true;
+        }
+    }
+
+    /// <summary>
+    /// Remove an object from the world. Its id may be handed out again by a later AddObj
+    /// An id that is out of range or already removed asserts, and is ignored in release builds
+    /// </summary>
+    /// <param name="id">the id returned by AddObj</param>
+    void World::RemoveObj(int id)
+    {
+        if (false == IsLiveId(id))
+        {
+            assert(false && "World::RemoveObj: id out of range or already removed");
+            return;
+        }
+        if (mProxy[id] != DynamicTree::NULL_NODE)
+        {
+            mTree.DestroyProxy(mProxy[id]);
+            mProxy[id] = DynamicTree::NULL_NODE;
+        }
+        mObj[id] = SoupObj();
+        mHot.SetEmpty(id);
+        mFreeIds.push_back(id);
+        if (mMode != AccelMode::Dynamic)
+        {
+            mAccelDirty = true;
+        }
+    }
+
+    /// <summary>
+    /// Move an object. In AccelMode::Dynamic this is cheap (nothing happens to the tree if the object stays
+    /// inside its fat bounds), the other modes need a Build() before they are used again.
+    /// An id that is out of range or already removed asserts, and is ignored in release builds
+    /// </summary>
+    /// <param name="id">the id returned by AddObj</param>
+    /// <param name="obj2World">the new transform of the object</param>
+    void World::UpdateTransform(int id, const Matrix4& obj2World)
+    {
+        if (false == IsLiveId(id))
+        {
+            assert(false && "World::UpdateTransform: id out of range or already removed");
+            return;
+        }
+        mObj[id].SetTransform(obj2World);
+        if (mObj[id].IsEmpty())
+        {   // in no structure, moving it changes nothing
+            return;
+        }
+        mHot.Set(id, mObj[id].GetWorldBounds(), mObj[id].GetWorld2Obj());
+        if (mProxy[id] != DynamicTree::NULL_NODE)
+        {
+            mTree.MoveProxy(mProxy[id], mObj[id].GetWorldBounds());
+        }
+        else
+        {
+            mAccelDirty = true;
+        }
+    }
+
+    /// <summary>
+    /// Was id handed out by AddObj and not removed since?
+    /// Removed slots are empty, so only an empty one can be on the free list.
+    /// </summary>
+    bool World::IsLiveId(int id) const
+    {
+        return id >= 0 && id < (int)mObj.size() &&
+            (false == mObj[id].IsEmpty() || std::find(mFreeIds.begin(), mFreeIds.end(), id) == mFreeIds.end());
+    }
+
+    /// <summary>
+    /// Choose the acceleration structure used by RayCast. Takes effect on the next Build()
+    /// </summary>
+    void World::SetAccelMode(AccelMode mode)
+    {
+        if (mode != mMode)
+        {
+            mMode = mode;
+            mAccelDirty = true;
+        }
+    }
+
+    /// <summary>
+    /// Build the acceleration structure over all the objects in the world.
+    /// The first cast after objects change does this by itself; call it to pay for the build up front instead.
+    /// In AccelMode::Dynamic the tree is kept up to date by AddObj/RemoveObj/UpdateTransform after the first Build().
+    /// Not safe to call while other threads are casting.
+    /// </summary>
+    void World::Build()
+    {
+        BuildAccel();
+    }
+
+    /// <summary>
+    /// Build() for the casts, which are const: only the mutable acceleration state changes
+    /// </summary>
+    void World::BuildAccel() const
+    {
+        mBvh.Clear();
+        mQuantizedBvh.Clear();
+        mGrid.Clear();
+        mTree.Clear();
+        mAccelObj.clear();
+        mAccelHot.Resize(0);
+        std::fill(mProxy.begin(), mProxy.end(), DynamicTree::NULL_NODE);
+
+        std::vector<AABB> bounds;
+        for (int id = 0; id < (int)mObj.size(); ++id)
+        {
+            if (false == mObj[id].IsEmpty())
+            {
+                mAccelObj.push_back(id);
+                bounds.push_back(mHot.GetBounds(id));
+            }
+        }
+
+        switch (mMode)
+        {
+        case AccelMode::Bvh:
+        case AccelMode::QuantizedBvh:
+        case AccelMode::Lbvh:
+        {
+            if (mMode == AccelMode::Lbvh)
+            {
+                mBvh.BuildLinear(bounds.data(), (int)bounds.size());
+            }
+            else
+            {
+                mBvh.Build(bounds.data(), (int)bounds.size());
+            }
+
+            // map the leaf ranges straight to object ids
+            const std::vector<int>& order = mBvh.GetPrimOrder();
+            std::vector<int> sorted(order.size());
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                sorted[i] = mAccelObj[order[i]];
+            }
+            mAccelObj.swap(sorted);
+            // the leaves visit objects in this order, a copy of their hot data in the same order saves a cache miss
+            // per object when many leaves are hit (large objects that overlap)
+            mAccelHot.Gather(mHot, mAccelObj);
+            if (mMode == AccelMode::QuantizedBvh)
+            {
+                if (mQuantizedBvh.Build(mBvh))
+                {   // otherwise too many objects for it: casts keep walking the Bvh
+                    mBvh.Clear();
+                }
+            }
+            break;
+        }
+        case AccelMode::Grid:
+            mGrid.Build(bounds.data(), (int)bounds.size());
+            break;
+        case AccelMode::Dynamic:
+            for (size_t i = 0; i < mAccelObj.size(); ++i)
+            {
+                int id = mAccelObj[i];
+                mProxy[id] = mTree.CreateProxy(bounds[i], id);
+            }
+            break;
+        case AccelMode::BruteForce:
+            break;
+        }
+        mAccelDirty.store(false, std::memory_order_release);
+    }
+
+    /// <summary>
+    /// Build the acceleration structure if objects changed since it was last built
+    /// Any number of threads may call this at once: the first one builds while the others wait for it, and once the
+    /// structure is up to date this is a single atomic load.
+    /// </summary>
+    void World::BuildIfDirty() const
+    {
+        if (false == mAccelDirty.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mBuildMutex);
+        if (mAccelDirty.load(std::memory_order_acquire))
+        {
+            // the structure only caches where the objects are, building it changes no answer a cast gives
+            BuildAccel();
+        }
+    }
+
+    /// <summary>
+    /// The memory taken by the nodes of the Bvh or QuantizedBvh (0 in the other modes)
+    /// </summary>
+    size_t World::GetAccelMemorySize() const
+    {
+        return mBvh.GetMemorySize() + mQuantizedBvh.GetMemorySize();
     }
 
     /// <summary>
@@ -176,7 +1180,374 @@ namespace Physics {
     /// <returns>true if the LineSegment hits the anything in the World</returns>
     bool World::RayCast(const LineSegment& line, CastInfo* info) const
     {
-        // TODO
+        BuildIfDirty();
+        CastInfo best;
+        int bestId = -1;
+        // just past the end of the segment, so a hit at exactly 1 still counts as closer
+        float maxFraction = std::nextafter(1.0f, 2.0f);
+        Vector3 invDir = Bvh::GetInvDir(line.mTo - line.mFrom);
+        bool hit = false;
+        switch (mMode)
+        {
+        case AccelMode::Bvh:
+        case AccelMode::QuantizedBvh:
+        case AccelMode::Lbvh:
+            hit = WalkBvh(line, maxFraction,
+                [&](int first, int count, float& fraction)
+                {
+                    bool leafHit = false;
+                    for (int i = first; i < first + count; ++i)
+                    {
+                        leafHit |= RayCastObj(mAccelHot, i, mAccelObj[i], line, invDir, fraction, best, bestId);
+                    }
+                    return leafHit;
+                });
+            break;
+        case AccelMode::Grid:
+            hit = mGrid.RayCast(line.mFrom, line.mTo, maxFraction,
+                [&](int prim, float& fraction)
+                {
+                    return RayCastObj(mHot, mAccelObj[prim], mAccelObj[prim], line, invDir, fraction, best, bestId);
+                });
+            break;
+        case AccelMode::Dynamic:
+            hit = mTree.RayCast(line.mFrom, line.mTo, maxFraction,
+                [&](int id, float& fraction)
+                {
+                    return RayCastObj(mHot, id, id, line, invDir, fraction, best, bestId);
+                });
+            break;
+        case AccelMode::BruteForce:
+            // empty slots have bounds nothing hits, so this only reads the bounds of the objects missed
+            for (int id = 0; id < mHot.GetCount(); ++id)
+            {
+                hit |= RayCastObj(mHot, id, id, line, invDir, maxFraction, best, bestId);
+            }
+            break;
+        }
+        if (hit && info)
+        {
+            *info = best;
+        }
+        return hit;
+    }
+
+    /// <summary>
+    /// Does the LineSegment hit anything in the World? (line of sight checks)
+    /// Gives the same answer as RayCast, but stops at the first hit it finds, whichever object it is on,
+    /// and never works out a point or a normal
+    /// </summary>
+    /// <param name="line">the LineSegment to check against the World</param>
+    /// <returns>true if the LineSegment hits anything in the World</returns>
+    bool World::IsOccluded(const LineSegment& line) const
+    {
+        BuildIfDirty();
+        Vector3 invDir = Bvh::GetInvDir(line.mTo - line.mFrom);
+        // the walks below stop once the callback drops maxFraction below zero
+        float maxFraction = 1.0f;
+        bool occluded = false;
+        auto testSlot = [&](const ObjArrays& hot, int slot, int id, float& fraction)
+        {
+            if (false == occluded && IsOccludedObj(hot, slot, id, line, invDir))
+            {
+                occluded = true;
+                fraction = -1.0f;
+            }
+            return occluded;
+        };
+        auto testObj = [&](int id, float& fraction)
+        {
+            return testSlot(mHot, id, id, fraction);
+        };
+        switch (mMode)
+        {
+        case AccelMode::Bvh:
+        case AccelMode::QuantizedBvh:
+        case AccelMode::Lbvh:
+            WalkBvh(line, maxFraction,
+                [&](int first, int count, float& fraction)
+                {
+                    for (int i = first; i < first + count && false == occluded; ++i)
+                    {
+                        testSlot(mAccelHot, i, mAccelObj[i], fraction);
+                    }
+                    return occluded;
+                });
+            break;
+        case AccelMode::Grid:
+            mGrid.RayCast(line.mFrom, line.mTo, maxFraction,
+                [&](int prim, float& fraction)
+                {
+                    return testObj(mAccelObj[prim], fraction);
+                });
+            break;
+        case AccelMode::Dynamic:
+            mTree.RayCast(line.mFrom, line.mTo, maxFraction, testObj);
+            break;
+        case AccelMode::BruteForce:
+            for (int id = 0; id < mHot.GetCount() && false == occluded; ++id)
+            {
+                testObj(id, maxFraction);
+            }
+            break;
+        }
+        return occluded;
+    }
+
+    /// <summary>
+    /// Find every surface the LineSegment crosses, in a single walk of the World (penetrating shots, sensors that see through glass)
+    /// Once maxHits hits are known, only objects in front of the farthest of them are visited.
+    /// </summary>
+    /// <param name="line">the LineSegment to check against the World</param>
+    /// <param name="pHits">maxHits entries, filled in with the closest hits sorted by mFraction (then mObjId)</param>
+    /// <param name="maxHits">the most hits to return</param>
+    /// <returns>how many hits were written to pHits</returns>
+    int World::RayCastAll(const LineSegment& line, CastHit* pHits, int maxHits) const
+    {
+        if (maxHits <= 0)
+        {
+            return 0;
+        }
+        auto less = [](const CastHit& a, const CastHit& b)
+        {
+            return a.mFraction < b.mFraction || (a.mFraction == b.mFraction && a.mObjId < b.mObjId);
+        };
+        BuildIfDirty();
+        Vector3 invDir = Bvh::GetInvDir(line.mTo - line.mFrom);
+        const int STACK_HITS = 16;
+        CastInfo stackHits[STACK_HITS];
+        std::vector<CastInfo> heapHits;     // only for an object that fills the stack buffer when more hits are wanted
+        int count = 0;
+        float maxFraction = 1.0f;
+        auto castSlot = [&](const ObjArrays& hot, int slot, int id, float& fraction)
+        {
+            CastInfo* pObjHits = stackHits;
+            int objCount = RayCastAllObj(hot, slot, id, line, invDir, fraction, stackHits, Math::Min(maxHits, STACK_HITS));
+            if (objCount == STACK_HITS && maxHits > STACK_HITS)
+            {   // the object may have more hits than fit on the stack
+                heapHits.resize(maxHits);
+                pObjHits = heapHits.data();
+                objCount = RayCastAllObj(hot, slot, id, line, invDir, fraction, pObjHits, maxHits);
+            }
+            bool kept = false;
+            for (int i = 0; i < objCount; ++i)
+            {
+                CastHit hit;
+                static_cast<CastInfo&>(hit) = pObjHits[i];
+                hit.mObjId = id;
+                kept |= KeepClosest(pHits, count, maxHits, hit, less);
+            }
+            if (count == maxHits)
+            {   // nothing past the farthest hit kept matters any more
+                fraction = pHits[0].mFraction;
+            }
+            return kept;
+        };
+        auto castObj = [&](int id, float& fraction)
+        {
+            return castSlot(mHot, id, id, fraction);
+        };
+        switch (mMode)
+        {
+        case AccelMode::Bvh:
+        case AccelMode::QuantizedBvh:
+        case AccelMode::Lbvh:
+            WalkBvh(line, maxFraction,
+                [&](int first, int num, float& fraction)
+                {
+                    bool kept = false;
+                    for (int i = first; i < first + num; ++i)
+                    {
+                        kept |= castSlot(mAccelHot, i, mAccelObj[i], fraction);
+                    }
+                    return kept;
+                });
+            break;
+        case AccelMode::Grid:
+            mGrid.RayCast(line.mFrom, line.mTo, maxFraction,
+                [&](int prim, float& fraction)
+                {
+                    return castObj(mAccelObj[prim], fraction);
+                });
+            break;
+        case AccelMode::Dynamic:
+            mTree.RayCast(line.mFrom, line.mTo, maxFraction, castObj);
+            break;
+        case AccelMode::BruteForce:
+            for (int id = 0; id < mHot.GetCount(); ++id)
+            {
+                castObj(id, maxFraction);
+            }
+            break;
+        }
+        std::sort_heap(pHits, pHits + count, less);
+        return count;
+    }
+
+    /// <summary>
+    /// Cast a packet of LineSegments across the World, giving the same results as calling RayCast on each of them
+    /// In AccelMode::Bvh and AccelMode::Lbvh the rays walk the hierarchy together (see RayPacket), each node and object
+    /// bounds test covering the whole packet. The other modes cast the rays one at a time.
+    /// </summary>
+    /// <param name="pLines">the LineSegments to check against the World</param>
+    /// <param name="count">how many LineSegments, at most RayPacket::MAX_RAYS (4, 8 or 16 are typical). A count out
+    /// of range asserts, and casts nothing in release builds</param>
+    /// <param name="pInfos">count entries, pInfos[r] is filled in if pLines[r] hits anything</param>
+    /// <returns>a mask with bit r set if pLines[r] hits anything</returns>
+    uint32_t World::RayCastPacket(const LineSegment* pLines, int count, CastInfo* pInfos) const
+    {
+        if (count < 0 || count > RayPacket::MAX_RAYS)
+        {
+            assert(false && "World::RayCastPacket: more rays than fit in a packet");
+            return 0;
+        }
+        uint32_t hitMask = 0;
+        BuildIfDirty();
+        if ((mMode != AccelMode::Bvh && mMode != AccelMode::Lbvh) || mBvh.IsEmpty())
+        {
+            for (int r = 0; r < count; ++r)
+            {
+                if (RayCast(pLines[r], &pInfos[r]))
+                {
+                    hitMask |= 1u << r;
+                }
+            }
+            return hitMask;
+        }
+
+        Vector3 from[RayPacket::MAX_RAYS];
+        Vector3 to[RayPacket::MAX_RAYS];
+        int bestId[RayPacket::MAX_RAYS];
+        for (int r = 0; r < count; ++r)
+        {
+            from[r] = pLines[r].mFrom;
+            to[r] = pLines[r].mTo;
+            bestId[r] = -1;
+        }
+        RayPacket packet(from, to, count);
+        packet.RayCast(mBvh.GetNodes(), packet.GetAllMask(),
+            [&](int first, int num, uint32_t mask)
+            {
+                for (int i = first; i < first + num; ++i)
+                {
+                    int id = mAccelObj[i];
+                    uint32_t objMask = packet.RayCast(mAccelHot.GetBounds(i), mask);
+                    for (int r = 0; objMask != 0; ++r, objMask >>= 1)
+                    {
+                        if ((objMask & 1u) &&
+                            RayCastObj(mAccelHot, i, id, pLines[r], packet.GetInvDir(r), packet.GetMaxFraction(r), pInfos[r], bestId[r]))
+                        {
+                            hitMask |= 1u << r;
+                        }
+                    }
+                }
+            });
+        return hitMask;
+    }
+
+    /// <summary>
+    /// Cast many independent LineSegments across the World, split across worker threads
+    /// Each line gets exactly what RayCast would give it, whatever the thread count or chunk size.
+    /// The World must not be changed until the call returns.
+    /// </summary>
+    /// <param name="pLines">the LineSegments to check against the World</param>
+    /// <param name="count">how many LineSegments</param>
+    /// <param name="pInfos">OPTIONAL count entries, pInfos[i] is filled in if pLines[i] hits anything</param>
+    /// <param name="pHits">OPTIONAL count entries, set to whether pLines[i] hits anything</param>
+    /// <param name="options">threads and chunk size</param>
+    void World::RayCastBatch(const LineSegment* pLines, size_t count, CastInfo* pInfos, bool* pHits, const BatchOptions& options) const
+    {
+        BuildIfDirty();     // before the threads start, so the build can use all of them
+        ParallelFor(count, options.mChunkSize, options.mThreadCount,
+            [&](size_t begin, size_t end)
+            {
+                // packets give the same answers as single casts, and are faster in AccelMode::Bvh
+                CastInfo infos[RayPacket::MAX_RAYS];
+                for (size_t i = begin; i < end; i += RayPacket::MAX_RAYS)
+                {
+                    int num = (int)std::min(end - i, (size_t)RayPacket::MAX_RAYS);
+                    uint32_t hitMask = RayCastPacket(pLines + i, num, infos);
+                    for (int r = 0; r < num; ++r)
+                    {
+                        bool hit = (hitMask & (1u << r)) != 0;
+                        if (pHits)
+                        {
+                            pHits[i + r] = hit;
+                        }
+                        if (pInfos && hit)
+                        {
+                            pInfos[i + r] = infos[r];
+                        }
+                    }
+                }
+            });
+    }
+
+    /// <summary>
+    /// Cast the LineSegment against one object, keeping the hit only if it is closer than maxFraction
+    /// A hit at exactly maxFraction replaces the best one if the object has a lower id, so the result
+    /// does not depend on the order the objects are tested in
+    /// </summary>
+    /// <param name="hot">mHot, or mAccelHot for a Bvh leaf</param>
+    /// <param name="slot">where the object is in hot</param>
+    /// <param name="id">the object to test</param>
+    /// <param name="line">the LineSegment to check against the object</param>
+    /// <param name="invDir">the inverse direction of the LineSegment (see Bvh::GetInvDir)</param>
+    /// <param name="maxFraction">the closest hit so far, lowered if this object is hit in front of it</param>
+    /// <param name="best">filled in if this object is hit in front of maxFraction</param>
+    /// <param name="bestId">the object of the closest hit so far, -1 if there is none</param>
+    /// <returns>true if the object was hit in front of maxFraction</returns>
+    bool World::RayCastObj(const ObjArrays& hot, int slot, int id, const LineSegment& line, const Vector3& invDir, float& maxFraction, CastInfo& best, int& bestId) const
+    {
+        if (false == hot.RayCastBounds(slot, line.mFrom, invDir, maxFraction))
+        {
+            return false;
+        }
+        LineSegment objLine(hot.PointToObj(slot, line.mFrom), hot.PointToObj(slot, line.mTo));
+        CastInfo objInfo;
+        if (mObj[id].RayCastLocal(objLine, maxFraction, &objInfo) &&
+            (objInfo.mFraction < maxFraction || (objInfo.mFraction == maxFraction && id < bestId)))
+        {
+            // affine transforms keep the fraction
+            maxFraction = objInfo.mFraction;
+            best.mPoint = Vector3::Lerp(line.mFrom, line.mTo, objInfo.mFraction);
+            best.mNormal = hot.NormalToWorld(slot, objInfo.mNormal);
+            best.mFraction = objInfo.mFraction;
+            bestId = id;
+            return true;
+        }
         return false;
     }
-}
\ No newline at end of file
+
+    /// <summary>
+    /// SoupObj::IsOccluded for one object of the world, from slot of the hot arrays (see RayCastObj)
+    /// </summary>
+    bool World::IsOccludedObj(const ObjArrays& hot, int slot, int id, const LineSegment& line, const Vector3& invDir) const
+    {
+        if (false == hot.RayCastBounds(slot, line.mFrom, invDir, 1.0f))
+        {
+            return false;
+        }
+        LineSegment objLine(hot.PointToObj(slot, line.mFrom), hot.PointToObj(slot, line.mTo));
+        return mObj[id].IsOccludedLocal(objLine, 1.0f);
+    }
+
+    /// <summary>
+    /// SoupObj::RayCastAll for one object of the world, from slot of the hot arrays (see RayCastObj)
+    /// </summary>
+    int World::RayCastAllObj(const ObjArrays& hot, int slot, int id, const LineSegment& line, const Vector3& invDir, float maxFraction, CastInfo* pInfos, int maxHits) const
+    {
+        if (false == hot.RayCastBounds(slot, line.mFrom, invDir, maxFraction))
+        {
+            return 0;
+        }
+        LineSegment objLine(hot.PointToObj(slot, line.mFrom), hot.PointToObj(slot, line.mTo));
+        int count = mObj[id].RayCastAllLocal(objLine, maxFraction, pInfos, maxHits);
+        for (int i = 0; i < count; ++i)
+        {
+            pInfos[i].mPoint = Vector3::Lerp(line.mFrom, line.mTo, pInfos[i].mFraction);
+            pInfos[i].mNormal = hot.NormalToWorld(slot, pInfos[i].mNormal);
+        }
+        return count;
+    }
+}
@@ -1,9 +1,24 @@
 #pragma once
 #include "Math.h"
+#include "Bvh.h"
+#include "QuantizedBvh.h"
+#include "Grid.h"
+#include "ObjArrays.h"
+#include "DynamicTree.h"
+#include "RayPacket.h"
+#include "Shapes.h"
+#include "TriangleKernel.h"
+#include <assert.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
 #include <vector>
 
 namespace Physics 
 {
+    class SceneCache;
+
     /// <summary>
     /// When we do a RayCast, this will be used to return data about the point we hit with the ray
     /// </summary>
@@ -14,6 +29,14 @@ namespace Physics
         float mFraction;    // how far along the line segment is the intersection (range 0 to 1)
     };
 
+    /// <summary>
+    /// One of the hits returned by World::RayCastAll
+    /// </summary>
+    class CastHit : public CastInfo {
+    public:
+        int mObjId;         // the id of the object that was hit (see World::AddObj)
+    };
+
     /// <summary>
     /// We'll be calling these things a Ray Cast, but it's really a Line Segment test
     /// You may add elements if you want to
@@ -22,8 +45,11 @@ namespace Physics
     public:
         Vector3 mFrom;
         Vector3 mTo;
-        LineSegment() {}
-        LineSegment(const Vector3& from, const Vector3& to);
+        constexpr LineSegment() {}
+        constexpr LineSegment(const Vector3& from, const Vector3& to)
+            : mFrom(from)
+            , mTo(to)
+        {}
     };
 
     /// <summary>
@@ -34,9 +60,15 @@ namespace Physics
     public:
         Vector3 mNormal;
         float mD;
-        Plane() : mD(0.0f) {}
-        Plane(const Vector3& point, const Vector3& normal);
-        Plane(const Vector3& normal, float d);
+        constexpr Plane() : mD(0.0f) {}
+        constexpr Plane(const Vector3& point, const Vector3& normal)
+            : mNormal(normal)
+            , mD(-Vector3::Dot(point, normal))
+        {}
+        constexpr Plane(const Vector3& normal, float d)
+            : mNormal(normal)
+            , mD(d)
+        {}
 
         bool RayCast(const LineSegment& line, CastInfo* info=nullptr) const;
     };
@@ -49,8 +81,10 @@ namespace Physics
     class Triangle {
     public:
         Vector3 mPoints[3];
-        Triangle() {}
-        Triangle(const Vector3& a, const Vector3& b, const Vector3& c);
+        constexpr Triangle() {}
+        constexpr Triangle(const Vector3& a, const Vector3& b, const Vector3& c)
+            : mPoints{ a, b, c }
+        {}
 
         Vector3 GetNormal() const;
         Plane GetPlane() const;
@@ -59,21 +93,158 @@ namespace Physics
         bool RayCast(const LineSegment& line, CastInfo* info=nullptr) const;
     };
 
+    /// <summary>
+    /// The precomputed triangles of a mesh known at compile time, worked out by the compiler (see MAKE_SOUP_DATA)
+    /// Declared constexpr, it is constant data in read-only memory, and TriangleSoup(const TriangleSoupData&) casts
+    /// against it in place. The triangles stay in index buffer order, as such soups are expected to be small.
+    /// pVerts and pIndices must outlive the data, the soup only reads them to detect boxes.
+    /// </summary>
+    template <int TRI_COUNT>
+    struct TriangleSoupData {
+        static const int STRIDE = TriangleStreams::GetPaddedCount(TRI_COUNT);
+
+        float mTriData[TriangleStreams::NUM_STREAMS * STRIDE];
+        AABB mBounds;
+        const Vector3* mVerts;
+        const int* mIndices;
+
+        /// <summary>
+        /// Same arguments as TriangleSoup(int, Vector3*, int, int*)
+        /// A wrong count or index reaches a throw, which fails to compile in a constexpr declaration in every build
+        /// configuration (and throws std::logic_error if the data is built at run time).
+        /// </summary>
+        constexpr TriangleSoupData(int vertCount, const Vector3* pVerts, int triCount, const int* pIndices)
+            : mTriData{}
+            , mVerts(pVerts)
+            , mIndices(pIndices)
+        {
+            triCount == TRI_COUNT ? void() : throw std::logic_error("TriangleSoupData: wrong triangle count");
+            for (int i = 0; i < TRI_COUNT; ++i)
+            {
+                const int* pTri = pIndices + i * 3;
+                for (int j = 0; j < 3; ++j)
+                {
+                    pTri[j] >= 0 && pTri[j] < vertCount ? void() : throw std::logic_error("TriangleSoupData: index out of range");
+                    mBounds.AddPoint(pVerts[pTri[j]]);
+                }
+                TriangleStreams::SetTriangle(mTriData, STRIDE, i, pVerts[pTri[0]], pVerts[pTri[1]], pVerts[pTri[2]]);
+            }
+        }
+    };
+
     /// <summary>
     /// A TriangleSoup is a collision mesh made out of a bunch of Triangle
     /// We cannot guarantee that the soup is entirely convex
+    /// The triangles are organized in a bounding volume hierarchy at construction
+    /// A soup that turns out to be an axis aligned box (2 triangles per face, see DetectBox) is cast against with a slab test
+    /// A soup made from a TriangleSoupData has no hierarchy, and does not own its triangles
     /// You may add data if you want to
     /// </summary>
     class TriangleSoup {
     public:
-        TriangleSoup(int vertCount, Vector3* pVerts, int triCount, int* pIndices);
+        /// <summary>
+        /// How a soup keeps its triangles, trading memory for cast speed
+        /// </summary>
+        enum class Format {
+            Precomputed,    // 48 bytes per triangle, the plane and edges worked out (TriangleStreams), SIMD kernel
+            Indexed,        // the vertices plus 6 or 12 bytes of indices per triangle (IndexedTriangles), scalar kernel
+            View,           // Indexed, but straight from the caller's buffers: only the hierarchy is built, nothing is copied
+        };
+
+        TriangleSoup(int vertCount, Vector3* pVerts, int triCount, int* pIndices, Format format = Format::Precomputed);
+        TriangleSoup(std::vector<Vector3>&& verts, int triCount, const int* pIndices);
+
+        /// <summary>
+        /// A Format::View soup, cast straight from the caller's vertex and index buffers, which are never written to
+        /// Lifetime: pVerts and pIndices must stay valid and unchanged for as long as the soup exists (and so as long as
+        /// any SoupObj or World uses it). The soup owns only its hierarchy and the order of the triangles in it.
+        /// TriangleSoup(vertCount, pVerts, triCount, pIndices, Format::View) does the same with int indices.
+        /// Every index is checked against vertCount once, here: a soup with one out of range is left without triangles
+        /// (GetTriCount() == 0) rather than reading past the vertices on every cast.
+        /// </summary>
+        TriangleSoup(int vertCount, const Vector3* pVerts, int triCount, const uint16_t* pIndices);
+        TriangleSoup(int vertCount, const Vector3* pVerts, int triCount, const uint32_t* pIndices);
+        template <int TRI_COUNT>
+        explicit TriangleSoup(const TriangleSoupData<TRI_COUNT>& data)
+            : TriangleSoup(data.mTriData, TriangleSoupData<TRI_COUNT>::STRIDE, TRI_COUNT, data.mBounds, data.mVerts, data.mIndices)
+        {}
         ~TriangleSoup();
 
+        TriangleSoup(const TriangleSoup&) = delete;
+        TriangleSoup& operator=(const TriangleSoup&) = delete;
+
         bool RayCast(const LineSegment& line, CastInfo* info = nullptr) const;
+        bool RayCast(const LineSegment& line, float maxFraction, CastInfo* info) const;
+        bool IsOccluded(const LineSegment& line, float maxFraction = 1.0f) const;
+        int RayCastAll(const LineSegment& line, float maxFraction, CastInfo* pInfos, int maxHits) const;
+        const AABB& GetBounds() const { return mBounds; }
+        int GetTriCount() const { return mTriCount; }
+        bool IsBox() const { return mIsBox; }
+        Format GetFormat() const { return mFormat; }
+        size_t GetTriMemorySize() const;
+        void CompressBvh();
+        size_t GetBvhMemorySize() const { return mBvh.GetMemorySize() + mQuantizedBvh.GetMemorySize(); }
 
     private:
-        Triangle* mTris;
+        friend class SceneCache;
+
+        TriangleSoup(const float* pTriData, int stride, int triCount, const AABB& bounds, const Vector3* pVerts, const int* pIndices);
+        TriangleSoup(int triCount, const AABB& bounds);
+
+        /// <summary>
+        /// Walk whichever hierarchy the soup has, see Bvh::RayCast
+        /// Without one, all the triangles are a single leaf behind the soup's bounds
+        /// </summary>
+        template <typename LeafFunc>
+        void WalkBvh(const LineSegment& line, float& maxFraction, LeafFunc leafFunc) const
+        {
+            if (false == mQuantizedBvh.IsEmpty())
+            {
+                mQuantizedBvh.RayCast(line.mFrom, line.mTo, maxFraction, leafFunc);
+            }
+            else if (false == mBvh.IsEmpty())
+            {
+                mBvh.RayCast(line.mFrom, line.mTo, maxFraction, leafFunc);
+            }
+            else if (mTriCount > 0 && mBounds.RayCast(line.mFrom, Bvh::GetInvDir(line.mTo - line.mFrom), maxFraction))
+            {
+                leafFunc(0, mTriCount, maxFraction);
+            }
+        }
+
+        /// <summary>
+        /// castFunc(tris) with the soup's triangles, either TriangleStreams or IndexedTriangles (see Format)
+        /// </summary>
+        template <typename CastFunc>
+        int CastTriangles(CastFunc castFunc) const
+        {
+            return mFormat == Format::Precomputed ? castFunc(mStreams) : castFunc(mIndexed);
+        }
+
+        template <typename Index>
+        bool BuildBvh(int vertCount, const Vector3* pVerts, const Index* pIndices);
+        template <typename Index>
+        void BuildView(int vertCount, const Vector3* pVerts, const Index* pIndices);
+        void BuildIndexed(const int* pIndices);
+
+        Vector3 GetTriNormal(int tri) const;
+        template <typename Index>
+        bool DetectBox(const Vector3* pVerts, const Index* pIndices);
+
+        float* mTriData;            // precomputed triangles in the leaf order of mBvh, padded for the kernel, null if not owned
+        TriangleStreams mStreams;   // where each stream starts in mTriData
+        Format mFormat;
+        std::vector<Vector3> mVerts;        // Indexed: the vertices
+        std::vector<uint16_t> mIndices16;   // Indexed: 3 per triangle in the leaf order of mBvh, if there are at most 65536 vertices
+        std::vector<uint32_t> mIndices32;   // Indexed: the same, if there are more
+        std::vector<int> mTriOrder;         // View: the triangle at each leaf position
+        IndexedTriangles mIndexed;          // points into the 3 above, or the caller's buffers and mTriOrder for a View
         int mTriCount;
+        AABB mBounds;               // object space bounds of all the triangles
+        Bvh mBvh;                   // built once per soup and shared by every SoupObj using it
+        QuantizedBvh mQuantizedBvh; // replaces mBvh after CompressBvh()
+        bool mIsBox;                // the triangles are exactly the faces of mBox
+        BoxShape mBox;
     };
 
     /// <summary>
@@ -81,32 +252,144 @@ namespace Physics
     /// This is essentially an instance of a TriangleSoup... thus we have a POINTER to a soup
     /// It is presumed we'll re-use the same soup on multiple different SoupObj
     /// so do not delete that pointer in the destructor
+    /// Instead of a soup, the object can be an analytic shape (see CreateBox, CreateSphere and CreateCapsule), picked by
+    /// its ShapeType rather than virtual functions so every object stays the same size in the World's array
+    /// The inverse transform and the world space bounds are worked out whenever the transform is set,
+    /// so casting against the object never has to invert a matrix
     /// You may add data if you want to
     /// </summary>
     class SoupObj {
     public:
         const TriangleSoup* mSoup;
-        Matrix4 mObj2World;
 
         SoupObj();
         SoupObj(const TriangleSoup* pSoup, const Matrix4& obj2World);
 
+        static SoupObj CreateBox(const Vector3& halfExtents, const Matrix4& obj2World);
+        static SoupObj CreateSphere(float radius, const Matrix4& obj2World);
+        static SoupObj CreateCapsule(float halfHeight, float radius, const Matrix4& obj2World);
+
+        ShapeType GetShapeType() const { return mType; }
+        bool IsEmpty() const { return mType == ShapeType::None; }
+        AABB GetLocalBounds() const;
+        void SetTransform(const Matrix4& obj2World);
+        const Matrix4& GetObj2World() const { return mObj2World; }
+        const Matrix4& GetWorld2Obj() const { return mWorld2Obj; }
+        const AABB& GetWorldBounds() const { return mWorldBounds; }
+
         bool RayCast(const LineSegment& line, CastInfo* info = nullptr) const;
+        bool RayCast(const LineSegment& line, const Vector3& invDir, float maxFraction, CastInfo* info) const;
+        bool IsOccluded(const LineSegment& line) const;
+        bool IsOccluded(const LineSegment& line, const Vector3& invDir, float maxFraction) const;
+        int RayCastAll(const LineSegment& line, const Vector3& invDir, float maxFraction, CastInfo* pInfos, int maxHits) const;
+
+        bool RayCastLocal(const LineSegment& objLine, float maxFraction, CastInfo* objInfo) const;
+        bool IsOccludedLocal(const LineSegment& objLine, float maxFraction) const;
+        int RayCastAllLocal(const LineSegment& objLine, float maxFraction, CastInfo* pInfos, int maxHits) const;
+
+    private:
+        friend class SceneCache;
+
+        Vector3 NormalToWorld(const Vector3& n) const;
+
+        ShapeType mType;
+        Vector3 mShapeSize;     // Box: half extents, Sphere: x is the radius, Capsule: x is the radius and y the half height
+        Matrix4 mObj2World;
+        Matrix4 mWorld2Obj;
+        AABB mWorldBounds;
     };
 
     /// <summary>
     /// The World is the container for all the SoupObj.
     /// You may add data or reorganize any way you want to
+    /// Changes to the objects only mark the acceleration structure dirty; the first cast after them builds it again,
+    /// once, however many threads are casting. Changes must not overlap casts.
     /// </summary>
     class World {
     public:
-        World();
+        /// <summary>
+        /// The acceleration structure World::RayCast uses to find the objects a LineSegment can touch
+        /// </summary>
+        enum class AccelMode {
+            BruteForce, // test every object
+            Bvh,        // surface area heuristic bounding volume hierarchy
+            QuantizedBvh, // the same hierarchy with 16 bit bounds, half the memory (see QuantizedBvh)
+            Grid,       // uniform grid walked with a 3D-DDA, best for short segments
+            Dynamic,    // dynamic AABB tree, updated in place as objects move
+            Lbvh,       // Bvh built from Morton codes (Bvh::BuildLinear), for worlds rebuilt every frame
+        };
+
+        /// <summary>
+        /// How RayCastBatch splits its work
+        /// </summary>
+        struct BatchOptions {
+            int mThreadCount;   // threads to use, counting the caller, <= 0 for one per core
+            size_t mChunkSize;  // lines a thread takes at a time
+
+            BatchOptions(int threadCount = 0, size_t chunkSize = 256)
+                : mThreadCount(threadCount)
+                , mChunkSize(chunkSize)
+            {}
+        };
+
+        World(AccelMode mode = AccelMode::Bvh);
         ~World();
 
-        void AddObj(const SoupObj& obj);
+        void Reserve(int objCount);
+        int AddObj(const SoupObj& obj);
+        void AddObjs(const SoupObj* pObjs, int count, int* pIds = nullptr);
+        void RemoveObj(int id);
+        void UpdateTransform(int id, const Matrix4& obj2World);
+        const SoupObj& GetObj(int id) const { return mObj[id]; }
+        void SetAccelMode(AccelMode mode);
+        AccelMode GetAccelMode() const { return mMode; }
+        void Build();
+        bool IsAccelDirty() const { return mAccelDirty.load(std::memory_order_acquire); }
+        size_t GetAccelMemorySize() const;
         bool RayCast(const LineSegment& line, CastInfo* info = nullptr) const;
+        bool IsOccluded(const LineSegment& line) const;
+        int RayCastAll(const LineSegment& line, CastHit* pHits, int maxHits) const;
+        uint32_t RayCastPacket(const LineSegment* pLines, int count, CastInfo* pInfos) const;
+        void RayCastBatch(const LineSegment* pLines, size_t count, CastInfo* pInfos, bool* pHits,
+            const BatchOptions& options = BatchOptions()) const;
 
     private:
-        std::vector<SoupObj> mObj;
+        friend class SceneCache;
+
+        /// <summary>
+        /// Walk the Bvh of AccelMode::Bvh or AccelMode::QuantizedBvh, see Bvh::RayCast
+        /// A QuantizedBvh that could not be built (too many objects) leaves the Bvh in place.
+        /// </summary>
+        template <typename LeafFunc>
+        bool WalkBvh(const LineSegment& line, float& maxFraction, LeafFunc leafFunc) const
+        {
+            if (false == mQuantizedBvh.IsEmpty())
+            {
+                return mQuantizedBvh.RayCast(line.mFrom, line.mTo, maxFraction, leafFunc);
+            }
+            return mBvh.RayCast(line.mFrom, line.mTo, maxFraction, leafFunc);
+        }
+
+        bool IsLiveId(int id) const;
+        void BuildAccel() const;
+        void BuildIfDirty() const;
+        bool RayCastObj(const ObjArrays& hot, int slot, int id, const LineSegment& line, const Vector3& invDir, float& maxFraction, CastInfo& best, int& bestId) const;
+        bool IsOccludedObj(const ObjArrays& hot, int slot, int id, const LineSegment& line, const Vector3& invDir) const;
+        int RayCastAllObj(const ObjArrays& hot, int slot, int id, const LineSegment& line, const Vector3& invDir, float maxFraction, CastInfo* pInfos, int maxHits) const;
+
+        std::vector<SoupObj> mObj;      // indexed by object id, removed objects are empty
+        ObjArrays mHot;                 // the bounds and inverse transforms of mObj, for the cast loops
+        std::vector<int> mFreeIds;
+        AccelMode mMode;
+        // the acceleration state is mutable: a const World still builds it on its first cast (see BuildIfDirty)
+        mutable std::atomic<bool> mAccelDirty;  // objects changed since the last Build(), the next cast builds again
+        mutable std::mutex mBuildMutex; // one cast builds, the others wait for it
+        mutable Bvh mBvh;
+        mutable QuantizedBvh mQuantizedBvh;
+        mutable Grid mGrid;
+        mutable std::vector<int> mAccelObj;     // object id of every Bvh/Grid primitive
+        mutable ObjArrays mAccelHot;    // Bvh modes: mHot of every mAccelObj entry, in leaf order
+        mutable DynamicTree mTree;
+        mutable std::vector<int> mProxy;        // DynamicTree proxy of every object id
     };
-};
+};
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "QuantizedBvh.h"
+#include <assert.h>
+
+namespace Physics {
+
+    namespace {
+        /// <summary>
+        /// The steps from the sides of bounds to the sides of child, rounded outwards so the decoded child
+        /// contains child. Sides that cannot be reached in 16 bits stay on the sides of bounds.
+        /// </summary>
+        void Quantize(const AABB& bounds, const Vector3& step, const AABB& child, uint16_t* pMin, uint16_t* pMax)
+        {
+            const float* pLo = bounds.mMin.GetAsFloatPtr();
+            const float* pHi = bounds.mMax.GetAsFloatPtr();
+            const float* pChildLo = child.mMin.GetAsFloatPtr();
+            const float* pChildHi = child.mMax.GetAsFloatPtr();
+            const float* pStep = step.GetAsFloatPtr();
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                int qMin = 0;
+                int qMax = 0;
+                if (pStep[axis] > 0.0f)
+                {
+                    qMin = (int)Math::Min((pChildLo[axis] - pLo[axis]) / pStep[axis], 65535.0f);
+                    qMax = (int)Math::Min((pHi[axis] - pChildHi[axis]) / pStep[axis], 65535.0f);
+                    qMin = Math::Max(qMin, 0);
+                    qMax = Math::Max(qMax, 0);
+                    // the divide rounds, step back until the decoded side is outside the child's
+                    while (qMin > 0 && pLo[axis] + qMin * pStep[axis] > pChildLo[axis])
+                    {
+                        --qMin;
+                    }
+                    while (qMax > 0 && pHi[axis] - qMax * pStep[axis] < pChildHi[axis])
+                    {
+                        --qMax;
+                    }
+                }
+                pMin[axis] = (uint16_t)qMin;
+                pMax[axis] = (uint16_t)qMax;
+            }
+        }
+    }
+
+    QuantizedBvh::QuantizedBvh()
+        : mRoot(EMPTY)
+        , mExternalNodes(nullptr)
+        , mExternalCount(0)
+    {}
+
+    /// <summary>
+    /// Build the compressed copy of a Bvh. The Bvh can be cleared afterwards, keeping its primitive order if needed.
+    /// </summary>
+    /// <param name="bvh">the hierarchy to compress</param>
+    /// <returns>false if the Bvh has more primitives than a reference can address (2^28), the tree is left empty</returns>
+    bool QuantizedBvh::Build(const Bvh& bvh)
+    {
+        Clear();
+        const BvhNode* bvhNodes = bvh.GetNodes();
+        if (bvh.IsEmpty())
+        {
+            return true;
+        }
+        if (bvh.GetPrimOrder().size() > (size_t)QuantizedBvhNode::FIRST_MASK + 1)
+        {
+            return false;
+        }
+        mNodes.reserve(bvh.GetNodeCount() / 2 + 1);
+        mRootBounds = bvhNodes[0].mBounds;
+        mRoot = BuildRef(bvhNodes, 0, mRootBounds);
+        return true;
+    }
+
+    void QuantizedBvh::Clear()
+    {
+        mNodes.clear();
+        mRootBounds = AABB();
+        mRoot = EMPTY;
+        mExternalNodes = nullptr;
+        mExternalCount = 0;
+    }
+
+    /// <summary>
+    /// Walk nodes kept elsewhere, such as a mapped SceneCache file, instead of building them
+    /// They must stay valid until the next Build or Clear.
+    /// </summary>
+    /// <param name="pNodes">the nodes, as GetNodes() returns them</param>
+    /// <param name="nodeCount">the number of nodes</param>
+    /// <param name="root">the reference to the root, as GetRoot() returns it</param>
+    /// <param name="rootBounds">the bounds of the root, as GetRootBounds() returns them</param>
+    void QuantizedBvh::SetExternalNodes(const QuantizedBvhNode* pNodes, int nodeCount, uint32_t root, const AABB& rootBounds)
+    {
+        Clear();
+        mExternalNodes = pNodes;
+        mExternalCount = nodeCount;
+        mRoot = root;
+        mRootBounds = rootBounds;
+    }
+
+    /// <summary>
+    /// Add a node for two children of a node with the given (decoded) bounds
+    /// </summary>
+    /// <returns>the index of the node</returns>
+    uint32_t QuantizedBvh::AddNode(const AABB& bounds, const AABB& childA, const AABB& childB)
+    {
+        Vector3 step = GetStep(bounds);
+        QuantizedBvhNode node;
+        Quantize(bounds, step, childA, node.mMin[0], node.mMax[0]);
+        Quantize(bounds, step, childB, node.mMin[1], node.mMax[1]);
+        node.mChild[0] = EMPTY;
+        node.mChild[1] = EMPTY;
+        mNodes.push_back(node);
+        return (uint32_t)mNodes.size() - 1;
+    }
+
+    /// <summary>
+    /// Compress the subtree of a Bvh node
+    /// </summary>
+    /// <param name="bvhNodes">the nodes of the Bvh</param>
+    /// <param name="bvhNode">the root of the subtree</param>
+    /// <param name="bounds">the bounds the walk will decode for it, they contain its bounds in the Bvh</param>
+    /// <returns>the reference to the subtree</returns>
+    uint32_t QuantizedBvh::BuildRef(const BvhNode* bvhNodes, int bvhNode, const AABB& bounds)
+    {
+        const BvhNode& cur = bvhNodes[bvhNode];
+        if (cur.mCount > 0)
+        {
+            return BuildLeaf(cur.mFirst, cur.mCount, bounds);
+        }
+        uint32_t index = AddNode(bounds, bvhNodes[cur.mFirst].mBounds, bvhNodes[cur.mFirst + 1].mBounds);
+        Vector3 step = GetStep(bounds);
+        for (int c = 0; c < 2; ++c)
+        {
+            // decoded here just as the walk will decode it
+            AABB child = Decode(bounds, step, mNodes[index].mMin[c], mNodes[index].mMax[c]);
+            uint32_t ref = BuildRef(bvhNodes, cur.mFirst + c, child);
+            mNodes[index].mChild[c] = ref;
+        }
+        return index;
+    }
+
+    /// <summary>
+    /// A leaf, split in halves (all with the bounds of the leaf) until each fits in a reference
+    /// </summary>
+    uint32_t QuantizedBvh::BuildLeaf(int first, int count, const AABB& bounds)
+    {
+        if (count <= QuantizedBvhNode::MAX_LEAF_COUNT)
+        {
+            // Build refuses more primitives than fit, so the first one never spills into the count
+            assert((uint32_t)(first + count - 1) <= QuantizedBvhNode::FIRST_MASK);
+            return QuantizedBvhNode::LEAF_FLAG | ((uint32_t)(count - 1) << QuantizedBvhNode::COUNT_SHIFT) | (uint32_t)first;
+        }
+        uint32_t index = AddNode(bounds, bounds, bounds);
+        int half = count / 2;
+        uint32_t refA = BuildLeaf(first, half, bounds);
+        uint32_t refB = BuildLeaf(first + half, count - half, bounds);
+        mNodes[index].mChild[0] = refA;
+        mNodes[index].mChild[1] = refB;
+        return index;
+    }
+}
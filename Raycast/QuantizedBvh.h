@@ -0,0 +1,183 @@
+#pragma once
+#include "Bvh.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// A 32 byte node of a QuantizedBvh: the bounds of its two children, as 16 bit steps in from the sides of the
+    /// node's own (decoded) bounds, and a reference to each child.
+    /// A child reference with LEAF_FLAG set is a leaf: (count - 1) in the 3 bits above the 28 bit first primitive.
+    /// Otherwise it is the index of the child's node.
+    /// </summary>
+    struct alignas(32) QuantizedBvhNode {
+        static const uint32_t LEAF_FLAG = 0x80000000u;
+        static const uint32_t COUNT_SHIFT = 28;
+        static const uint32_t FIRST_MASK = (1u << COUNT_SHIFT) - 1;
+        static const int MAX_LEAF_COUNT = 8;
+
+        uint16_t mMin[2][3];    // steps up from the node's min, per child and axis
+        uint16_t mMax[2][3];    // steps down from the node's max, per child and axis
+        uint32_t mChild[2];
+    };
+
+    /// <summary>
+    /// A compressed copy of a Bvh, half its size: where the Bvh keeps a 32 byte node per child, this keeps a
+    /// 32 byte node per pair of children, with their bounds quantized relative to their parent.
+    /// The quantized bounds are always rounded outwards, so a walk visits every leaf the Bvh walk would (and
+    /// maybe a few more), and casts find the same closest hits. The leaf ranges are the ones of the Bvh, so
+    /// the owner keeps using Bvh::GetPrimOrder() to reorder its data. Leaves bigger than
+    /// QuantizedBvhNode::MAX_LEAF_COUNT are split, and at most 2^28 primitives are supported: Build refuses more.
+    /// The steps are powers of two, so decoding is exact and the walk sees the very boxes the build made.
+    /// Instead of being built, a QuantizedBvh can walk nodes kept elsewhere (see SetExternalNodes).
+    /// </summary>
+    class QuantizedBvh {
+    public:
+        static const int MAX_STACK = Bvh::MAX_DEPTH + 32;
+
+        QuantizedBvh();
+
+        bool Build(const Bvh& bvh);
+        void Clear();
+        void SetExternalNodes(const QuantizedBvhNode* pNodes, int nodeCount, uint32_t root, const AABB& rootBounds);
+
+        bool IsEmpty() const { return mRoot == EMPTY; }
+        const QuantizedBvhNode* GetNodes() const { return mExternalNodes ? mExternalNodes : mNodes.data(); }
+        int GetNodeCount() const { return mExternalNodes ? mExternalCount : (int)mNodes.size(); }
+        uint32_t GetRoot() const { return mRoot; }
+        const AABB& GetRootBounds() const { return mRootBounds; }
+        size_t GetMemorySize() const { return mNodes.size() * sizeof(QuantizedBvhNode); }
+
+        /// <summary>
+        /// Walk the hierarchy front to back along the segment from -> to, exactly like Bvh::RayCast
+        /// leafFunc(first, count, maxFraction) is called for every leaf the segment reaches; it returns true
+        /// if it found a hit, in which case it must have lowered maxFraction to the fraction of that hit.
+        /// A callback that drops maxFraction below zero ends the walk (any-hit queries).
+        /// </summary>
+        /// <returns>true if any call to leafFunc returned true</returns>
+        template <typename LeafFunc>
+        bool RayCast(const Vector3& from, const Vector3& to, float& maxFraction, LeafFunc leafFunc) const
+        {
+            struct StackEntry {
+                uint32_t mRef;
+                float mEnter;
+                AABB mBounds;
+            };
+            if (mRoot == EMPTY)
+            {
+                return false;
+            }
+            Vector3 invDir = Bvh::GetInvDir(to - from);
+            StackEntry cur = { mRoot, 0.0f, mRootBounds };
+            if (false == cur.mBounds.RayCast(from, invDir, maxFraction, &cur.mEnter))
+            {
+                return false;
+            }
+
+            const QuantizedBvhNode* pNodes = GetNodes();
+            StackEntry stack[MAX_STACK];
+            int stackSize = 0;
+            bool hit = false;
+            for (;;)
+            {
+                if (cur.mRef & QuantizedBvhNode::LEAF_FLAG)
+                {
+                    int first = (int)(cur.mRef & QuantizedBvhNode::FIRST_MASK);
+                    int count = (int)((cur.mRef & ~QuantizedBvhNode::LEAF_FLAG) >> QuantizedBvhNode::COUNT_SHIFT) + 1;
+                    hit |= leafFunc(first, count, maxFraction);
+                }
+                else
+                {
+                    const QuantizedBvhNode& node = pNodes[cur.mRef];
+                    Vector3 step = GetStep(cur.mBounds);
+                    StackEntry a = { node.mChild[0], 0.0f, Decode(cur.mBounds, step, node.mMin[0], node.mMax[0]) };
+                    StackEntry b = { node.mChild[1], 0.0f, Decode(cur.mBounds, step, node.mMin[1], node.mMax[1]) };
+                    bool hitA = a.mBounds.RayCast(from, invDir, maxFraction, &a.mEnter);
+                    bool hitB = b.mBounds.RayCast(from, invDir, maxFraction, &b.mEnter);
+                    if (hitA && hitB)
+                    {
+                        if (a.mEnter <= b.mEnter)
+                        {
+                            stack[stackSize++] = b;
+                            cur = a;
+                        }
+                        else
+                        {
+                            stack[stackSize++] = a;
+                            cur = b;
+                        }
+                        continue;
+                    }
+                    if (hitA || hitB)
+                    {
+                        cur = hitA ? a : b;
+                        continue;
+                    }
+                }
+
+                // pop the next subtree that is still in front of the closest hit
+                bool found = false;
+                while (stackSize > 0 && false == found)
+                {
+                    cur = stack[--stackSize];
+                    found = cur.mEnter <= maxFraction;
+                }
+                if (false == found)
+                {
+                    break;
+                }
+            }
+            return hit;
+        }
+
+    private:
+        static const uint32_t EMPTY = 0xffffffffu;
+
+        /// <summary>
+        /// The size of one quantization step across each axis of bounds: the power of two that is about
+        /// 1/32768th of the extent (straight from its exponent bits), or 0 for a flat axis
+        /// </summary>
+        static Vector3 GetStep(const AABB& bounds)
+        {
+            return Vector3(GetStep(bounds.mMax.x - bounds.mMin.x), GetStep(bounds.mMax.y - bounds.mMin.y), GetStep(bounds.mMax.z - bounds.mMin.z));
+        }
+
+        static float GetStep(float extent)
+        {
+            if (false == (extent > 0.0f))
+            {
+                return 0.0f;
+            }
+            uint32_t bits;
+            std::memcpy(&bits, &extent, sizeof(bits));
+            int exponent = Math::Max((int)(bits >> 23) - 15, 1);
+            bits = (uint32_t)exponent << 23;
+            float step;
+            std::memcpy(&step, &bits, sizeof(step));
+            return step;
+        }
+
+        /// <summary>
+        /// The bounds of a child, from the bounds of its node. q * step is exact, so this rounds once per side
+        /// </summary>
+        static AABB Decode(const AABB& bounds, const Vector3& step, const uint16_t* pMin, const uint16_t* pMax)
+        {
+            return AABB(
+                Vector3(bounds.mMin.x + pMin[0] * step.x, bounds.mMin.y + pMin[1] * step.y, bounds.mMin.z + pMin[2] * step.z),
+                Vector3(bounds.mMax.x - pMax[0] * step.x, bounds.mMax.y - pMax[1] * step.y, bounds.mMax.z - pMax[2] * step.z)
+            );
+        }
+
+        uint32_t AddNode(const AABB& bounds, const AABB& childA, const AABB& childB);
+        uint32_t BuildRef(const BvhNode* bvhNodes, int bvhNode, const AABB& bounds);
+        uint32_t BuildLeaf(int first, int count, const AABB& bounds);
+
+        AABB mRootBounds;
+        uint32_t mRoot;
+        std::vector<QuantizedBvhNode> mNodes;
+        const QuantizedBvhNode* mExternalNodes;  // not owned, replaces mNodes if set
+        int mExternalCount;
+    };
+}
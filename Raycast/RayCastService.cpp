@@ -0,0 +1,159 @@
+#include "RayCastService.h"
+#include "Parallel.h"
+
+namespace Physics {
+
+    /// <summary>
+    /// Start the workers
+    /// </summary>
+    /// <param name="world">the World every cast goes against</param>
+    /// <param name="workerCount">how many worker threads, <= 0 for one per core</param>
+    RayCastService::RayCastService(const World& world, int workerCount)
+        : mWorld(world)
+        , mPending(0)
+        , mSleeping(0)
+        , mStop(false)
+    {
+        if (workerCount <= 0)
+        {
+            workerCount = GetDefaultThreadCount();
+        }
+        for (int i = 0; i < workerCount; ++i)
+        {
+            mWorkers.emplace_back(&RayCastService::WorkerMain, this);
+        }
+    }
+
+    /// <summary>
+    /// Finish every request already submitted, then stop the workers
+    /// </summary>
+    RayCastService::~RayCastService()
+    {
+        mStop.store(true);
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+        }
+        mWake.notify_all();
+        for (std::thread& worker : mWorkers)
+        {
+            worker.join();
+        }
+    }
+
+    /// <summary>
+    /// Queue a cast, the result arrives in the returned future
+    /// </summary>
+    std::future<RayCastResult> RayCastService::Submit(const LineSegment& line)
+    {
+        Request* pRequest = new Request();
+        pRequest->mLine = line;
+        std::future<RayCastResult> future = pRequest->mPromise.get_future();
+        Push(pRequest);
+        return future;
+    }
+
+    /// <summary>
+    /// Queue a cast, callback(result) is called on a worker thread once it is done
+    /// </summary>
+    void RayCastService::Submit(const LineSegment& line, Callback callback)
+    {
+        Request* pRequest = new Request();
+        pRequest->mLine = line;
+        pRequest->mCallback = std::move(callback);
+        Push(pRequest);
+    }
+
+    void RayCastService::Push(Request* pRequest)
+    {
+        mQueue.Push(pRequest);
+        mPending.fetch_add(1);
+        // a worker going to sleep counts itself before it checks mPending, so one of us sees the other
+        if (mSleeping.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mSleepMutex);
+            }
+            mWake.notify_one();
+        }
+    }
+
+    /// <summary>
+    /// Take up to MAX_BATCH requests off the queue
+    /// </summary>
+    /// <returns>how many requests were written to ppBatch</returns>
+    int RayCastService::PopBatch(Request** ppBatch)
+    {
+        std::lock_guard<std::mutex> lock(mPopMutex);
+        int count = 0;
+        while (count < MAX_BATCH)
+        {
+            MpscNode* pNode = mQueue.Pop();
+            if (pNode == nullptr)
+            {
+                break;
+            }
+            ppBatch[count++] = static_cast<Request*>(pNode);
+        }
+        mPending.fetch_sub(count);
+        return count;
+    }
+
+    void RayCastService::WorkerMain()
+    {
+        Request* batch[MAX_BATCH];
+        for (;;)
+        {
+            int count = PopBatch(batch);
+            if (count == 0)
+            {
+                if (mPending.load() > 0)
+                {
+                    // a producer is half way through a push, or another worker is popping
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(mSleepMutex);
+                mSleeping.fetch_add(1);
+                mWake.wait(lock, [this]() { return mPending.load() > 0 || mStop.load(); });
+                mSleeping.fetch_sub(1);
+                if (mPending.load() == 0 && mStop.load())
+                {
+                    return;
+                }
+                continue;
+            }
+
+            // cast the batch in packets, then hand out the results
+            for (int first = 0; first < count; first += RayPacket::MAX_RAYS)
+            {
+                int num = Math::Min(count - first, (int)RayPacket::MAX_RAYS);
+                LineSegment lines[RayPacket::MAX_RAYS];
+                CastInfo infos[RayPacket::MAX_RAYS];
+                for (int r = 0; r < num; ++r)
+                {
+                    lines[r] = batch[first + r]->mLine;
+                }
+                uint32_t hitMask = mWorld.RayCastPacket(lines, num, infos);
+                for (int r = 0; r < num; ++r)
+                {
+                    Request* pRequest = batch[first + r];
+                    RayCastResult result;
+                    result.mHit = (hitMask & (1u << r)) != 0;
+                    if (result.mHit)
+                    {
+                        result.mInfo = infos[r];
+                    }
+                    if (pRequest->mCallback)
+                    {
+                        pRequest->mCallback(result);
+                    }
+                    else
+                    {
+                        pRequest->mPromise.set_value(result);
+                    }
+                    delete pRequest;
+                }
+            }
+        }
+    }
+}
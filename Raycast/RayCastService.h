@@ -0,0 +1,93 @@
+#pragma once
+#include "Physics.h"
+#include "MpscQueue.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+namespace Physics
+{
+    /// <summary>
+    /// What an asynchronous ray cast hands back
+    /// </summary>
+    struct RayCastResult {
+        bool mHit = false;
+        CastInfo mInfo;
+    };
+
+    /// <summary>
+    /// Runs ray casts against a World on a pool of worker threads, so the threads asking don't have to wait
+    /// Any thread can submit at any time: requests go into a lock-free queue, and whichever worker is free takes
+    /// up to MAX_BATCH of them at once and casts them together in packets (see World::RayCastPacket).
+    /// Results come back through a std::future, a callback (called on the worker thread) or, in C++20, co_await.
+    /// The World must outlive the service and must not be changed while casts are in flight.
+    /// </summary>
+    class RayCastService {
+    public:
+        static const int MAX_BATCH = 64;
+
+        typedef std::function<void(const RayCastResult&)> Callback;
+
+        RayCastService(const World& world, int workerCount = 0);
+        ~RayCastService();
+
+        RayCastService(const RayCastService&) = delete;
+        RayCastService& operator=(const RayCastService&) = delete;
+
+        std::future<RayCastResult> Submit(const LineSegment& line);
+        void Submit(const LineSegment& line, Callback callback);
+        int GetWorkerCount() const { return (int)mWorkers.size(); }
+
+#if defined(__cpp_impl_coroutine)
+        /// <summary>
+        /// co_await service.Async(line) suspends the coroutine until the cast is done, it resumes on a worker thread
+        /// </summary>
+        struct Awaiter {
+            RayCastService* mService;
+            LineSegment mLine;
+            RayCastResult mResult;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                mService->Submit(mLine, [this, handle](const RayCastResult& result)
+                    {
+                        mResult = result;
+                        handle.resume();
+                    });
+            }
+            RayCastResult await_resume() const noexcept { return mResult; }
+        };
+
+        Awaiter Async(const LineSegment& line) { return Awaiter{ this, line, RayCastResult() }; }
+#endif
+
+    private:
+        struct Request : MpscNode {
+            LineSegment mLine;
+            std::promise<RayCastResult> mPromise;
+            Callback mCallback;     // if empty, the result goes to mPromise
+        };
+
+        void Push(Request* pRequest);
+        int PopBatch(Request** ppBatch);
+        void WorkerMain();
+
+        const World& mWorld;
+        MpscQueue mQueue;
+        std::atomic<int> mPending;      // pushed but not popped yet
+        std::mutex mPopMutex;           // only one worker pops at a time, the queue has a single consumer
+        std::mutex mSleepMutex;
+        std::condition_variable mWake;
+        std::atomic<int> mSleeping;
+        std::atomic<bool> mStop;
+        std::vector<std::thread> mWorkers;
+    };
+}
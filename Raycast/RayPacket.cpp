@@ -0,0 +1,107 @@
+#include "RayPacket.h"
+#if PHYSICS_PACKET_SSE
+#include <emmintrin.h>
+#endif
+
+namespace Physics {
+
+    /// <summary>
+    /// Set up a packet of segments from pFrom[r] to pTo[r]
+    /// Unused rays are padded with a copy of the first one so the 4 wide loads never read garbage
+    /// </summary>
+    /// <param name="count">how many rays, at most MAX_RAYS</param>
+    RayPacket::RayPacket(const Vector3* pFrom, const Vector3* pTo, int count)
+        : mCount(Math::Min(count, (int)MAX_RAYS))
+    {
+        for (int r = 0; r < MAX_RAYS; ++r)
+        {
+            int src = r < mCount ? r : 0;
+            Vector3 invDir = mCount > 0 ? Bvh::GetInvDir(pTo[src] - pFrom[src]) : Vector3::Zero;
+            Vector3 from = mCount > 0 ? pFrom[src] : Vector3::Zero;
+            mFromX[r] = from.x;
+            mFromY[r] = from.y;
+            mFromZ[r] = from.z;
+            mInvDirX[r] = invDir.x;
+            mInvDirY[r] = invDir.y;
+            mInvDirZ[r] = invDir.z;
+            // just past the end of the segment, as World::RayCast does
+            mMaxFraction[r] = std::nextafter(1.0f, 2.0f);
+        }
+    }
+
+    /// <summary>
+    /// Slab test of every active ray against the box, the same test as AABB::RayCast
+    /// </summary>
+    /// <param name="box">the box to test</param>
+    /// <param name="active">the rays to test</param>
+    /// <param name="enter">OPTIONAL MAX_RAYS entries, the fraction at which each ray enters the box</param>
+    /// <returns>the active rays that overlap the box in front of their maxFraction</returns>
+    uint32_t RayPacket::RayCast(const AABB& box, uint32_t active, float* enter) const
+    {
+        uint32_t mask = 0;
+#if PHYSICS_PACKET_SSE
+        const __m128 minX = _mm_set1_ps(box.mMin.x), minY = _mm_set1_ps(box.mMin.y), minZ = _mm_set1_ps(box.mMin.z);
+        const __m128 maxX = _mm_set1_ps(box.mMax.x), maxY = _mm_set1_ps(box.mMax.y), maxZ = _mm_set1_ps(box.mMax.z);
+        const __m128 zero = _mm_setzero_ps();
+        for (int r = 0; r < mCount; r += 4)
+        {
+            if (((active >> r) & 0xf) == 0)
+            {
+                continue;
+            }
+            __m128 fromX = _mm_load_ps(mFromX + r), invX = _mm_load_ps(mInvDirX + r);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(minX, fromX), invX);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(maxX, fromX), invX);
+            __m128 tMin = _mm_min_ps(t1, t2);
+            __m128 tMax = _mm_max_ps(t1, t2);
+            __m128 fromY = _mm_load_ps(mFromY + r), invY = _mm_load_ps(mInvDirY + r);
+            t1 = _mm_mul_ps(_mm_sub_ps(minY, fromY), invY);
+            t2 = _mm_mul_ps(_mm_sub_ps(maxY, fromY), invY);
+            tMin = _mm_max_ps(tMin, _mm_min_ps(t1, t2));
+            tMax = _mm_min_ps(tMax, _mm_max_ps(t1, t2));
+            __m128 fromZ = _mm_load_ps(mFromZ + r), invZ = _mm_load_ps(mInvDirZ + r);
+            t1 = _mm_mul_ps(_mm_sub_ps(minZ, fromZ), invZ);
+            t2 = _mm_mul_ps(_mm_sub_ps(maxZ, fromZ), invZ);
+            tMin = _mm_max_ps(tMin, _mm_min_ps(t1, t2));
+            tMax = _mm_min_ps(tMax, _mm_max_ps(t1, t2));
+            tMin = _mm_max_ps(tMin, zero);
+            tMax = _mm_min_ps(tMax, _mm_load_ps(mMaxFraction + r));
+            mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tMin, tMax)) << r;
+            if (enter)
+            {
+                _mm_storeu_ps(enter + r, tMin);
+            }
+        }
+#else
+        for (int r = 0; r < mCount; ++r)
+        {
+            if (active & (1u << r))
+            {
+                float t1 = (box.mMin.x - mFromX[r]) * mInvDirX[r];
+                float t2 = (box.mMax.x - mFromX[r]) * mInvDirX[r];
+                float tMin = Math::Min(t1, t2);
+                float tMax = Math::Max(t1, t2);
+                t1 = (box.mMin.y - mFromY[r]) * mInvDirY[r];
+                t2 = (box.mMax.y - mFromY[r]) * mInvDirY[r];
+                tMin = Math::Max(tMin, Math::Min(t1, t2));
+                tMax = Math::Min(tMax, Math::Max(t1, t2));
+                t1 = (box.mMin.z - mFromZ[r]) * mInvDirZ[r];
+                t2 = (box.mMax.z - mFromZ[r]) * mInvDirZ[r];
+                tMin = Math::Max(tMin, Math::Min(t1, t2));
+                tMax = Math::Min(tMax, Math::Max(t1, t2));
+                tMin = Math::Max(tMin, 0.0f);
+                tMax = Math::Min(tMax, mMaxFraction[r]);
+                if (tMin <= tMax)
+                {
+                    mask |= 1u << r;
+                }
+                if (enter)
+                {
+                    enter[r] = tMin;
+                }
+            }
+        }
+#endif
+        return mask & active;
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include "Bvh.h"
+#include <cstdint>
+
+// The packet box test uses SSE2, which every x64 compiler targets. Define PHYSICS_NO_SIMD to force the scalar loop.
+#if !defined(PHYSICS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PHYSICS_PACKET_SSE 1
+#else
+#define PHYSICS_PACKET_SSE 0
+#endif
+
+namespace Physics
+{
+    /// <summary>
+    /// A group of up to MAX_RAYS segments cast together, stored as a structure of arrays
+    /// Rays are addressed by bit masks (bit r is ray r), every box is tested against all the active rays at once,
+    /// 4 at a time. Each ray keeps its own maxFraction, which the caller lowers as it finds hits.
+    /// </summary>
+    class RayPacket {
+    public:
+        static const int MAX_RAYS = 16;
+
+        RayPacket(const Vector3* pFrom, const Vector3* pTo, int count);
+
+        int GetCount() const { return mCount; }
+        uint32_t GetAllMask() const { return (1u << mCount) - 1u; }
+        Vector3 GetInvDir(int ray) const { return Vector3(mInvDirX[ray], mInvDirY[ray], mInvDirZ[ray]); }
+        float& GetMaxFraction(int ray) { return mMaxFraction[ray]; }
+
+        uint32_t RayCast(const AABB& box, uint32_t active, float* enter = nullptr) const;
+
+        /// <summary>
+        /// Walk a Bvh front to back with the whole packet. A node is visited while any active ray overlaps it
+        /// in front of that ray's maxFraction, the order of the children follows the first ray overlapping both.
+        /// leafFunc(first, count, mask) is called for every leaf reached, mask holds the rays that overlap it;
+        /// it lowers GetMaxFraction() of the rays it finds hits for.
+        /// </summary>
+        template <typename LeafFunc>
+        void RayCast(const BvhNode* pNodes, uint32_t active, LeafFunc leafFunc)
+        {
+            uint32_t mask = RayCast(pNodes[0].mBounds, active);
+            if (mask == 0)
+            {
+                return;
+            }
+
+            struct StackEntry {
+                int mNode;
+                uint32_t mMask;
+            };
+            StackEntry stack[Bvh::MAX_DEPTH + 1];
+            int stackSize = 0;
+            int node = 0;
+            for (;;)
+            {
+                const BvhNode& cur = pNodes[node];
+                if (cur.mCount > 0)
+                {
+                    leafFunc(cur.mFirst, cur.mCount, mask);
+                }
+                else
+                {
+                    float enterA[MAX_RAYS], enterB[MAX_RAYS];
+                    uint32_t maskA = RayCast(pNodes[cur.mFirst].mBounds, mask, enterA);
+                    uint32_t maskB = RayCast(pNodes[cur.mFirst + 1].mBounds, mask, enterB);
+                    if (maskA != 0 && maskB != 0)
+                    {
+                        int lead = 0;
+                        uint32_t both = maskA & maskB;
+                        while (both != 0 && (both & (1u << lead)) == 0)
+                        {
+                            ++lead;
+                        }
+                        bool aFirst = both == 0 || enterA[lead] <= enterB[lead];
+                        stack[stackSize++] = aFirst ? StackEntry{ cur.mFirst + 1, maskB } : StackEntry{ cur.mFirst, maskA };
+                        node = aFirst ? cur.mFirst : cur.mFirst + 1;
+                        mask = aFirst ? maskA : maskB;
+                        continue;
+                    }
+                    if (maskA != 0 || maskB != 0)
+                    {
+                        node = maskA != 0 ? cur.mFirst : cur.mFirst + 1;
+                        mask = maskA != 0 ? maskA : maskB;
+                        continue;
+                    }
+                }
+
+                // pop the next subtree that some ray can still reach in front of its closest hit
+                node = -1;
+                while (stackSize > 0)
+                {
+                    const StackEntry& entry = stack[--stackSize];
+                    mask = RayCast(pNodes[entry.mNode].mBounds, entry.mMask);
+                    if (mask != 0)
+                    {
+                        node = entry.mNode;
+                        break;
+                    }
+                }
+                if (node < 0)
+                {
+                    break;
+                }
+            }
+        }
+
+    private:
+        alignas(16) float mFromX[MAX_RAYS];
+        alignas(16) float mFromY[MAX_RAYS];
+        alignas(16) float mFromZ[MAX_RAYS];
+        alignas(16) float mInvDirX[MAX_RAYS];
+        alignas(16) float mInvDirY[MAX_RAYS];
+        alignas(16) float mInvDirZ[MAX_RAYS];
+        alignas(16) float mMaxFraction[MAX_RAYS];
+        int mCount;
+    };
+}
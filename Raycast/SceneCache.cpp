@@ -0,0 +1,507 @@
+#include "SceneCache.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+
+namespace Physics {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // File layout
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    namespace {
+        const char MAGIC[8] = { 'R', 'A', 'Y', 'C', 'A', 'C', 'H', 'E' };
+        const uint32_t ENDIAN_TAG = 0x01020304u;   // reads back swapped on a machine of the other byte order
+        const size_t SECTION_ALIGN = CACHE_LINE_SIZE;
+
+        enum class CacheTris : uint32_t {
+            Precomputed,    // TriangleStreams::NUM_STREAMS streams of GetPaddedCount(triCount) floats
+            Indexed16,      // 3 uint16_t per triangle, into the vertex section
+            Indexed32,      // 3 uint32_t per triangle, into the vertex section
+        };
+
+        enum class CacheHierarchy : uint32_t {
+            None,
+            Bvh,            // BvhNode section
+            QuantizedBvh,   // QuantizedBvhNode section, plus the root reference and bounds
+        };
+
+        static_assert(std::is_trivially_copyable<AABB>::value && std::is_trivially_copyable<Matrix4>::value &&
+            std::is_trivially_copyable<BoxShape>::value && std::is_trivially_copyable<BvhNode>::value &&
+            std::is_trivially_copyable<QuantizedBvhNode>::value, "the cache stores these as they are in memory");
+    }
+
+    /// <summary>
+    /// Where an array is in the file: the offset of its first element, a multiple of SECTION_ALIGN, and its length
+    /// </summary>
+    struct SceneCache::Section {
+        uint64_t mOffset;
+        uint64_t mCount;
+    };
+
+    struct SceneCache::CacheSoup {
+        uint32_t mTriCount;
+        CacheTris mTris;
+        CacheHierarchy mHierarchy;
+        uint32_t mIsBox;
+        Section mTriData;           // the streams or the indices, in the leaf order of the hierarchy
+        Section mVerts;             // Vector3, for indexed triangles
+        Section mNodes;
+        uint32_t mQuantizedRoot;
+        AABB mBounds;
+        AABB mQuantizedBounds;
+        BoxShape mBox;
+    };
+
+    struct SceneCache::CacheObj {
+        int32_t mSoup;              // index in the soup section, -1 for an analytic shape or a removed object
+        ShapeType mType;
+        Vector3 mShapeSize;
+        Matrix4 mObj2World;
+        Matrix4 mWorld2Obj;
+        AABB mWorldBounds;
+    };
+
+    struct SceneCache::CacheHeader {
+        char mMagic[8];
+        uint32_t mVersion;
+        uint32_t mEndianTag;
+        uint32_t mLayoutSize[6];    // sizeof every stored struct, a file from a compiler that lays them out otherwise is rejected
+        uint64_t mFileSize;
+        Section mSoups;             // CacheSoup
+        Section mObjs;              // CacheObj, indexed by object id
+        Section mFreeIds;           // int32_t
+        Section mAccelObj;          // int32_t, the object id of every primitive of the World's hierarchy
+        Section mNodes;             // BvhNode or QuantizedBvhNode, by mMode
+        World::AccelMode mMode;
+        uint32_t mAccelBuilt;       // 0 if the World needed a Build() when it was saved
+        uint32_t mQuantizedRoot;
+        AABB mQuantizedBounds;
+
+        static void GetLayoutSizes(uint32_t* pSizes)
+        {
+            pSizes[0] = (uint32_t)sizeof(CacheHeader);
+            pSizes[1] = (uint32_t)sizeof(CacheSoup);
+            pSizes[2] = (uint32_t)sizeof(CacheObj);
+            pSizes[3] = (uint32_t)sizeof(BvhNode);
+            pSizes[4] = (uint32_t)sizeof(QuantizedBvhNode);
+            pSizes[5] = (uint32_t)sizeof(Vector3);
+        }
+    };
+
+    /// <summary>
+    /// Lays the sections of a file out one after the other in memory, each on a SECTION_ALIGN boundary
+    /// </summary>
+    class SceneCache::Writer {
+    public:
+        explicit Writer(size_t headerSize)
+            : mBytes(headerSize, 0)
+        {}
+
+        template <typename T>
+        Section Add(const T* pData, size_t count)
+        {
+            mBytes.resize((mBytes.size() + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN, 0);
+            Section section = { mBytes.size(), count };
+            if (count > 0)
+            {
+                const char* pBytes = reinterpret_cast<const char*>(pData);
+                mBytes.insert(mBytes.end(), pBytes, pBytes + count * sizeof(T));
+            }
+            return section;
+        }
+
+        std::vector<char>& GetBytes() { return mBytes; }
+
+    private:
+        std::vector<char> mBytes;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // SceneCache
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    SceneCache::SceneCache()
+    {}
+
+    SceneCache::~SceneCache()
+    {
+        Close();
+    }
+
+    /// <summary>
+    /// Write a World and every soup it uses to a cache file
+    /// A World that needs a Build() is saved as it is, and built when it is loaded
+    /// </summary>
+    /// <param name="path">the file to write, replaced if it exists</param>
+    /// <param name="world">the World to save</param>
+    /// <returns>false if the file could not be written</returns>
+    bool SceneCache::Save(const char* path, const World& world)
+    {
+        CacheHeader header = {};
+        Writer writer(sizeof(header));
+
+        // the soups, in the order the objects first use them
+        std::unordered_map<const TriangleSoup*, int> soupIndex;
+        std::vector<CacheSoup> soups;
+        std::vector<CacheObj> objs(world.mObj.size());
+        for (size_t id = 0; id < world.mObj.size(); ++id)
+        {
+            const SoupObj& obj = world.mObj[id];
+            CacheObj& cacheObj = objs[id];
+            cacheObj.mSoup = -1;
+            if (obj.mType == ShapeType::Soup)
+            {
+                auto found = soupIndex.find(obj.mSoup);
+                if (found == soupIndex.end())
+                {
+                    found = soupIndex.emplace(obj.mSoup, (int)soups.size()).first;
+                    soups.push_back(CacheSoup());
+                    SaveSoup(writer, *obj.mSoup, soups.back());
+                }
+                cacheObj.mSoup = found->second;
+            }
+            cacheObj.mType = obj.mType;
+            cacheObj.mShapeSize = obj.mShapeSize;
+            cacheObj.mObj2World = obj.mObj2World;
+            cacheObj.mWorld2Obj = obj.mWorld2Obj;
+            cacheObj.mWorldBounds = obj.mWorldBounds;
+        }
+        header.mSoups = writer.Add(soups.data(), soups.size());
+        header.mObjs = writer.Add(objs.data(), objs.size());
+
+        std::vector<int32_t> freeIds(world.mFreeIds.begin(), world.mFreeIds.end());
+        std::vector<int32_t> accelObj(world.mAccelObj.begin(), world.mAccelObj.end());
+        header.mFreeIds = writer.Add(freeIds.data(), freeIds.size());
+        header.mAccelObj = writer.Add(accelObj.data(), accelObj.size());
+        header.mMode = world.mMode;
+        header.mAccelBuilt = world.mAccelDirty ? 0 : 1;
+        if (world.mMode == World::AccelMode::Bvh || world.mMode == World::AccelMode::Lbvh)
+        {
+            header.mNodes = writer.Add(world.mBvh.GetNodes(), world.mBvh.GetNodeCount());
+        }
+        else if (world.mMode == World::AccelMode::QuantizedBvh)
+        {
+            header.mNodes = writer.Add(world.mQuantizedBvh.GetNodes(), world.mQuantizedBvh.GetNodeCount());
+            header.mQuantizedRoot = world.mQuantizedBvh.GetRoot();
+            header.mQuantizedBounds = world.mQuantizedBvh.GetRootBounds();
+            if (world.mQuantizedBvh.IsEmpty())
+            {   // too many objects to compress, the World walks its Bvh: built again on load
+                header.mAccelBuilt = 0;
+            }
+        }
+        else
+        {
+            header.mNodes = writer.Add((const BvhNode*)nullptr, 0);
+        }
+
+        std::memcpy(header.mMagic, MAGIC, sizeof(MAGIC));
+        header.mVersion = VERSION;
+        header.mEndianTag = ENDIAN_TAG;
+        CacheHeader::GetLayoutSizes(header.mLayoutSize);
+        std::vector<char>& bytes = writer.GetBytes();
+        header.mFileSize = bytes.size();
+        std::memcpy(bytes.data(), &header, sizeof(header));
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), (std::streamsize)bytes.size());
+        return file.good();
+    }
+
+    /// <summary>
+    /// Write the triangles and hierarchy of a soup, and describe them in cacheSoup
+    /// </summary>
+    void SceneCache::SaveSoup(Writer& writer, const TriangleSoup& soup, CacheSoup& cacheSoup)
+    {
+        cacheSoup = CacheSoup();
+        cacheSoup.mTriCount = (uint32_t)soup.mTriCount;
+        cacheSoup.mBounds = soup.mBounds;
+        cacheSoup.mIsBox = soup.mIsBox ? 1 : 0;
+        cacheSoup.mBox = soup.mBox;
+
+        if (soup.mFormat == TriangleSoup::Format::Precomputed)
+        {   // the streams may be spaced out differently in memory (see TriangleSoupData)
+            int stride = TriangleStreams::GetPaddedCount(soup.mTriCount);
+            std::vector<float> data(TriangleStreams::NUM_STREAMS * stride, 0.0f);
+            for (int s = 0; s < TriangleStreams::NUM_STREAMS; ++s)
+            {
+                std::copy(soup.mStreams.mStream[s], soup.mStreams.mStream[s] + soup.mTriCount, data.begin() + s * stride);
+            }
+            cacheSoup.mTris = CacheTris::Precomputed;
+            cacheSoup.mTriData = writer.Add(data.data(), data.size());
+            cacheSoup.mVerts = writer.Add((const Vector3*)nullptr, 0);
+        }
+        else
+        {   // Indexed and View soups alike, as indices in leaf order into the vertices they use
+            const IndexedTriangles& tris = soup.mIndexed;
+            std::vector<uint32_t> indices(soup.mTriCount * 3);
+            uint32_t vertCount = 0;
+            for (int i = 0; i < soup.mTriCount; ++i)
+            {
+                int tri = tris.mOrder ? tris.mOrder[i] : i;
+                for (int j = 0; j < 3; ++j)
+                {
+                    uint32_t index = tris.mIndices16 ? tris.mIndices16[tri * 3 + j] : tris.mIndices32[tri * 3 + j];
+                    indices[i * 3 + j] = index;
+                    vertCount = std::max(vertCount, index + 1);
+                }
+            }
+            if (vertCount <= 0x10000)
+            {
+                std::vector<uint16_t> indices16(indices.begin(), indices.end());
+                cacheSoup.mTris = CacheTris::Indexed16;
+                cacheSoup.mTriData = writer.Add(indices16.data(), indices16.size());
+            }
+            else
+            {
+                cacheSoup.mTris = CacheTris::Indexed32;
+                cacheSoup.mTriData = writer.Add(indices.data(), indices.size());
+            }
+            cacheSoup.mVerts = writer.Add(tris.mVerts, vertCount);
+        }
+
+        if (false == soup.mQuantizedBvh.IsEmpty())
+        {
+            cacheSoup.mHierarchy = CacheHierarchy::QuantizedBvh;
+            cacheSoup.mNodes = writer.Add(soup.mQuantizedBvh.GetNodes(), soup.mQuantizedBvh.GetNodeCount());
+            cacheSoup.mQuantizedRoot = soup.mQuantizedBvh.GetRoot();
+            cacheSoup.mQuantizedBounds = soup.mQuantizedBvh.GetRootBounds();
+        }
+        else if (false == soup.mBvh.IsEmpty())
+        {
+            cacheSoup.mHierarchy = CacheHierarchy::Bvh;
+            cacheSoup.mNodes = writer.Add(soup.mBvh.GetNodes(), soup.mBvh.GetNodeCount());
+        }
+        else
+        {
+            cacheSoup.mHierarchy = CacheHierarchy::None;
+            cacheSoup.mNodes = writer.Add((const BvhNode*)nullptr, 0);
+        }
+    }
+
+    /// <summary>
+    /// Map a cache file written by Save and set up its World, replacing whatever was loaded before
+    /// </summary>
+    /// <param name="path">the file to load</param>
+    /// <returns>false if the file cannot be mapped, or is not a cache of this version and layout</returns>
+    bool SceneCache::Load(const char* path)
+    {
+        Close();
+        if (false == mFile.Open(path) || mFile.GetSize() < sizeof(CacheHeader))
+        {
+            Close();
+            return false;
+        }
+        const CacheHeader& header = *reinterpret_cast<const CacheHeader*>(mFile.GetData());
+        uint32_t layoutSize[6];
+        CacheHeader::GetLayoutSizes(layoutSize);
+        if (std::memcmp(header.mMagic, MAGIC, sizeof(MAGIC)) != 0 || header.mVersion != VERSION || header.mEndianTag != ENDIAN_TAG ||
+            std::memcmp(header.mLayoutSize, layoutSize, sizeof(layoutSize)) != 0 || header.mFileSize != mFile.GetSize() ||
+            false == LoadWorld(header))
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Release the World, its soups and the mapping
+    /// </summary>
+    void SceneCache::Close()
+    {
+        mWorld.reset();
+        mSoups.clear();
+        mFile.Close();
+    }
+
+    /// <summary>
+    /// The elements of a section, in place in the mapping
+    /// </summary>
+    /// <returns>null if the section does not lie inside the file, or is not aligned for T</returns>
+    template <typename T>
+    const T* SceneCache::GetSection(const Section& section) const
+    {
+        uint64_t size = mFile.GetSize();
+        if (section.mOffset > size || section.mCount > (size - section.mOffset) / sizeof(T) || section.mOffset % alignof(T) != 0)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(mFile.GetData() + section.mOffset);
+    }
+
+    /// <summary>
+    /// A soup that casts straight against the triangles and hierarchy of a CacheSoup
+    /// </summary>
+    /// <returns>null if the sections of the soup do not fit its header or the file</returns>
+    TriangleSoup* SceneCache::LoadSoup(const CacheSoup& cacheSoup) const
+    {
+        int triCount = (int)cacheSoup.mTriCount;
+        if (triCount < 0)
+        {
+            return nullptr;
+        }
+        std::unique_ptr<TriangleSoup> soup(new TriangleSoup(triCount, cacheSoup.mBounds));
+        switch (cacheSoup.mTris)
+        {
+        case CacheTris::Precomputed:
+        {
+            int stride = TriangleStreams::GetPaddedCount(triCount);
+            const float* pTriData = GetSection<float>(cacheSoup.mTriData);
+            if (pTriData == nullptr || cacheSoup.mTriData.mCount != (uint64_t)TriangleStreams::NUM_STREAMS * stride)
+            {
+                return nullptr;
+            }
+            for (int s = 0; s < TriangleStreams::NUM_STREAMS; ++s)
+            {
+                soup->mStreams.mStream[s] = pTriData + s * stride;
+            }
+            break;
+        }
+        case CacheTris::Indexed16:
+        case CacheTris::Indexed32:
+        {
+            IndexedTriangles& tris = soup->mIndexed;
+            tris.mVerts = GetSection<Vector3>(cacheSoup.mVerts);
+            if (cacheSoup.mTris == CacheTris::Indexed16)
+            {
+                tris.mIndices16 = GetSection<uint16_t>(cacheSoup.mTriData);
+            }
+            else
+            {
+                tris.mIndices32 = GetSection<uint32_t>(cacheSoup.mTriData);
+            }
+            if (tris.mVerts == nullptr || (tris.mIndices16 == nullptr && tris.mIndices32 == nullptr) ||
+                cacheSoup.mTriData.mCount != (uint64_t)triCount * 3)
+            {
+                return nullptr;
+            }
+            soup->mFormat = TriangleSoup::Format::Indexed;
+            break;
+        }
+        default:
+            return nullptr;
+        }
+
+        switch (cacheSoup.mHierarchy)
+        {
+        case CacheHierarchy::Bvh:
+        {
+            const BvhNode* pNodes = GetSection<BvhNode>(cacheSoup.mNodes);
+            if (pNodes == nullptr)
+            {
+                return nullptr;
+            }
+            soup->mBvh.SetExternalNodes(pNodes, (int)cacheSoup.mNodes.mCount);
+            break;
+        }
+        case CacheHierarchy::QuantizedBvh:
+        {
+            const QuantizedBvhNode* pNodes = GetSection<QuantizedBvhNode>(cacheSoup.mNodes);
+            if (pNodes == nullptr)
+            {
+                return nullptr;
+            }
+            soup->mQuantizedBvh.SetExternalNodes(pNodes, (int)cacheSoup.mNodes.mCount, cacheSoup.mQuantizedRoot, cacheSoup.mQuantizedBounds);
+            break;
+        }
+        case CacheHierarchy::None:
+            break;
+        default:
+            return nullptr;
+        }
+        soup->mIsBox = cacheSoup.mIsBox != 0;
+        soup->mBox = cacheSoup.mBox;
+        return soup.release();
+    }
+
+    /// <summary>
+    /// Set up the soups and the World of a mapped file whose header checked out
+    /// </summary>
+    bool SceneCache::LoadWorld(const CacheHeader& header)
+    {
+        const CacheSoup* pSoups = GetSection<CacheSoup>(header.mSoups);
+        const CacheObj* pObjs = GetSection<CacheObj>(header.mObjs);
+        const int32_t* pFreeIds = GetSection<int32_t>(header.mFreeIds);
+        const int32_t* pAccelObj = GetSection<int32_t>(header.mAccelObj);
+        if (pSoups == nullptr || pObjs == nullptr || pFreeIds == nullptr || pAccelObj == nullptr ||
+            (uint32_t)header.mMode > (uint32_t)World::AccelMode::Lbvh)
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < header.mSoups.mCount; ++i)
+        {
+            TriangleSoup* pSoup = LoadSoup(pSoups[i]);
+            if (pSoup == nullptr)
+            {
+                return false;
+            }
+            mSoups.emplace_back(pSoup);
+        }
+
+        // the objects, as they were: their inverse transforms and bounds are stored, so nothing is worked out again
+        int objCount = (int)header.mObjs.mCount;
+        mWorld.reset(new World(header.mMode));
+        World& world = *mWorld;
+        world.mObj.resize(objCount);
+        world.mProxy.assign(objCount, DynamicTree::NULL_NODE);
+        world.mHot.Resize(objCount);
+        for (int id = 0; id < objCount; ++id)
+        {
+            const CacheObj& cacheObj = pObjs[id];
+            bool isSoup = cacheObj.mType == ShapeType::Soup;
+            if ((uint32_t)cacheObj.mType > (uint32_t)ShapeType::Capsule ||
+                (isSoup ? (cacheObj.mSoup < 0 || cacheObj.mSoup >= (int)mSoups.size()) : cacheObj.mSoup != -1))
+            {
+                return false;
+            }
+            SoupObj& obj = world.mObj[id];
+            obj.mSoup = isSoup ? mSoups[cacheObj.mSoup].get() : nullptr;
+            obj.mType = cacheObj.mType;
+            obj.mShapeSize = cacheObj.mShapeSize;
+            obj.mObj2World = cacheObj.mObj2World;
+            obj.mWorld2Obj = cacheObj.mWorld2Obj;
+            obj.mWorldBounds = cacheObj.mWorldBounds;
+            if (false == obj.IsEmpty())
+            {
+                world.mHot.Set(id, obj.mWorldBounds, obj.mWorld2Obj);
+            }
+        }
+        auto isValidId = [objCount](int32_t id) { return id >= 0 && id < objCount; };
+        if (false == std::all_of(pFreeIds, pFreeIds + header.mFreeIds.mCount, isValidId) ||
+            false == std::all_of(pAccelObj, pAccelObj + header.mAccelObj.mCount, isValidId))
+        {
+            return false;
+        }
+        world.mFreeIds.assign(pFreeIds, pFreeIds + header.mFreeIds.mCount);
+        world.mAccelObj.assign(pAccelObj, pAccelObj + header.mAccelObj.mCount);
+
+        // the hierarchy of the World in place, the other structures are quick to build again
+        bool built = header.mAccelBuilt != 0;
+        if (built && (header.mMode == World::AccelMode::Bvh || header.mMode == World::AccelMode::Lbvh))
+        {
+            const BvhNode* pNodes = GetSection<BvhNode>(header.mNodes);
+            if (pNodes == nullptr)
+            {
+                return false;
+            }
+            world.mBvh.SetExternalNodes(pNodes, (int)header.mNodes.mCount);
+            world.mAccelHot.Gather(world.mHot, world.mAccelObj);
+        }
+        else if (built && header.mMode == World::AccelMode::QuantizedBvh)
+        {
+            const QuantizedBvhNode* pNodes = GetSection<QuantizedBvhNode>(header.mNodes);
+            if (pNodes == nullptr)
+            {
+                return false;
+            }
+            world.mQuantizedBvh.SetExternalNodes(pNodes, (int)header.mNodes.mCount, header.mQuantizedRoot, header.mQuantizedBounds);
+            world.mAccelHot.Gather(world.mHot, world.mAccelObj);
+        }
+        else if (false == built || header.mMode != World::AccelMode::BruteForce)
+        {
+            world.Build();
+        }
+        return true;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "MappedFile.h"
+#include "Physics.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Physics
+{
+    /// <summary>
+    /// A binary snapshot of a World, its soups and their hierarchies, loaded by mapping the file
+    /// Save writes everything a built World casts against: the triangles of every soup it uses (in their leaf order,
+    /// Indexed and View soups as 16 or 32 bit indexed triangles), the soups' Bvh or QuantizedBvh nodes, every object's
+    /// shape, transforms and bounds, and the nodes of the World's Bvh or QuantizedBvh.
+    /// Load maps the file and points soups and hierarchies straight at it: sections are addressed by file offsets and
+    /// laid out as they are in memory, so nothing is parsed or fixed up. Only the per object arrays of the World are
+    /// filled in, from the stored transforms and bounds (no matrix is inverted), and a Grid or Dynamic world rebuilds.
+    /// A file is checked for its version, byte order and struct sizes, and that every section lies inside it, but not
+    /// element by element: only load files written by Save.
+    /// The loaded World and soups point into the mapping, so they are only valid until Close() or the next Load().
+    /// </summary>
+    class SceneCache {
+    public:
+        static const uint32_t VERSION = 1;
+
+        SceneCache();
+        ~SceneCache();
+
+        SceneCache(const SceneCache&) = delete;
+        SceneCache& operator=(const SceneCache&) = delete;
+
+        static bool Save(const char* path, const World& world);
+        bool Load(const char* path);
+        void Close();
+
+        bool IsLoaded() const { return mWorld != nullptr; }
+        World& GetWorld() { return *mWorld; }
+        const World& GetWorld() const { return *mWorld; }
+        int GetSoupCount() const { return (int)mSoups.size(); }
+        size_t GetFileSize() const { return mFile.GetSize(); }
+
+    private:
+        struct Section;
+        struct CacheHeader;
+        struct CacheSoup;
+        struct CacheObj;
+        class Writer;
+
+        static void SaveSoup(Writer& writer, const TriangleSoup& soup, CacheSoup& cacheSoup);
+        template <typename T>
+        const T* GetSection(const Section& section) const;
+        TriangleSoup* LoadSoup(const CacheSoup& cacheSoup) const;
+        bool LoadWorld(const CacheHeader& header);
+
+        MappedFile mFile;
+        std::vector<std::unique_ptr<TriangleSoup>> mSoups;
+        std::unique_ptr<World> mWorld;
+    };
+}
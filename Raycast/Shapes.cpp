@@ -0,0 +1,210 @@
+#include "Shapes.h"
+
+namespace Physics {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // BoxShape
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    namespace {
+        /// <summary>
+        /// scale * p + w, rounded the way the triangle kernel rounds the dot product of a row with one non-zero
+        /// component: the product on its own, then w added. Written plainly a compiler may fuse it into one FMA,
+        /// which rounds once and can be a bit off the kernel. A product plus zero fuses to the same rounded product,
+        /// and a sum that isn't a product can't be fused with w, so this gives the same bits with or without FMA.
+        /// </summary>
+        inline float PlaneDistance(float scale, float p, float w)
+        {
+            float product = scale * p + 0.0f;
+            return product + w;
+        }
+    }
+
+    BoxShape::BoxShape()
+    {
+        for (int face = 0; face < NUM_FACES; ++face)
+        {
+            mScale[face] = 0.0f;
+            mOffset[face] = 0.0f;
+        }
+    }
+
+    /// <summary>
+    /// The box covering bounds, with unit rows (so fractions are plain slab distances)
+    /// </summary>
+    BoxShape::BoxShape(const AABB& bounds)
+        : mBounds(bounds)
+    {
+        const float* pMin = bounds.mMin.GetAsFloatPtr();
+        const float* pMax = bounds.mMax.GetAsFloatPtr();
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            Vector3 normal = Vector3::Zero;
+            (&normal.x)[axis] = 1.0f;
+            mScale[2 * axis] = -1.0f;
+            mOffset[2 * axis] = pMin[axis];
+            mNormal[2 * axis] = -1.0f * normal;
+            mScale[2 * axis + 1] = 1.0f;
+            mOffset[2 * axis + 1] = -pMax[axis];
+            mNormal[2 * axis + 1] = normal;
+        }
+    }
+
+    /// <summary>
+    /// Set one face from the row of a triangle on it
+    /// </summary>
+    /// <param name="face">-x, +x, -y, +y, -z, +z</param>
+    /// <param name="row">the plane's normal, scaled, with a single non-zero component</param>
+    /// <param name="w">the plane's offset, in the same scale</param>
+    /// <param name="normal">the unit normal reported for hits on this face</param>
+    void BoxShape::SetFace(int face, const Vector3& row, float w, const Vector3& normal)
+    {
+        int axis = face / 2;
+        mScale[face] = row.GetAsFloatPtr()[axis];
+        mOffset[face] = w;
+        mNormal[face] = normal;
+        Vector3& corner = (face % 2 == 0) ? mBounds.mMin : mBounds.mMax;
+        (&corner.x)[axis] = -w / mScale[face];
+    }
+
+    /// <summary>
+    /// Slab test of the segment from + t * dir, t in [0, maxFraction) against the outside of the box
+    /// Each plane distance is worked out exactly as the triangle kernel works it out for a triangle on that face
+    /// </summary>
+    /// <param name="fraction">the fraction of the hit, if there is one</param>
+    /// <param name="normal">the outward normal of the face hit, if there is one</param>
+    /// <returns>true if the segment enters the box</returns>
+    bool BoxShape::RayCast(const Vector3& from, const Vector3& dir, float maxFraction, float* fraction, Vector3* normal) const
+    {
+        const float* pFrom = from.GetAsFloatPtr();
+        const float* pDir = dir.GetAsFloatPtr();
+        float enter = -Math::Infinity;
+        float exit = Math::Infinity;
+        int enterFace = -1;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int lo = 2 * axis;
+            int hi = 2 * axis + 1;
+            if (pDir[axis] == 0.0f)
+            {   // parallel to the slab, it has to start between the two faces
+                if (PlaneDistance(mScale[lo], pFrom[axis], mOffset[lo]) > 0.0f || PlaneDistance(mScale[hi], pFrom[axis], mOffset[hi]) > 0.0f)
+                {
+                    return false;
+                }
+                continue;
+            }
+            // the face the segment moves against is the one it can enter through
+            int front = pDir[axis] < 0.0f ? hi : lo;
+            int back = front ^ 1;
+            float t = -PlaneDistance(mScale[front], pFrom[axis], mOffset[front]) / (mScale[front] * pDir[axis]);
+            float tBack = -PlaneDistance(mScale[back], pFrom[axis], mOffset[back]) / (mScale[back] * pDir[axis]);
+            if (t > enter)
+            {
+                enter = t;
+                enterFace = front;
+            }
+            exit = Math::Min(exit, tBack);
+        }
+        if (enterFace < 0 || false == (enter >= 0.0f && enter < maxFraction && enter <= exit))
+        {
+            return false;
+        }
+        *fraction = enter;
+        *normal = mNormal[enterFace];
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Sphere and capsule
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    namespace {
+        /// <summary>
+        /// Where the line from + t * dir enters the sphere, the smaller root of |from + t * dir - center| = radius
+        /// </summary>
+        /// <returns>false if the line misses the sphere</returns>
+        bool EnterSphere(const Vector3& center, float radius, const Vector3& from, const Vector3& dir, float* t)
+        {
+            Vector3 o = from - center;
+            float a = Vector3::Dot(dir, dir);
+            float b = Vector3::Dot(o, dir);
+            float c = Vector3::Dot(o, o) - radius * radius;
+            float disc = b * b - a * c;
+            if (disc < 0.0f || a == 0.0f)
+            {
+                return false;
+            }
+            *t = (-b - Math::Sqrt(disc)) / a;
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// Cast the segment from + t * dir, t in [0, maxFraction) against the outside of a sphere centered on the origin
+    /// </summary>
+    /// <returns>true if the segment enters the sphere</returns>
+    bool RayCastSphere(float radius, const Vector3& from, const Vector3& dir, float maxFraction, float* fraction, Vector3* normal)
+    {
+        float t;
+        if (false == EnterSphere(Vector3::Zero, radius, from, dir, &t) || false == (t >= 0.0f && t < maxFraction))
+        {
+            return false;
+        }
+        *fraction = t;
+        *normal = Vector3::Normalize(from + t * dir);
+        return true;
+    }
+
+    /// <summary>
+    /// Cast the segment from + t * dir, t in [0, maxFraction) against the outside of a capsule around the y axis
+    /// The capsule is every point within radius of the segment (0, -halfHeight, 0) - (0, halfHeight, 0)
+    /// </summary>
+    /// <returns>true if the segment enters the capsule</returns>
+    bool RayCastCapsule(float halfHeight, float radius, const Vector3& from, const Vector3& dir, float maxFraction, float* fraction, Vector3* normal)
+    {
+        float best = maxFraction;
+        bool hit = false;
+
+        // the side of the cylinder, between the two ends
+        float a = dir.x * dir.x + dir.z * dir.z;
+        if (a > 0.0f)
+        {
+            float b = from.x * dir.x + from.z * dir.z;
+            float c = from.x * from.x + from.z * from.z - radius * radius;
+            float disc = b * b - a * c;
+            if (disc >= 0.0f)
+            {
+                float t = (-b - Math::Sqrt(disc)) / a;
+                float y = from.y + t * dir.y;
+                if (t >= 0.0f && t < best && y >= -halfHeight && y <= halfHeight)
+                {
+                    Vector3 p = from + t * dir;
+                    best = t;
+                    *normal = Vector3::Normalize(Vector3(p.x, 0.0f, p.z));
+                    hit = true;
+                }
+            }
+        }
+
+        // the half spheres, only the part past each end counts
+        for (float side : { -1.0f, 1.0f })
+        {
+            Vector3 center(0.0f, side * halfHeight, 0.0f);
+            float t;
+            if (EnterSphere(center, radius, from, dir, &t) && t >= 0.0f && t < best)
+            {
+                Vector3 p = from + t * dir;
+                if (side * (p.y - center.y) >= 0.0f)
+                {
+                    best = t;
+                    *normal = Vector3::Normalize(p - center);
+                    hit = true;
+                }
+            }
+        }
+
+        if (hit)
+        {
+            *fraction = best;
+        }
+        return hit;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Bvh.h"
+
+namespace Physics
+{
+    /// <summary>
+    /// The analytic shapes an object can be instead of a TriangleSoup (see SoupObj)
+    /// </summary>
+    enum class ShapeType {
+        None,       // removed object
+        Soup,       // TriangleSoup
+        Box,        // box centered on the origin
+        Sphere,     // sphere centered on the origin
+        Capsule,    // cylinder along the y axis with half spheres on both ends
+    };
+
+    /// <summary>
+    /// An axis aligned box stored as its 6 face planes (-x, +x, -y, +y, -z, +z), each as the row the triangle kernel
+    /// would use for a triangle of that face (see TriangleStreams). A box detected in a TriangleSoup copies the rows of
+    /// its triangles, so the slab test below finds the same fractions and normals as the triangles did, to the bit, whether
+    /// or not the compiler fuses multiplies and adds.
+    /// Like triangles, only the outside of the faces counts: a segment starting inside the box does not hit it.
+    /// </summary>
+    class BoxShape {
+    public:
+        static const int NUM_FACES = 6;
+
+        BoxShape();
+        explicit BoxShape(const AABB& bounds);
+
+        void SetFace(int face, const Vector3& row, float w, const Vector3& normal);
+        const AABB& GetBounds() const { return mBounds; }
+
+        bool RayCast(const Vector3& from, const Vector3& dir, float maxFraction, float* fraction, Vector3* normal) const;
+
+    private:
+        AABB mBounds;
+        float mScale[NUM_FACES];        // the only non-zero component of each face's row
+        float mOffset[NUM_FACES];       // the 4th component of each face's row
+        Vector3 mNormal[NUM_FACES];     // the unit outward normal of each face
+    };
+
+    bool RayCastSphere(float radius, const Vector3& from, const Vector3& dir, float maxFraction, float* fraction, Vector3* normal);
+    bool RayCastCapsule(float halfHeight, float radius, const Vector3& from, const Vector3& dir, float maxFraction, float* fraction, Vector3* normal);
+}
@@ -2,7 +2,7 @@
 
 namespace Physics {
 
-    static Vector3 s_cubeVert[] = {
+    static constexpr Vector3 s_cubeVert[] = {
         Vector3(-10.0f, -10.0f, -10.0f),
         Vector3(10.0f, -10.0f, -10.0f),
         Vector3(10.0f, 10.0f, -10.0f),
@@ -12,7 +12,7 @@ namespace Physics {
         Vector3(10.0f, 10.0f, 10.0f),
         Vector3(-10.0f, 10.0f, 10.0f),
     };
-    static int s_cubeIndex[] = {
+    static constexpr int s_cubeIndex[] = {
         // bottom
         0, 2, 1,
         0, 3, 2,
@@ -38,5 +38,10 @@ namespace Physics {
         1, 6, 5
     };
 
-    TriangleSoup g_cubeSoup(MAKE_SOUP(s_cubeVert, s_cubeIndex));
+    // the triangles are worked out by the compiler, the soup only points at them
+    static constexpr auto s_cubeData = MAKE_SOUP_DATA(s_cubeVert, s_cubeIndex);
+    static_assert(s_cubeData.mBounds.mMin.x == -10.0f && s_cubeData.mBounds.mMax.z == 10.0f, "the cube is 20 across");
+    static_assert(s_cubeData.mTriData[TriangleStreams::ROW_N_Z * s_cubeData.STRIDE] < 0.0f, "the bottom faces down");
+
+    TriangleSoup g_cubeSoup(s_cubeData);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "Physics.h"
 
 #define MAKE_SOUP(vert, index) ARRAY_SIZE(vert), vert, ARRAY_SIZE(index)/3, index
+#define MAKE_SOUP_DATA(vert, index) Physics::TriangleSoupData<ARRAY_SIZE(index)/3>(MAKE_SOUP(vert, index))
 
 namespace Physics {
     extern Physics::TriangleSoup g_cubeSoup;
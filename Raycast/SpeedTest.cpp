@@ -1,8 +1,16 @@
 #include "SpeedTest.h"
+#include "MeshImporter.h"
+#include "Parallel.h"
 #include "Physics.h"
 #include "Random.h"
+#include "SceneCache.h"
 #include "SoupCube.h"
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
 
 const int NUM_OBJ = 10000;
 const int NUM_RAY = 5000;
@@ -10,11 +18,11 @@ const float WORLD_RADIUS = 10000.0f;
 const float MIN_SCALE = 0.1f;
 const float MAX_SCALE = 100.0f;
 
-Matrix4 RandomMatrix()
+Matrix4 RandomMatrix(float minScale = MIN_SCALE, float maxScale = MAX_SCALE)
 {
     Vector3 pos = WORLD_RADIUS * Random::GetVector(Vector3(-1.0f, -1.0f, -1.0f), Vector3(1.0f, 1.0f, 1.0f));
     Vector3 euler = Random::GetVector(Vector3(-Math::Pi, -Math::Pi, -Math::Pi), Vector3(Math::Pi, Math::Pi, Math::Pi));
-    Vector3 scale = WORLD_RADIUS * Random::GetVector(Vector3(MIN_SCALE, MIN_SCALE, MIN_SCALE), Vector3(MAX_SCALE, MAX_SCALE, MAX_SCALE));
+    Vector3 scale = WORLD_RADIUS * Random::GetVector(Vector3(minScale, minScale, minScale), Vector3(maxScale, maxScale, maxScale));
     Matrix4 mat = Matrix4::CreateScale(scale)
         * Matrix4::CreateRotationX(euler.x)
         * Matrix4::CreateRotationY(euler.y)
@@ -31,32 +39,353 @@ Physics::LineSegment RandomLine()
     return line;
 }
 
+float TimeRayCasts(const Physics::World& world, const Physics::LineSegment* pLine)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    Physics::CastInfo info;
+    for (int i = 0; i < NUM_RAY; ++i)
+    {
+        world.RayCast(pLine[i], &info);
+    }
+
+	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+	return (float)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+}
+
+float TimeRayCastPackets(const Physics::World& world, const Physics::LineSegment* pLine)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    Physics::CastInfo info[Physics::RayPacket::MAX_RAYS];
+    for (int i = 0; i < NUM_RAY; i += Physics::RayPacket::MAX_RAYS)
+    {
+        world.RayCastPacket(pLine + i, std::min(NUM_RAY - i, (int)Physics::RayPacket::MAX_RAYS), info);
+    }
+
+	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+	return (float)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+}
+
 float SpeedTest()
 {
     Random::Init();
     Random::Seed(0x1337);
-    Physics::World world;
+    // loaded in one go: the world's arrays grow once and the first Build() is the only one
+    std::vector<Physics::SoupObj> objs;
+    objs.reserve(NUM_OBJ);
     for (int i = 0; i < NUM_OBJ; ++i)
     {
         Matrix4 randMat = RandomMatrix();
-        world.AddObj(Physics::SoupObj(&Physics::g_cubeSoup, randMat));
+        objs.push_back(Physics::SoupObj(&Physics::g_cubeSoup, randMat));
     }
+    Physics::World world;
+    world.AddObjs(objs.data(), NUM_OBJ);
     Physics::LineSegment* pLine = new Physics::LineSegment[NUM_RAY];
     for (int i = 0; i < NUM_RAY; ++i)
     {
         pLine[i] = RandomLine();
     }
 
-	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    // compare the acceleration structures, the default one (Bvh) goes last and is the one reported
+    const struct {
+        Physics::World::AccelMode mMode;
+        const char* mName;
+    } modes[] = {
+        { Physics::World::AccelMode::BruteForce, "BruteForce" },
+        { Physics::World::AccelMode::Grid, "Grid" },
+        { Physics::World::AccelMode::Dynamic, "Dynamic" },
+        { Physics::World::AccelMode::QuantizedBvh, "QuantizedBvh" },
+        { Physics::World::AccelMode::Lbvh, "Lbvh" },
+        { Physics::World::AccelMode::Bvh, "Bvh" },
+    };
+    float time = 0.0f;
+    size_t quantizedSize = 0;
+    for (const auto& mode : modes)
+    {
+        world.SetAccelMode(mode.mMode);
+        world.Build();
+        time = TimeRayCasts(world, pLine);
+        std::cout << "  " << mode.mName << " = " << time << " ms";
+        size_t size = world.GetAccelMemorySize();
+        if (mode.mMode == Physics::World::AccelMode::QuantizedBvh)
+        {
+            quantizedSize = size;
+            std::cout << " (" << size / 1024 << " KB of nodes)";
+        }
+        else if (mode.mMode == Physics::World::AccelMode::Bvh)
+        {
+            std::cout << " (" << size / 1024 << " KB of nodes, QuantizedBvh saves " << (size - quantizedSize) / 1024 << " KB)";
+        }
+        std::cout << std::endl;
+    }
 
-    Physics::CastInfo info;
-    for (int i = 0; i < NUM_RAY; ++i)
+    // every object above spans the world, so every ray enters every leaf and the Bvh can only add its walk to the
+    // BruteForce loop. The same number of small objects over the same volume is the scene a hierarchy is for
     {
-        world.RayCast(pLine[i], &info);
+        std::vector<Physics::SoupObj> smallObjs;
+        smallObjs.reserve(NUM_OBJ);
+        for (int i = 0; i < NUM_OBJ; ++i)
+        {
+            smallObjs.push_back(Physics::SoupObj(&Physics::g_cubeSoup, RandomMatrix(0.001f, 0.01f)));
+        }
+        Physics::World smallWorld(Physics::World::AccelMode::BruteForce);
+        smallWorld.AddObjs(smallObjs.data(), NUM_OBJ);
+        smallWorld.Build();
+        float bruteTime = TimeRayCasts(smallWorld, pLine);
+        smallWorld.SetAccelMode(Physics::World::AccelMode::Bvh);
+        smallWorld.Build();
+        float bvhTime = TimeRayCasts(smallWorld, pLine);
+        std::cout << "  Small objects: BruteForce = " << bruteTime << " ms, Bvh = " << bvhTime << " ms" << std::endl;
     }
 
-	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
-	float time = (float)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    // the same rays as line of sight checks
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < NUM_RAY; ++i)
+        {
+            world.IsOccluded(pLine[i]);
+        }
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+        std::cout << "  Bvh occlusion = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+    }
+
+    // the same rays in packets (random rays, so this is the worst case for them)
+    std::cout << "  Bvh packets = " << TimeRayCastPackets(world, pLine) << " ms" << std::endl;
+
+    // the same rays as one batch across every core
+    {
+        Physics::CastInfo* pInfo = new Physics::CastInfo[NUM_RAY];
+        bool* pHit = new bool[NUM_RAY];
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        world.RayCastBatch(pLine, NUM_RAY, pInfo, pHit);
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+        std::cout << "  Bvh batch (" << Physics::GetDefaultThreadCount() << " threads) = "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+        delete[] pHit;
+        delete[] pInfo;
+    }
+
+    // cost of moving every object a little, as a game would every frame
+    world.SetAccelMode(Physics::World::AccelMode::Dynamic);
+    world.Build();
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < NUM_OBJ; ++i)
+    {
+        Matrix4 mat = world.GetObj(i).GetObj2World();
+        mat.mat[3][0] += 1.0f;
+        world.UpdateTransform(i, mat);
+    }
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    std::cout << "  Dynamic update = " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+    world.SetAccelMode(Physics::World::AccelMode::Bvh);
+
+    // loading the objects into a Dynamic world one at a time (each one goes into the tree), against all at once
+    {
+        std::chrono::high_resolution_clock::time_point startSingle = std::chrono::high_resolution_clock::now();
+        Physics::World single(Physics::World::AccelMode::Dynamic);
+        single.Build();
+        for (const Physics::SoupObj& obj : objs)
+        {
+            single.AddObj(obj);
+        }
+        std::chrono::high_resolution_clock::time_point startBulk = std::chrono::high_resolution_clock::now();
+        Physics::World bulk(Physics::World::AccelMode::Dynamic);
+        bulk.AddObjs(objs.data(), NUM_OBJ);
+        bulk.Build();
+        std::chrono::high_resolution_clock::time_point endBulk = std::chrono::high_resolution_clock::now();
+        std::cout << "  Load of " << NUM_OBJ << " objects: AddObj = " << std::chrono::duration_cast<std::chrono::microseconds>(startBulk - startSingle).count()
+            << " us, AddObjs and Build = " << std::chrono::duration_cast<std::chrono::microseconds>(endBulk - startBulk).count() << " us" << std::endl;
+    }
+
+    // what a transform update spends inverting the matrix (both are out of line, so neither loop is optimized away)
+    {
+        std::chrono::high_resolution_clock::time_point startInvert = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < NUM_OBJ; ++i)
+        {
+            Matrix4 mat = world.GetObj(i).GetObj2World();
+            mat.Invert();
+        }
+        std::chrono::high_resolution_clock::time_point startAffine = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < NUM_OBJ; ++i)
+        {
+            Matrix4 mat = world.GetObj(i).GetObj2World();
+            mat.InvertAffine();
+        }
+        std::chrono::high_resolution_clock::time_point endAffine = std::chrono::high_resolution_clock::now();
+        std::cout << "  Invert = " << std::chrono::duration_cast<std::chrono::microseconds>(startAffine - startInvert).count()
+            << " us, InvertAffine = " << std::chrono::duration_cast<std::chrono::microseconds>(endAffine - startAffine).count() << " us" << std::endl;
+    }
+
+    // a dense mesh in each TriangleSoup format: what Indexed and View save in memory and cost in cast time
+    {
+        const int SIDE = 256;
+        std::vector<Vector3> verts;
+        std::vector<int> indices;
+        for (int y = 0; y < SIDE; ++y)
+        {
+            for (int x = 0; x < SIDE; ++x)
+            {
+                verts.push_back(Vector3((float)x, (float)y, 5.0f * Math::Sin(0.3f * x) * Math::Cos(0.2f * y)));
+            }
+        }
+        for (int y = 0; y + 1 < SIDE; ++y)
+        {
+            for (int x = 0; x + 1 < SIDE; ++x)
+            {
+                int a = y * SIDE + x;
+                int quad[6] = { a, a + 1, a + SIDE + 1, a, a + SIDE + 1, a + SIDE };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+        std::vector<Physics::LineSegment> lines;
+        for (int i = 0; i < NUM_RAY; ++i)
+        {
+            lines.push_back(Physics::LineSegment(Random::GetVector(Vector3(0.0f, 0.0f, 20.0f), Vector3(SIDE - 1.0f, SIDE - 1.0f, 20.0f)),
+                Random::GetVector(Vector3(0.0f, 0.0f, -20.0f), Vector3(SIDE - 1.0f, SIDE - 1.0f, -20.0f))));
+        }
+        const struct {
+            Physics::TriangleSoup::Format mFormat;
+            const char* mName;
+        } formats[] = {
+            { Physics::TriangleSoup::Format::Precomputed, "Precomputed" },
+            { Physics::TriangleSoup::Format::Indexed, "Indexed" },
+            { Physics::TriangleSoup::Format::View, "View" },
+        };
+        std::cout << "  Soup";
+        const char* separator = " ";
+        for (const auto& format : formats)
+        {
+            Physics::TriangleSoup soup((int)verts.size(), verts.data(), (int)indices.size() / 3, indices.data(), format.mFormat);
+            Physics::CastInfo info;
+            std::chrono::high_resolution_clock::time_point startSoup = std::chrono::high_resolution_clock::now();
+            for (const Physics::LineSegment& line : lines)
+            {
+                soup.RayCast(line, &info);
+            }
+            std::chrono::high_resolution_clock::time_point endSoup = std::chrono::high_resolution_clock::now();
+            std::cout << separator << format.mName << " = " << std::chrono::duration_cast<std::chrono::microseconds>(endSoup - startSoup).count()
+                << " us (" << soup.GetTriMemorySize() / 1024 << " KB)";
+            separator = ", ";
+        }
+        std::cout << std::endl;
+    }
+
+    // a dense mesh written as OBJ and as binary PLY, and imported back
+    {
+        const int SIDE = 512;
+        const char* paths[] = { "SpeedTest.obj", "SpeedTest.ply" };
+        {
+            std::ofstream obj(paths[0]);
+            std::ofstream ply(paths[1], std::ios::binary);
+            ply << "ply\nformat binary_little_endian 1.0\nelement vertex " << SIDE * SIDE
+                << "\nproperty float x\nproperty float y\nproperty float z\nelement face " << (SIDE - 1) * (SIDE - 1)
+                << "\nproperty list uchar int vertex_indices\nend_header\n";
+            for (int y = 0; y < SIDE; ++y)
+            {
+                for (int x = 0; x < SIDE; ++x)
+                {
+                    Vector3 v((float)x, (float)y, 5.0f * Math::Sin(0.3f * x) * Math::Cos(0.2f * y));
+                    obj << "v " << v.x << ' ' << v.y << ' ' << v.z << '\n';
+                    ply.write(reinterpret_cast<const char*>(v.GetAsFloatPtr()), 3 * sizeof(float));
+                }
+            }
+            for (int y = 0; y + 1 < SIDE; ++y)
+            {
+                for (int x = 0; x + 1 < SIDE; ++x)
+                {
+                    int quad[4] = { y * SIDE + x, y * SIDE + x + 1, (y + 1) * SIDE + x + 1, (y + 1) * SIDE + x };
+                    obj << "f " << quad[0] + 1 << ' ' << quad[1] + 1 << ' ' << quad[2] + 1 << ' ' << quad[3] + 1 << '\n';
+                    ply.put(4);
+                    ply.write(reinterpret_cast<const char*>(quad), sizeof(quad));
+                }
+            }
+        }
+        Physics::MeshImporter importer;
+        Physics::Mesh mesh;
+        std::cout << "  Import";
+        const char* separator = " ";
+        for (const char* path : paths)
+        {
+            if (importer.Load(path, &mesh))
+            {
+                std::cout << separator << (path == paths[0] ? "OBJ" : "PLY") << " = " << (int)importer.GetMBPerSecond() << " MB/s ("
+                    << importer.GetBytesRead() / 1024 << " KB)";
+                separator = ", ";
+            }
+            std::remove(path);
+        }
+        std::cout << ", " << mesh.GetTriCount() << " triangles" << std::endl;
+    }
+
+    // building a big hierarchy on more and more threads
+    {
+        const int NUM_BOX = 1 << 19;
+        std::vector<Physics::AABB> boxes;
+        for (int i = 0; i < NUM_BOX; ++i)
+        {
+            Vector3 center = WORLD_RADIUS * Random::GetVector(Vector3(-1.0f, -1.0f, -1.0f), Vector3(1.0f, 1.0f, 1.0f));
+            Vector3 half = Random::GetVector(Vector3(1.0f, 1.0f, 1.0f), Vector3(50.0f, 50.0f, 50.0f));
+            boxes.push_back(Physics::AABB(center - half, center + half));
+        }
+        std::cout << "  Bvh build of " << NUM_BOX << " boxes:";
+        float serialCost = 0.0f;
+        const char* separator = " ";
+        for (int threadCount : { 1, 2, 4, Physics::GetDefaultThreadCount() })
+        {
+            Physics::Bvh bvh;
+            std::chrono::high_resolution_clock::time_point startBuild = std::chrono::high_resolution_clock::now();
+            bvh.Build(boxes.data(), NUM_BOX, threadCount);
+            std::chrono::high_resolution_clock::time_point endBuild = std::chrono::high_resolution_clock::now();
+            serialCost = threadCount == 1 ? bvh.GetSahCost() : serialCost;
+            std::cout << separator << threadCount << (threadCount == 1 ? " thread = " : " threads = ")
+                << std::chrono::duration_cast<std::chrono::milliseconds>(endBuild - startBuild).count() << " ms";
+            if (threadCount != 1)
+            {
+                std::cout << " (SAH " << bvh.GetSahCost() / serialCost << "x)";
+            }
+            separator = ", ";
+        }
+        std::cout << std::endl;
+
+        // the same boxes sorted along a Morton curve, as a world rebuilt every frame would be
+        std::cout << "  Linear build of " << NUM_BOX << " boxes:";
+        separator = " ";
+        for (Physics::Bvh::MortonCode code : { Physics::Bvh::MortonCode::Bits30, Physics::Bvh::MortonCode::Bits63 })
+        {
+            Physics::Bvh bvh;
+            std::chrono::high_resolution_clock::time_point startBuild = std::chrono::high_resolution_clock::now();
+            bvh.BuildLinear(boxes.data(), NUM_BOX, code);
+            std::chrono::high_resolution_clock::time_point endBuild = std::chrono::high_resolution_clock::now();
+            std::cout << separator << (code == Physics::Bvh::MortonCode::Bits30 ? "30" : "63") << " bit codes = "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(endBuild - startBuild).count() << " ms (SAH "
+                << bvh.GetSahCost() / serialCost << "x)";
+            separator = ", ";
+        }
+        std::cout << std::endl;
+    }
+
+    // the world saved to a cache file and mapped back, against building it from its objects
+    {
+        const char* path = "SpeedTest.cache";
+        std::chrono::high_resolution_clock::time_point startBuild = std::chrono::high_resolution_clock::now();
+        world.Build();
+        std::chrono::high_resolution_clock::time_point startSave = std::chrono::high_resolution_clock::now();
+        bool saved = Physics::SceneCache::Save(path, world);
+        std::chrono::high_resolution_clock::time_point startLoad = std::chrono::high_resolution_clock::now();
+        Physics::SceneCache cache;
+        bool loaded = saved && cache.Load(path);
+        std::chrono::high_resolution_clock::time_point endLoad = std::chrono::high_resolution_clock::now();
+        if (loaded)
+        {
+            std::cout << "  Bvh build = " << std::chrono::duration_cast<std::chrono::microseconds>(startSave - startBuild).count()
+                << " us, cache save = " << std::chrono::duration_cast<std::chrono::microseconds>(startLoad - startSave).count()
+                << " us, load = " << std::chrono::duration_cast<std::chrono::microseconds>(endLoad - startLoad).count()
+                << " us (" << cache.GetFileSize() / 1024 << " KB), Bvh from cache = " << TimeRayCasts(cache.GetWorld(), pLine) << " ms" << std::endl;
+        }
+        cache.Close();
+        std::remove(path);
+    }
 
     delete[] pLine;
 
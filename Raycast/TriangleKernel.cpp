@@ -0,0 +1,321 @@
+#include "TriangleKernel.h"
+#if PHYSICS_TRI_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+namespace Physics {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // SIMD wrappers, so the kernel below reads the same for SSE and AVX
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+#if PHYSICS_TRI_WIDTH == 8
+    namespace {
+        typedef __m256 Lanes;
+        inline Lanes Set1(float f) { return _mm256_set1_ps(f); }
+        inline Lanes Load(const float* p) { return _mm256_loadu_ps(p); }
+        inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+        inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+        inline Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+        inline Lanes Neg(Lanes a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+        inline Lanes And(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+        inline Lanes Less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        inline Lanes GreaterEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        inline Lanes LessEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        inline int MoveMask(Lanes a) { return _mm256_movemask_ps(a); }
+        inline void Store(float* p, Lanes a) { _mm256_storeu_ps(p, a); }
+        inline Lanes LaneIndex() { return _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f); }
+    }
+#elif PHYSICS_TRI_WIDTH == 4
+    namespace {
+        typedef __m128 Lanes;
+        inline Lanes Set1(float f) { return _mm_set1_ps(f); }
+        inline Lanes Load(const float* p) { return _mm_loadu_ps(p); }
+        inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+        inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+        inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+        inline Lanes Neg(Lanes a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+        inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+        inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+        inline Lanes GreaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+        inline Lanes LessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+        inline int MoveMask(Lanes a) { return _mm_movemask_ps(a); }
+        inline void Store(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+        inline Lanes LaneIndex() { return _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f); }
+    }
+#endif
+
+    namespace {
+        enum Mode {
+            CLOSEST_HIT,    // return the closest hit, lowering maxFraction to it
+            ANY_HIT,        // return the first hit found
+            ALL_HITS,       // write every hit to pTris/pFractions, return how many
+        };
+
+        /// <summary>
+        /// One triangle at a time, used when there is no SIMD (see RayCastLanes)
+        /// </summary>
+        template <Mode MODE>
+        int RayCastScalar(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction,
+            int* pTris = nullptr, float* pFractions = nullptr)
+        {
+            const float* const* s = tris.mStream;
+            int bestTri = -1;
+            int hitCount = 0;
+            for (int i = first; i < first + count; ++i)
+            {
+                // moving against the normal, or it's a back face (or parallel)
+                float nx = s[TriangleStreams::ROW_N_X][i];
+                float ny = s[TriangleStreams::ROW_N_Y][i];
+                float nz = s[TriangleStreams::ROW_N_Z][i];
+                float ddz = nx * dir.x + ny * dir.y + nz * dir.z;
+                if (false == (ddz < 0.0f))
+                {
+                    continue;
+                }
+                float odz = nx * from.x + ny * from.y + nz * from.z + s[TriangleStreams::ROW_N_W][i];
+                float t = -odz / ddz;
+                if (false == (t >= 0.0f && t < maxFraction))
+                {
+                    continue;
+                }
+                Vector3 p(from.x + t * dir.x, from.y + t * dir.y, from.z + t * dir.z);
+                float u = s[TriangleStreams::ROW_U_X][i] * p.x + s[TriangleStreams::ROW_U_Y][i] * p.y + s[TriangleStreams::ROW_U_Z][i] * p.z + s[TriangleStreams::ROW_U_W][i];
+                float v = s[TriangleStreams::ROW_V_X][i] * p.x + s[TriangleStreams::ROW_V_Y][i] * p.y + s[TriangleStreams::ROW_V_Z][i] * p.z + s[TriangleStreams::ROW_V_W][i];
+                if (false == (u >= 0.0f && v >= 0.0f && u + v <= 1.0f))
+                {
+                    continue;
+                }
+                if (MODE == ANY_HIT)
+                {
+                    return i;
+                }
+                if (MODE == ALL_HITS)
+                {
+                    pTris[hitCount] = i;
+                    pFractions[hitCount++] = t;
+                    continue;
+                }
+                maxFraction = t;
+                bestTri = i;
+            }
+            return MODE == ALL_HITS ? hitCount : bestTri;
+        }
+
+        /// <summary>
+        /// The loop behind RayCastTriangles, RayCastTrianglesAny and RayCastTrianglesAll, see Mode
+        /// </summary>
+        template <Mode MODE>
+        int RayCastLanes(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction,
+            int* pTris = nullptr, float* pFractions = nullptr)
+        {
+#if PHYSICS_TRI_WIDTH > 1
+            const float* const* s = tris.mStream;
+            const Lanes ox = Set1(from.x), oy = Set1(from.y), oz = Set1(from.z);
+            const Lanes dx = Set1(dir.x), dy = Set1(dir.y), dz = Set1(dir.z);
+            const Lanes zero = Set1(0.0f);
+            const Lanes one = Set1(1.0f);
+            const Lanes laneIndex = LaneIndex();
+            Lanes best = Set1(maxFraction);
+            int bestTri = -1;
+            int hitCount = 0;
+
+            for (int i = first; i < first + count; i += PHYSICS_TRI_WIDTH)
+            {
+                // lanes past the end of the range hold other triangles (or padding), mask them off
+                Lanes mask = Less(laneIndex, Set1((float)(first + count - i)));
+
+                Lanes nx = Load(s[TriangleStreams::ROW_N_X] + i);
+                Lanes ny = Load(s[TriangleStreams::ROW_N_Y] + i);
+                Lanes nz = Load(s[TriangleStreams::ROW_N_Z] + i);
+                Lanes nw = Load(s[TriangleStreams::ROW_N_W] + i);
+                Lanes ddz = Add(Add(Mul(nx, dx), Mul(ny, dy)), Mul(nz, dz));
+                mask = And(mask, Less(ddz, zero));
+                Lanes odz = Add(Add(Add(Mul(nx, ox), Mul(ny, oy)), Mul(nz, oz)), nw);
+                Lanes t = Div(Neg(odz), ddz);
+                mask = And(mask, And(GreaterEqual(t, zero), Less(t, best)));
+                if (MoveMask(mask) == 0)
+                {
+                    continue;
+                }
+
+                Lanes px = Add(ox, Mul(t, dx));
+                Lanes py = Add(oy, Mul(t, dy));
+                Lanes pz = Add(oz, Mul(t, dz));
+                Lanes u = Add(Add(Add(Mul(Load(s[TriangleStreams::ROW_U_X] + i), px), Mul(Load(s[TriangleStreams::ROW_U_Y] + i), py)),
+                    Mul(Load(s[TriangleStreams::ROW_U_Z] + i), pz)), Load(s[TriangleStreams::ROW_U_W] + i));
+                Lanes v = Add(Add(Add(Mul(Load(s[TriangleStreams::ROW_V_X] + i), px), Mul(Load(s[TriangleStreams::ROW_V_Y] + i), py)),
+                    Mul(Load(s[TriangleStreams::ROW_V_Z] + i), pz)), Load(s[TriangleStreams::ROW_V_W] + i));
+                mask = And(mask, And(GreaterEqual(u, zero), GreaterEqual(v, zero)));
+                mask = And(mask, LessEqual(Add(u, v), one));
+                int bits = MoveMask(mask);
+                if (bits == 0)
+                {
+                    continue;
+                }
+
+                // closest of the lanes that hit, lowest index first
+                float lanesT[PHYSICS_TRI_WIDTH];
+                Store(lanesT, t);
+                for (int lane = 0; lane < PHYSICS_TRI_WIDTH; ++lane)
+                {
+                    if ((bits & (1 << lane)) && lanesT[lane] < maxFraction)
+                    {
+                        if (MODE == ANY_HIT)
+                        {
+                            return i + lane;
+                        }
+                        if (MODE == ALL_HITS)
+                        {
+                            pTris[hitCount] = i + lane;
+                            pFractions[hitCount++] = lanesT[lane];
+                            continue;
+                        }
+                        maxFraction = lanesT[lane];
+                        bestTri = i + lane;
+                    }
+                }
+                best = Set1(maxFraction);
+            }
+            return MODE == ALL_HITS ? hitCount : bestTri;
+#else
+            return RayCastScalar<MODE>(tris, first, count, from, dir, maxFraction, pTris, pFractions);
+#endif
+        }
+
+        /// <summary>
+        /// The loop behind the IndexedTriangles kernels. The same tests as RayCastScalar, but on the unscaled normal
+        /// n = e1 x e2 and with u and v scaled by |n|^2, so the only division is the one for t
+        /// </summary>
+        template <Mode MODE, typename Index>
+        int RayCastIndices(const Vector3* pVerts, const Index* pIndices, const int* pOrder, int first, int count, const Vector3& from,
+            const Vector3& dir, float& maxFraction, int* pTris, float* pFractions)
+        {
+            int bestTri = -1;
+            int hitCount = 0;
+            for (int i = first; i < first + count; ++i)
+            {
+                const Index* pTri = pIndices + (pOrder ? pOrder[i] : i) * 3;
+                const Vector3& v0 = pVerts[pTri[0]];
+                Vector3 e1 = pVerts[pTri[1]] - v0;
+                Vector3 e2 = pVerts[pTri[2]] - v0;
+                Vector3 n = Vector3::Cross(e1, e2);
+
+                // moving against the normal, or it's a back face (or parallel, or degenerate)
+                float ddz = Vector3::Dot(n, dir);
+                if (false == (ddz < 0.0f))
+                {
+                    continue;
+                }
+                Vector3 o = from - v0;
+                float t = -Vector3::Dot(n, o) / ddz;
+                if (false == (t >= 0.0f && t < maxFraction))
+                {
+                    continue;
+                }
+                Vector3 p = o + t * dir;
+                float u = Vector3::Dot(Vector3::Cross(e2, n), p);
+                float v = Vector3::Dot(Vector3::Cross(n, e1), p);
+                if (false == (u >= 0.0f && v >= 0.0f && u + v <= n.LengthSq()))
+                {
+                    continue;
+                }
+                if (MODE == ANY_HIT)
+                {
+                    return i;
+                }
+                if (MODE == ALL_HITS)
+                {
+                    pTris[hitCount] = i;
+                    pFractions[hitCount++] = t;
+                    continue;
+                }
+                maxFraction = t;
+                bestTri = i;
+            }
+            return MODE == ALL_HITS ? hitCount : bestTri;
+        }
+
+        template <Mode MODE>
+        int RayCastIndexed(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction,
+            int* pTris = nullptr, float* pFractions = nullptr)
+        {
+            if (tris.mIndices16)
+            {
+                return RayCastIndices<MODE>(tris.mVerts, tris.mIndices16, tris.mOrder, first, count, from, dir, maxFraction, pTris, pFractions);
+            }
+            return RayCastIndices<MODE>(tris.mVerts, tris.mIndices32, tris.mOrder, first, count, from, dir, maxFraction, pTris, pFractions);
+        }
+    }
+
+    /// <summary>
+    /// Find the closest triangle in [first, first + count) hit by the segment from + t * dir, t in [0, maxFraction)
+    /// Only front faces count. The arithmetic is done in the same order as RayCastTrianglesScalar so both agree,
+    /// and ties go to the lowest index in both.
+    /// </summary>
+    /// <param name="tris">the precomputed triangles</param>
+    /// <param name="first">the first triangle to test</param>
+    /// <param name="count">how many triangles to test</param>
+    /// <param name="from">start of the segment</param>
+    /// <param name="dir">end - start of the segment</param>
+    /// <param name="maxFraction">only hits in front of this count, lowered to the fraction of the hit if there is one</param>
+    /// <returns>the index of the triangle hit, or -1</returns>
+    int RayCastTriangles(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction)
+    {
+        return RayCastLanes<CLOSEST_HIT>(tris, first, count, from, dir, maxFraction);
+    }
+
+    /// <summary>
+    /// The scalar version of RayCastTriangles, one triangle at a time
+    /// </summary>
+    int RayCastTrianglesScalar(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction)
+    {
+        return RayCastScalar<CLOSEST_HIT>(tris, first, count, from, dir, maxFraction);
+    }
+
+    /// <summary>
+    /// Is any triangle in [first, first + count) hit by the segment from + t * dir, t in [0, maxFraction)?
+    /// Stops at the first hit it finds, which is not necessarily the closest.
+    /// </summary>
+    /// <returns>the index of a triangle hit, or -1</returns>
+    int RayCastTrianglesAny(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction)
+    {
+        return RayCastLanes<ANY_HIT>(tris, first, count, from, dir, maxFraction);
+    }
+
+    /// <summary>
+    /// Every triangle in [first, first + count) hit by the segment from + t * dir, t in [0, maxFraction), in index order
+    /// </summary>
+    /// <param name="pTris">count entries, the triangles hit</param>
+    /// <param name="pFractions">count entries, the fraction of each hit</param>
+    /// <returns>how many triangles were hit</returns>
+    int RayCastTrianglesAll(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction,
+        int* pTris, float* pFractions)
+    {
+        return RayCastLanes<ALL_HITS>(tris, first, count, from, dir, maxFraction, pTris, pFractions);
+    }
+
+    /// <summary>
+    /// RayCastTriangles for the triangles of an indexed soup, the hits agree with it up to rounding
+    /// </summary>
+    int RayCastTriangles(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction)
+    {
+        return RayCastIndexed<CLOSEST_HIT>(tris, first, count, from, dir, maxFraction);
+    }
+
+    /// <summary>
+    /// RayCastTrianglesAny for the triangles of an indexed soup
+    /// </summary>
+    int RayCastTrianglesAny(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction)
+    {
+        return RayCastIndexed<ANY_HIT>(tris, first, count, from, dir, maxFraction);
+    }
+
+    /// <summary>
+    /// RayCastTrianglesAll for the triangles of an indexed soup
+    /// </summary>
+    int RayCastTrianglesAll(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction,
+        int* pTris, float* pFractions)
+    {
+        return RayCastIndexed<ALL_HITS>(tris, first, count, from, dir, maxFraction, pTris, pFractions);
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "Math.h"
+#include <cstdint>
+
+// SIMD width of the triangle kernel: AVX when the compiler targets it (/arch:AVX2, -mavx2), otherwise SSE2, which every
+// x64 compiler targets. Define PHYSICS_NO_SIMD to force the scalar loop.
+#if defined(PHYSICS_NO_SIMD)
+#define PHYSICS_TRI_WIDTH 1
+#elif defined(__AVX__)
+#define PHYSICS_TRI_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHYSICS_TRI_WIDTH 4
+#else
+#define PHYSICS_TRI_WIDTH 1
+#endif
+
+namespace Physics
+{
+    /// <summary>
+    /// The precomputed triangles of a soup, as a structure of arrays
+    /// Every triangle is stored as the rows of the affine transform taking points into its own space:
+    /// v0 goes to the origin, the edges v1 - v0 and v2 - v0 to the x and y axes and the (unnormalized) normal to z.
+    /// A hit is then t = -z / dz, u = x + t * dx, v = y + t * dy with u, v >= 0 and u + v <= 1, all dot products.
+    /// Each stream must be readable PHYSICS_TRI_WIDTH - 1 floats past the last triangle (see GetPaddedCount).
+    /// </summary>
+    struct TriangleStreams {
+        enum Stream {
+            ROW_U_X, ROW_U_Y, ROW_U_Z, ROW_U_W,
+            ROW_V_X, ROW_V_Y, ROW_V_Z, ROW_V_W,
+            ROW_N_X, ROW_N_Y, ROW_N_Z, ROW_N_W,
+            NUM_STREAMS
+        };
+        const float* mStream[NUM_STREAMS];
+
+        /// <summary>
+        /// How many floats to allocate per stream for triCount triangles, so the kernel can always load a full batch
+        /// </summary>
+        static constexpr int GetPaddedCount(int triCount)
+        {
+            const int BLOCK = 8;
+            return (triCount + BLOCK - 1 + BLOCK - 1) / BLOCK * BLOCK;
+        }
+
+        /// <summary>
+        /// The rows of the triangle v0, v1, v2, as pRows[r].x, .y, .z and pW[r], for r = ROW_U, ROW_V and ROW_N
+        /// </summary>
+        /// <returns>false for a degenerate triangle, which has no rows</returns>
+        static constexpr bool GetRows(const Vector3& v0, const Vector3& v1, const Vector3& v2, Vector3* pRows, float* pW)
+        {
+            Vector3 e1 = v1 - v0;
+            Vector3 e2 = v2 - v0;
+            Vector3 n = Vector3::Cross(e1, e2);
+            float lenSq = n.LengthSq();
+            if (lenSq == 0.0f)
+            {
+                return false;
+            }
+
+            // the rows of the inverse of the matrix with columns e1, e2, n
+            float invLenSq = 1.0f / lenSq;
+            pRows[0] = invLenSq * Vector3::Cross(e2, n);
+            pRows[1] = invLenSq * Vector3::Cross(n, e1);
+            pRows[2] = invLenSq * n;
+            for (int r = 0; r < 3; ++r)
+            {
+                pW[r] = -Vector3::Dot(pRows[r], v0);
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Write the rows of the triangle v0, v1, v2 as triangle i of streams stride floats apart, starting at pData
+        /// A degenerate triangle is left at zero so nothing ever hits it, pData must be zeroed beforehand
+        /// </summary>
+        static constexpr void SetTriangle(float* pData, int stride, int i, const Vector3& v0, const Vector3& v1, const Vector3& v2)
+        {
+            Vector3 rows[3];
+            float w[3] = {};
+            if (false == GetRows(v0, v1, v2, rows, w))
+            {
+                return;
+            }
+            for (int r = 0; r < 3; ++r)
+            {
+                pData[(r * 4 + 0) * stride + i] = rows[r].x;
+                pData[(r * 4 + 1) * stride + i] = rows[r].y;
+                pData[(r * 4 + 2) * stride + i] = rows[r].z;
+                pData[(r * 4 + 3) * stride + i] = w[r];
+            }
+        }
+    };
+
+    /// <summary>
+    /// The triangles of an indexed soup: a shared vertex array and 3 indices per triangle, 16 bit when they fit
+    /// Nothing is precomputed, so this takes about a quarter of the memory of TriangleStreams, and the kernel works
+    /// out each triangle's plane as it goes, one triangle at a time
+    /// </summary>
+    struct IndexedTriangles {
+        const Vector3* mVerts;
+        const uint16_t* mIndices16; // 3 per triangle, null if the indices are 32 bit
+        const uint32_t* mIndices32; // 3 per triangle, null if the indices are 16 bit
+        const int* mOrder;          // the triangle at each position of a [first, first + count) range, null if they are in order
+    };
+
+    int RayCastTriangles(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction);
+    int RayCastTrianglesScalar(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction);
+    int RayCastTrianglesAny(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction);
+    int RayCastTrianglesAll(const TriangleStreams& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction,
+        int* pTris, float* pFractions);
+
+    int RayCastTriangles(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float& maxFraction);
+    int RayCastTrianglesAny(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction);
+    int RayCastTrianglesAll(const IndexedTriangles& tris, int first, int count, const Vector3& from, const Vector3& dir, float maxFraction,
+        int* pTris, float* pFractions);
+}
@@ -1,10 +1,44 @@
 #include "UnitTest.h"
+#include "MeshImporter.h"
+#include "Parallel.h"
 #include "Physics.h"
+#include "RayCastService.h"
+#include "SceneCache.h"
 #include "SoupCube.h"
+#include <algorithm>
 #include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
 
 namespace Physics
 {
+    /// <summary>
+    /// Every hit a test table expects has to be on its line, with a normal facing against it (back faces never hit)
+    /// The tables are constexpr, so this is checked as they compile
+    /// </summary>
+    template <typename Test, size_t N>
+    constexpr bool HitsAreOnTheirLines(const Test (&tests)[N])
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (false == tests[i].mShouldHit)
+            {
+                continue;
+            }
+            Vector3 dir = tests[i].mLine.mTo - tests[i].mLine.mFrom;
+            Vector3 toHit = tests[i].mCorrectPosition - tests[i].mLine.mFrom;
+            float along = Vector3::Dot(toHit, dir);
+            float lenSq = dir.LengthSq();
+            if (along < 0.0f || along > lenSq || Vector3::Cross(toHit, dir).LengthSq() > 0.000001f * lenSq * lenSq ||
+                Vector3::Dot(tests[i].mCorrectNormal, dir) >= 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
     struct LineVsPlane {
         LineSegment mLine;
         Plane mPlane;
@@ -12,7 +46,7 @@ namespace Physics
         Vector3 mCorrectNormal;
         Vector3 mCorrectPosition;
     };
-    static LineVsPlane s_lineVsPlane[] = {
+    static constexpr LineVsPlane s_lineVsPlane[] = {
         {   // hit down z-axis
             { Vector3(0.0f, 0.0f, 100.0f), Vector3(0.0f, 0.0f, -100.0f) },
             { Vector3(0.0f, 0.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f) },
@@ -49,6 +83,7 @@ namespace Physics
             Vector3(0.0f, 0.0f, 0.0f)
         },
     };
+    static_assert(HitsAreOnTheirLines(s_lineVsPlane), "a hit in s_lineVsPlane is off its line");
 
     bool TestLineVsPlane(const LineVsPlane& test)
     {
@@ -77,7 +112,7 @@ namespace Physics
         Plane mPlane;
     };
 
-    static Tri2Plane s_testTri2Plane[] = {
+    static constexpr Tri2Plane s_testTri2Plane[] = {
         {   // flat on xy axis
             { Vector3(0.0f, 0.0f, 0.0f), Vector3(100.0f, 0.0f, 0.0f), Vector3(100.0f, 100.0f, 0.0f) },
             { Vector3(0.0f, 0.0f, 1.0f), 0.0f }
@@ -98,7 +133,7 @@ namespace Physics
         bool mIsInside;
     };
 
-    static PointInTri s_testPointInTri[] = {
+    static constexpr PointInTri s_testPointInTri[] = {
         // xy plane
         {   // inside
             { Vector3(0.0f, 0.0f, 0.0f), Vector3(100.0f, 0.0f, 0.0f), Vector3(0.0f, 100.0f, 0.0f) },
@@ -161,7 +196,7 @@ namespace Physics
         Vector3 mCorrectPosition;
     };
 
-    static LineVsTri s_testLineVTri[] = {
+    static constexpr LineVsTri s_testLineVTri[] = {
         {   // tri in xy plane, line on z-axis hits it
             { Vector3(20.0f, 20.0f, 100.0f), Vector3(20.0f, 20.0f, -100.0f) },
             { Vector3(0.0f, 0.0f, 0.0f), Vector3(100.0f, 0.0f, 0.0f), Vector3(0.0f, 100.0f, 0.0f) },
@@ -219,6 +254,7 @@ namespace Physics
             Vector3(0.0f, 0.0f, 0.0f)
         },    
     };
+    static_assert(HitsAreOnTheirLines(s_testLineVTri), "a hit in s_testLineVTri is off its line");
 
     bool TestLineVsTri(const LineVsTri& test)
     {
@@ -249,7 +285,7 @@ namespace Physics
         Vector3 mCorrectNormal;
         Vector3 mCorrectPosition;
     };
-    static LineVsSoup s_lineVSoup[] = {
+    static constexpr LineVsSoup s_lineVSoup[] = {
         {   // hit a cube on the left
             { Vector3(-100.0f, 0.0f, 0.0f), Vector3(100.0f, 0.0f, 0.0f) },
             g_cubeSoup,
@@ -286,6 +322,7 @@ namespace Physics
             Vector3(0.0f, 0.0f, 0.0f)
         },
     };
+    static_assert(HitsAreOnTheirLines(s_lineVSoup), "a hit in s_lineVSoup is off its line");
 
     bool TestLineVsSoup(const LineVsSoup& test)
     {
@@ -309,6 +346,391 @@ namespace Physics
         return true;
     }
 
+    /// <summary>
+    /// A side by side grid of vertices spacing apart, bumped up and down in z, as 2 triangles per cell facing +z
+    /// </summary>
+    void MakeHeightField(int side, std::vector<Vector3>& verts, std::vector<int>& indices, float spacing = 1.0f)
+    {
+        verts.clear();
+        indices.clear();
+        for (int y = 0; y < side; ++y)
+        {
+            for (int x = 0; x < side; ++x)
+            {
+                verts.emplace_back(spacing * x, spacing * y, 2.0f * spacing * Math::Sin(0.7f * x) * Math::Cos(0.5f * y));
+            }
+        }
+        for (int y = 0; y + 1 < side; ++y)
+        {
+            for (int x = 0; x + 1 < side; ++x)
+            {
+                int a = y * side + x;
+                int quad[6] = { a, a + 1, a + side + 1, a, a + side + 1, a + side };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+    }
+
+    /// <summary>
+    /// A box that is not a cube, 2 triangles facing out of each face, for the tests of box detection
+    /// </summary>
+    static constexpr Vector3 s_boxVert[] = {
+        Vector3(-1.0f, -2.0f, -3.0f), Vector3(1.0f, -2.0f, -3.0f), Vector3(1.0f, 2.0f, -3.0f), Vector3(-1.0f, 2.0f, -3.0f),
+        Vector3(-1.0f, -2.0f, 3.0f), Vector3(1.0f, -2.0f, 3.0f), Vector3(1.0f, 2.0f, 3.0f), Vector3(-1.0f, 2.0f, 3.0f),
+    };
+    static constexpr int s_boxIndex[] = {
+        0, 2, 1,  0, 3, 2,  4, 5, 6,  4, 6, 7,  0, 1, 5,  0, 5, 4,
+        2, 3, 7,  2, 7, 6,  0, 4, 7,  0, 7, 3,  1, 2, 6,  1, 6, 5,
+    };
+
+    /// <summary>
+    /// Make a bumpy height field soup, big enough that its hierarchy has many levels,
+    /// and check casting against it matches testing every triangle
+    /// </summary>
+    bool TestLargeSoup()
+    {
+        const int GRID = 32;
+        const int NUM_LINE = 200;
+        std::vector<Vector3> verts;
+        std::vector<int> indices;
+        MakeHeightField(GRID + 1, verts, indices, 10.0f);
+        std::vector<Triangle> tris;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            tris.emplace_back(verts[indices[i]], verts[indices[i + 1]], verts[indices[i + 2]]);
+        }
+        TriangleSoup soup((int)verts.size(), verts.data(), (int)tris.size(), indices.data());
+
+        std::mt19937 gen(0x5678);
+        std::uniform_real_distribution<float> dist(0.0f, 10.0f * GRID);
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            LineSegment line(Vector3(dist(gen), dist(gen), 100.0f), Vector3(dist(gen), dist(gen), -100.0f));
+            CastInfo best;
+            best.mFraction = Math::Infinity;
+            for (const Triangle& tri : tris)
+            {
+                CastInfo info;
+                if (tri.RayCast(line, &info) && info.mFraction < best.mFraction)
+                {
+                    best = info;
+                }
+            }
+
+            CastInfo info;
+            bool result = soup.RayCast(line, &info);
+            if (result != (best.mFraction != Math::Infinity))
+            {
+                return false;
+            }
+            if (result && (false == Math::CloseEnough(info.mPoint, best.mPoint) || false == Math::CloseEnough(info.mNormal, best.mNormal)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// A Bvh built on several threads has to have the SAH cost of the one a single thread builds, and a line has to
+    /// reach the very same primitives through either
+    /// </summary>
+    bool TestBvhParallelBuild()
+    {
+        const int NUM_PRIM = 70000;     // enough for the top nodes to be binned and partitioned in parallel
+        const int NUM_LINE = 200;
+        std::mt19937 gen(0x9a8b);
+        std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> size(0.01f, 2.0f);
+        std::vector<AABB> bounds;
+        for (int i = 0; i < NUM_PRIM; ++i)
+        {   // half spread out, half in a tight cluster
+            Vector3 center = (i % 2 ? 1.0f : 0.05f) * Vector3(dist(gen), dist(gen), dist(gen));
+            Vector3 half(size(gen), size(gen), size(gen));
+            bounds.emplace_back(center - half, center + half);
+        }
+        Bvh serial;
+        serial.Build(bounds.data(), NUM_PRIM, 1);
+        for (int threadCount : { 2, 3, 4 })
+        {
+            Bvh parallel;
+            parallel.Build(bounds.data(), NUM_PRIM, threadCount);
+            if (parallel.GetNodeCount() != serial.GetNodeCount() ||
+                false == Math::NearZero(parallel.GetSahCost() / serial.GetSahCost() - 1.0f, 0.0001f))
+            {
+                return false;
+            }
+            std::vector<int> order = parallel.GetPrimOrder();
+            std::sort(order.begin(), order.end());
+            for (int i = 0; i < NUM_PRIM; ++i)
+            {
+                if (order[i] != i)
+                {
+                    return false;
+                }
+            }
+
+            for (int i = 0; i < NUM_LINE; ++i)
+            {
+                LineSegment line(Vector3(dist(gen), dist(gen), dist(gen)), Vector3(dist(gen), dist(gen), dist(gen)));
+                std::vector<int> reached[2];
+                const Bvh* bvhs[2] = { &serial, &parallel };
+                for (int b = 0; b < 2; ++b)
+                {
+                    float maxFraction = 1.0f;
+                    bvhs[b]->RayCast(line.mFrom, line.mTo, maxFraction,
+                        [&](int first, int count, float&)
+                        {
+                            for (int p = first; p < first + count; ++p)
+                            {
+                                reached[b].push_back(bvhs[b]->GetPrimOrder()[p]);
+                            }
+                            return false;
+                        });
+                    std::sort(reached[b].begin(), reached[b].end());
+                }
+                if (reached[0] != reached[1])
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// How deep a hierarchy goes, 0 for a lone leaf
+    /// </summary>
+    int GetBvhDepth(const BvhNode* pNodes, int node)
+    {
+        if (pNodes[node].mCount > 0)
+        {
+            return 0;
+        }
+        return 1 + std::max(GetBvhDepth(pNodes, pNodes[node].mFirst), GetBvhDepth(pNodes, pNodes[node].mFirst + 1));
+    }
+
+    /// <summary>
+    /// A Bvh built from Morton codes has to hold every primitive once, in one leaf each, inside bounds that hold
+    /// their children, and a line has to reach exactly the primitives whose bounds it crosses. The tree must not
+    /// depend on the thread count, and primitives spread so unevenly that the codes would nest too deep have to
+    /// end up in a tree Bvh::RayCast can walk.
+    /// </summary>
+    bool TestLinearBvh()
+    {
+        const int NUM_PRIM = 70000;     // enough for the sort and the tree to run in parallel
+        const int NUM_LINE = 200;
+        std::mt19937 gen(0x1b7c);
+        std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> size(0.01f, 2.0f);
+        std::vector<AABB> bounds;
+        for (int i = 0; i < NUM_PRIM; ++i)
+        {   // a third spread out, a third in a tight cluster, a third stacked on the same center
+            Vector3 center = i % 3 == 0 ? Vector3(dist(gen), dist(gen), dist(gen)) :
+                i % 3 == 1 ? 0.01f * Vector3(dist(gen), dist(gen), dist(gen)) : Vector3(50.0f, 50.0f, 50.0f);
+            Vector3 half(size(gen), size(gen), size(gen));
+            bounds.emplace_back(center - half, center + half);
+        }
+
+        for (Bvh::MortonCode code : { Bvh::MortonCode::Bits30, Bvh::MortonCode::Bits63 })
+        {
+            Bvh serial;
+            serial.BuildLinear(bounds.data(), NUM_PRIM, code, 1);
+            Bvh parallel;
+            parallel.BuildLinear(bounds.data(), NUM_PRIM, code, 4);
+            if (serial.GetNodeCount() != 2 * NUM_PRIM - 1 || parallel.GetNodeCount() != serial.GetNodeCount() ||
+                parallel.GetPrimOrder() != serial.GetPrimOrder() ||
+                0 != std::memcmp(parallel.GetNodes(), serial.GetNodes(), serial.GetNodeCount() * sizeof(BvhNode)) ||
+                GetBvhDepth(serial.GetNodes(), 0) > Bvh::MAX_DEPTH)
+            {
+                return false;
+            }
+
+            std::vector<int> order = serial.GetPrimOrder();
+            std::sort(order.begin(), order.end());
+            for (int i = 0; i < NUM_PRIM; ++i)
+            {
+                if (order[i] != i)
+                {
+                    return false;
+                }
+            }
+            const BvhNode* pNodes = serial.GetNodes();
+            for (int i = 0; i < serial.GetNodeCount(); ++i)
+            {
+                const BvhNode& node = pNodes[i];
+                for (int c = 0; c < 2 && node.mCount == 0; ++c)
+                {
+                    const AABB& child = pNodes[node.mFirst + c].mBounds;
+                    if (child.mMin.x < node.mBounds.mMin.x || child.mMin.y < node.mBounds.mMin.y || child.mMin.z < node.mBounds.mMin.z ||
+                        child.mMax.x > node.mBounds.mMax.x || child.mMax.y > node.mBounds.mMax.y || child.mMax.z > node.mBounds.mMax.z)
+                    {
+                        return false;
+                    }
+                }
+                if (node.mCount > 1)
+                {
+                    return false;
+                }
+            }
+
+            for (int i = 0; i < NUM_LINE; ++i)
+            {
+                LineSegment line(Vector3(dist(gen), dist(gen), dist(gen)), Vector3(dist(gen), dist(gen), dist(gen)));
+                Vector3 invDir = Bvh::GetInvDir(line.mTo - line.mFrom);
+                std::vector<int> expected;
+                for (int p = 0; p < NUM_PRIM; ++p)
+                {
+                    if (bounds[p].RayCast(line.mFrom, invDir, 1.0f))
+                    {
+                        expected.push_back(p);
+                    }
+                }
+                std::vector<int> reached;
+                float maxFraction = 1.0f;
+                serial.RayCast(line.mFrom, line.mTo, maxFraction,
+                    [&](int first, int count, float&)
+                    {
+                        for (int p = first; p < first + count; ++p)
+                        {
+                            reached.push_back(serial.GetPrimOrder()[p]);
+                        }
+                        return false;
+                    });
+                std::sort(reached.begin(), reached.end());
+                if (reached != expected)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // one box at the origin and one at each power of two along each axis: with 63 bit codes every box splits off
+        // on its own level, deeper than a walk can go, and Build() takes over
+        std::vector<AABB> chain(1, AABB(Vector3(-0.5f, -0.5f, -0.5f), Vector3(0.5f, 0.5f, 0.5f)));
+        for (int k = 0; k < 20; ++k)
+        {
+            float offset = (float)(1 << k);
+            for (const Vector3& axis : { Vector3(1.0f, 0.0f, 0.0f), Vector3(0.0f, 1.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f) })
+            {
+                chain.emplace_back(chain[0].mMin + offset * axis, chain[0].mMax + offset * axis);
+            }
+        }
+        for (Bvh::MortonCode code : { Bvh::MortonCode::Bits30, Bvh::MortonCode::Bits63 })
+        {
+            Bvh bvh;
+            bvh.BuildLinear(chain.data(), (int)chain.size(), code);
+            if (bvh.IsEmpty() || GetBvhDepth(bvh.GetNodes(), 0) > Bvh::MAX_DEPTH)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// The QuantizedBvh has to reach every primitive the Bvh it was built from reaches, and a soup using one
+    /// has to find the same hits as the same soup using the Bvh
+    /// </summary>
+    bool TestQuantizedBvh()
+    {
+        const int NUM_PRIM = 2000;
+        const int NUM_LINE = 300;
+        std::mt19937 gen(0x2468);
+        std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> size(0.01f, 5.0f);
+        std::vector<AABB> bounds;
+        for (int i = 0; i < NUM_PRIM; ++i)
+        {
+            Vector3 center(dist(gen), dist(gen), 0.01f * dist(gen));
+            Vector3 half(size(gen), size(gen), 0.0f);
+            bounds.emplace_back(center - half, center + half);
+        }
+        // a pile of boxes with the same center make a leaf too big for one reference
+        for (int i = 0; i < 20; ++i)
+        {
+            bounds.emplace_back(Vector3(10.0f - i, 10.0f - i, -1.0f), Vector3(10.0f + i, 10.0f + i, 1.0f));
+        }
+        Bvh bvh;
+        bvh.Build(bounds.data(), (int)bounds.size());
+        QuantizedBvh quantized;
+        if (false == quantized.Build(bvh) || quantized.IsEmpty() || 10 * quantized.GetMemorySize() > 6 * bvh.GetMemorySize())
+        {
+            return false;
+        }
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            LineSegment line(Vector3(dist(gen), dist(gen), dist(gen)), Vector3(dist(gen), dist(gen), dist(gen)));
+            std::vector<bool> reached(bounds.size(), false);
+            float maxFraction = 1.0f;
+            bvh.RayCast(line.mFrom, line.mTo, maxFraction,
+                [&](int first, int count, float&)
+                {
+                    for (int p = first; p < first + count; ++p)
+                    {
+                        reached[p] = true;
+                    }
+                    return false;
+                });
+            quantized.RayCast(line.mFrom, line.mTo, maxFraction,
+                [&](int first, int count, float&)
+                {
+                    for (int p = first; p < first + count; ++p)
+                    {
+                        reached[p] = false;
+                    }
+                    return false;
+                });
+            if (std::find(reached.begin(), reached.end(), true) != reached.end())
+            {
+                return false;
+            }
+        }
+
+        // a bumpy grid, as in TestLargeSoup
+        const int GRID = 32;
+        std::vector<Vector3> verts;
+        std::vector<int> indices;
+        MakeHeightField(GRID + 1, verts, indices, 10.0f);
+        int triCount = (int)indices.size() / 3;
+        TriangleSoup soup((int)verts.size(), verts.data(), triCount, indices.data());
+        TriangleSoup compressed((int)verts.size(), verts.data(), triCount, indices.data());
+        compressed.CompressBvh();
+        if (10 * compressed.GetBvhMemorySize() > 6 * soup.GetBvhMemorySize())
+        {
+            return false;
+        }
+        std::uniform_real_distribution<float> coord(-20.0f, 10.0f * GRID + 20.0f);
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            LineSegment line(Vector3(coord(gen), coord(gen), dist(gen)), Vector3(coord(gen), coord(gen), dist(gen)));
+            CastInfo info, refInfo;
+            bool hit = compressed.RayCast(line, &info);
+            if (hit != soup.RayCast(line, &refInfo) || hit != compressed.IsOccluded(line))
+            {
+                return false;
+            }
+            if (hit && (info.mFraction != refInfo.mFraction || false == Math::CloseEnough(info.mNormal, refInfo.mNormal)))
+            {
+                return false;
+            }
+            CastInfo all[8], refAll[8];
+            int count = compressed.RayCastAll(line, 1.0f, all, 8);
+            if (count != soup.RayCastAll(line, 1.0f, refAll, 8))
+            {
+                return false;
+            }
+            for (int h = 0; h < count; ++h)
+            {
+                if (all[h].mFraction != refAll[h].mFraction)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
     struct ObjTest {
         LineSegment mLine;
         Vector3 mPosition;
@@ -319,7 +741,7 @@ namespace Physics
         Vector3 mCorrectNormal;
         Vector3 mCorrectPosition;
     };
-    static ObjTest s_objTest[] = {
+    static constexpr ObjTest s_objTest[] = {
         {
             { Vector3(-100.0f, 0.0f, 0.0f), Vector3(100.0f, 0.0f, 0.0f) },
             Vector3(0.0f, 0.0f, 0.0f),
@@ -371,6 +793,7 @@ namespace Physics
             Vector3(-15.0f, 0.0f, 0.0f)
         },
     };
+    static_assert(HitsAreOnTheirLines(s_objTest), "a hit in s_objTest is off its line");
 
     bool TestLineVsObj(const ObjTest& test)
     {
@@ -400,65 +823,1672 @@ namespace Physics
         return true;
     }
 
+    static constexpr Vector3 s_octahedronVert[] = {
+        Vector3(10.0f, 0.0f, 0.0f), Vector3(-10.0f, 0.0f, 0.0f), Vector3(0.0f, 10.0f, 0.0f),
+        Vector3(0.0f, -10.0f, 0.0f), Vector3(0.0f, 0.0f, 10.0f), Vector3(0.0f, 0.0f, -10.0f),
+    };
+    static constexpr int s_octahedronIndex[] = {
+        0, 2, 4,  1, 4, 2,  0, 4, 3,  1, 3, 4,  0, 5, 2,  1, 2, 5,  0, 3, 5,  1, 5, 3,
+    };
+    static constexpr auto s_octahedronData = MAKE_SOUP_DATA(s_octahedronVert, s_octahedronIndex);
+
     /// <summary>
-    /// This is the master unit test for the Physics Ray Casting
+    /// A soup over compile time TriangleSoupData has to hit exactly what the same mesh built at run time hits
     /// </summary>
-    /// <returns>true if the tests all pass or false if any fails</returns>
-    bool UnitTest()
+    bool TestSoupData()
     {
-        bool result = true;
-        {   // line vs plane
-            for (const LineVsPlane& test : s_lineVsPlane)
+        Vector3 verts[ARRAY_SIZE(s_octahedronVert)];
+        int indices[ARRAY_SIZE(s_octahedronIndex)];
+        std::copy(s_octahedronVert, s_octahedronVert + ARRAY_SIZE(verts), verts);
+        std::copy(s_octahedronIndex, s_octahedronIndex + ARRAY_SIZE(indices), indices);
+        TriangleSoup built(MAKE_SOUP(verts, indices));
+        TriangleSoup soup(s_octahedronData);
+        if (soup.IsBox() || soup.GetTriCount() != built.GetTriCount() || soup.GetBvhMemorySize() != 0 ||
+            false == Math::CloseEnough(soup.GetBounds().mMin, built.GetBounds().mMin, 0.0f) ||
+            false == Math::CloseEnough(soup.GetBounds().mMax, built.GetBounds().mMax, 0.0f))
+        {
+            return false;
+        }
+
+        std::mt19937 gen(0x9753);
+        std::uniform_real_distribution<float> dist(-20.0f, 20.0f);
+        int hitCount = 0;
+        for (int i = 0; i < 2000; ++i)
+        {
+            LineSegment line(Vector3(dist(gen), dist(gen), dist(gen)), Vector3(dist(gen), dist(gen), dist(gen)));
+            CastInfo info, refInfo;
+            bool hit = soup.RayCast(line, &info);
+            if (hit != built.RayCast(line, &refInfo) || hit != soup.IsOccluded(line))
             {
-                bool ret = TestLineVsPlane(test);
-                assert(ret);
-                result &= ret;
+                return false;
+            }
+            CastInfo all[4], refAll[4];
+            if (soup.RayCastAll(line, 1.0f, all, 4) != built.RayCastAll(line, 1.0f, refAll, 4))
+            {
+                return false;
+            }
+            if (hit)
+            {
+                ++hitCount;
+                // the compiler may fuse the run time precompute into FMAs, where the compile time one is not
+                if (false == Math::NearZero(info.mFraction - refInfo.mFraction, 0.00001f) ||
+                    false == Math::CloseEnough(info.mNormal, refInfo.mNormal, 0.00001f))
+                {
+                    return false;
+                }
             }
         }
+        return hitCount > 0;
+    }
 
-        {   // triangle 2 plane
-            for (const Tri2Plane& test : s_testTri2Plane)
+    /// <summary>
+    /// An Indexed soup has to hit what the Precomputed soup of the same mesh hits, up to rounding, in a fraction
+    /// of the memory. The heightfield has more than 65536 vertices so its indices are 32 bit, the box's are 16 bit.
+    /// A soup that takes its vertices over has to hit exactly what the one that copies them hits.
+    /// </summary>
+    bool TestIndexedSoup()
+    {
+        const int SIDE = 257;
+        std::vector<Vector3> verts;
+        std::vector<int> indices;
+        MakeHeightField(SIDE, verts, indices);
+        int triCount = (int)indices.size() / 3;
+        TriangleSoup soup((int)verts.size(), verts.data(), triCount, indices.data(), TriangleSoup::Format::Indexed);
+        TriangleSoup reference((int)verts.size(), verts.data(), triCount, indices.data());
+        TriangleSoup moved(std::vector<Vector3>(verts), triCount, indices.data());
+        if (soup.GetFormat() != TriangleSoup::Format::Indexed || soup.GetTriCount() != triCount ||
+            soup.GetTriMemorySize() != verts.size() * sizeof(Vector3) + indices.size() * sizeof(uint32_t) ||
+            moved.GetFormat() != TriangleSoup::Format::Indexed || moved.GetTriMemorySize() != soup.GetTriMemorySize() ||
+            2 * soup.GetTriMemorySize() > reference.GetTriMemorySize())
+        {
+            return false;
+        }
+
+        std::mt19937 gen(0xa864);
+        std::uniform_real_distribution<float> dist(0.0f, (float)(SIDE - 1));
+        int hitCount = 0;
+        for (int i = 0; i < 2000; ++i)
+        {
+            LineSegment line(Vector3(dist(gen), dist(gen), 20.0f), Vector3(dist(gen), dist(gen), -20.0f));
+            CastInfo info, refInfo, movedInfo;
+            bool hit = soup.RayCast(line, &info);
+            if (hit != reference.RayCast(line, &refInfo) || hit != soup.IsOccluded(line) ||
+                hit != moved.RayCast(line, &movedInfo) || (hit && movedInfo.mFraction != info.mFraction))
             {
-                Plane p = test.mTriangle.GetPlane();
-                bool ret = Math::CloseEnough(p.mNormal, test.mPlane.mNormal);
-                ret |= Math::NearZero(p.mD - test.mPlane.mD);
-                assert(ret);
-                result &= ret;
+                return false;
+            }
+            CastInfo all[8], refAll[8];
+            if (soup.RayCastAll(line, 1.0f, all, 8) != reference.RayCastAll(line, 1.0f, refAll, 8))
+            {
+                return false;
+            }
+            if (hit)
+            {
+                ++hitCount;
+                if (false == Math::NearZero(info.mFraction - refInfo.mFraction, 0.00001f) ||
+                    false == Math::CloseEnough(info.mNormal, refInfo.mNormal, 0.01f))
+                {
+                    return false;
+                }
             }
         }
 
-        {   // point in triangle
-            for (const PointInTri& test : s_testPointInTri)
+        // a box is still found to be one, and cast with the slab test
+        Vector3 boxVerts[ARRAY_SIZE(s_boxVert)];
+        int boxIndices[ARRAY_SIZE(s_boxIndex)];
+        std::copy(s_boxVert, s_boxVert + ARRAY_SIZE(boxVerts), boxVerts);
+        std::copy(s_boxIndex, s_boxIndex + ARRAY_SIZE(boxIndices), boxIndices);
+        TriangleSoup box(MAKE_SOUP(boxVerts, boxIndices), TriangleSoup::Format::Indexed);
+        if (false == box.IsBox() || box.GetTriMemorySize() != sizeof(boxVerts) + ARRAY_SIZE(boxIndices) * sizeof(uint16_t))
+        {
+            return false;
+        }
+        return hitCount > 0;
+    }
+
+    /// <summary>
+    /// A View soup casts straight from the caller's buffers, and has to hit exactly what an Indexed copy of them hits,
+    /// with 16 bit, 32 bit and int indices, and after CompressBvh
+    /// </summary>
+    bool TestSoupView()
+    {
+        const int SIDE = 64;
+        std::vector<Vector3> verts;
+        std::vector<int> indices;
+        MakeHeightField(SIDE, verts, indices);
+        std::vector<uint16_t> indices16(indices.begin(), indices.end());
+        std::vector<uint32_t> indices32(indices.begin(), indices.end());
+        int vertCount = (int)verts.size();
+        int triCount = (int)indices.size() / 3;
+        TriangleSoup reference(vertCount, verts.data(), triCount, indices.data(), TriangleSoup::Format::Indexed);
+        TriangleSoup view16(vertCount, verts.data(), triCount, indices16.data());
+        TriangleSoup view32(vertCount, verts.data(), triCount, indices32.data());
+        TriangleSoup viewInt(vertCount, verts.data(), triCount, indices.data(), TriangleSoup::Format::View);
+        viewInt.CompressBvh();
+        const TriangleSoup* views[] = { &view16, &view32, &viewInt };
+        for (const TriangleSoup* pView : views)
+        {
+            if (pView->GetFormat() != TriangleSoup::Format::View || pView->GetTriMemorySize() != triCount * sizeof(int))
             {
-                bool ret = test.mTriangle.IsPointInside(test.mPoint);
-                ret = ret == test.mIsInside;
-                assert(ret);
-                result &= ret;
+                return false;
             }
         }
 
-        {   // line vs triangle
-            for (const LineVsTri& test : s_testLineVTri)
+        std::mt19937 gen(0xb975);
+        std::uniform_real_distribution<float> dist(0.0f, (float)(SIDE - 1));
+        int hitCount = 0;
+        for (int i = 0; i < 1000; ++i)
+        {
+            LineSegment line(Vector3(dist(gen), dist(gen), 10.0f), Vector3(dist(gen), dist(gen), -10.0f));
+            CastInfo refInfo;
+            bool hit = reference.RayCast(line, &refInfo);
+            hitCount += hit ? 1 : 0;
+            for (const TriangleSoup* pView : views)
             {
-                bool ret = TestLineVsTri(test);
-                assert(ret);
-                result &= ret;
+                CastInfo info;
+                if (pView->RayCast(line, &info) != hit || pView->IsOccluded(line) != hit)
+                {
+                    return false;
+                }
+                if (hit && (info.mFraction != refInfo.mFraction || false == Math::CloseEnough(info.mNormal, refInfo.mNormal, 0.0f)))
+                {
+                    return false;
+                }
             }
         }
 
-        {   // line vs soup
-            for (const LineVsSoup& test : s_lineVSoup)
+        // box detection reads the caller's indices too
+        Vector3 boxVerts[ARRAY_SIZE(s_boxVert)];
+        uint16_t boxIndices[ARRAY_SIZE(s_boxIndex)];
+        std::copy(s_boxVert, s_boxVert + ARRAY_SIZE(boxVerts), boxVerts);
+        std::copy(s_boxIndex, s_boxIndex + ARRAY_SIZE(boxIndices), boxIndices);
+        if (false == TriangleSoup(MAKE_SOUP(boxVerts, boxIndices)).IsBox())
+        {
+            return false;
+        }
+
+        // an index past the vertices (a corrupt file) leaves the soup without triangles instead of reading past them
+        uint32_t badIndices[] = { 0, 2, 1,  0, 3, 8 };
+        int badInts[] = { 0, 2, 1,  0, -1, 2 };
+        TriangleSoup badView(8, boxVerts, 2, badIndices);
+        TriangleSoup badIntView(8, boxVerts, 2, badInts, TriangleSoup::Format::View);
+        TriangleSoup badIndexed(8, boxVerts, 2, badInts, TriangleSoup::Format::Indexed);
+        LineSegment down(Vector3(0.0f, 0.0f, -10.0f), Vector3(0.0f, 0.0f, 10.0f));
+        if (badView.GetTriCount() != 0 || badIntView.GetTriCount() != 0 || badIndexed.GetTriCount() != 0 ||
+            badView.RayCast(down) || badIntView.RayCast(down) || badIndexed.RayCast(down))
+        {
+            return false;
+        }
+        return hitCount > 0;
+    }
+
+    /// <summary>
+    /// A soup that is a box has to be found to be one, and the slab test it then uses has to give exactly what
+    /// the same triangles give (checked against a copy with one extra, degenerate triangle so it is not a box)
+    /// </summary>
+    bool TestBoxSoup()
+    {
+        Vector3 verts[ARRAY_SIZE(s_boxVert)];
+        int indices[ARRAY_SIZE(s_boxIndex) + 3] = {};
+        std::copy(s_boxVert, s_boxVert + ARRAY_SIZE(verts), verts);
+        std::copy(s_boxIndex, s_boxIndex + ARRAY_SIZE(s_boxIndex), indices);
+        indices[ARRAY_SIZE(s_boxIndex) + 2] = 1;    // 0, 0, 1: degenerate
+        TriangleSoup box(8, verts, 12, indices);
+        TriangleSoup notBox(8, verts, 13, indices);
+        if (false == box.IsBox() || notBox.IsBox() || false == g_cubeSoup.IsBox())
+        {
+            return false;
+        }
+        int flipped[36];
+        std::copy(indices, indices + 36, flipped);
+        std::swap(flipped[1], flipped[2]);  // one triangle facing in
+        if (TriangleSoup(8, verts, 12, flipped).IsBox())
+        {
+            return false;
+        }
+
+        std::mt19937 gen(0x7531);
+        std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+        int hitCount = 0;
+        for (int i = 0; i < 2000; ++i)
+        {
+            LineSegment line(Vector3(dist(gen), dist(gen), dist(gen)), Vector3(dist(gen), dist(gen), dist(gen)));
+            CastInfo info, refInfo;
+            bool hit = box.RayCast(line, &info);
+            if (hit != notBox.RayCast(line, &refInfo) || hit != box.IsOccluded(line))
             {
-                bool ret = TestLineVsSoup(test);
-                assert(ret);
-                result &= ret;
+                return false;
+            }
+            if (hit)
+            {
+                ++hitCount;
+                if (info.mFraction != refInfo.mFraction || false == Math::CloseEnough(info.mNormal, refInfo.mNormal, 0.0f))
+                {
+                    return false;
+                }
             }
         }
+        return hitCount > 0;
+    }
 
-        {   // line vs obj
-            for (const ObjTest& test : s_objTest)
+    /// <summary>
+    /// The analytic shapes: a box shape against the cube soup it matches, and a sphere and a capsule against known answers
+    /// </summary>
+    bool TestShapes()
+    {
+        Matrix4 obj2World = Matrix4::CreateScale(Vector3(2.0f, 0.5f, 1.0f))
+            * Matrix4::CreateRotationY(0.3f)
+            * Matrix4::CreateTranslation(Vector3(100.0f, 0.0f, 0.0f));
+        SoupObj cube(&g_cubeSoup, obj2World);
+        SoupObj box = SoupObj::CreateBox(Vector3(10.0f, 10.0f, 10.0f), obj2World);
+        std::mt19937 gen(0x8642);
+        std::uniform_real_distribution<float> dist(-50.0f, 50.0f);
+        for (int i = 0; i < 500; ++i)
+        {
+            LineSegment line(Vector3(100.0f + dist(gen), dist(gen), dist(gen)), Vector3(100.0f + dist(gen), dist(gen), dist(gen)));
+            CastInfo info, refInfo;
+            bool hit = box.RayCast(line, &info);
+            if (hit != cube.RayCast(line, &refInfo))
             {
-                bool ret = TestLineVsObj(test);
+                return false;
+            }
+            if (hit && (false == Math::NearZero(info.mFraction - refInfo.mFraction, 0.0001f) ||
+                false == Math::CloseEnough(info.mNormal, refInfo.mNormal)))
+            {
+                return false;
+            }
+        }
+
+        Matrix4 at = Matrix4::CreateTranslation(Vector3(0.0f, 0.0f, 10.0f));
+        SoupObj sphere = SoupObj::CreateSphere(2.0f, at);
+        SoupObj capsule = SoupObj::CreateCapsule(3.0f, 1.0f, at);
+        CastInfo info;
+        // head on, from outside
+        if (false == sphere.RayCast(LineSegment(Vector3(-10.0f, 0.0f, 10.0f), Vector3(10.0f, 0.0f, 10.0f)), &info) ||
+            false == Math::NearZero(info.mFraction - 0.4f, 0.0001f) || false == Math::CloseEnough(info.mNormal, Vector3(-1.0f, 0.0f, 0.0f)))
+        {
+            return false;
+        }
+        // from inside, like a triangle's back face it does not count
+        if (sphere.RayCast(LineSegment(Vector3(0.0f, 0.0f, 10.0f), Vector3(10.0f, 0.0f, 10.0f))))
+        {
+            return false;
+        }
+        // the side of the capsule
+        if (false == capsule.RayCast(LineSegment(Vector3(-10.0f, 2.5f, 10.0f), Vector3(10.0f, 2.5f, 10.0f)), &info) ||
+            false == Math::NearZero(info.mFraction - 0.45f, 0.0001f) || false == Math::CloseEnough(info.mNormal, Vector3(-1.0f, 0.0f, 0.0f)))
+        {
+            return false;
+        }
+        // the top cap
+        if (false == capsule.RayCast(LineSegment(Vector3(0.0f, 10.0f, 10.0f), Vector3(0.0f, -10.0f, 10.0f)), &info) ||
+            false == Math::NearZero(info.mFraction - 0.3f, 0.0001f) || false == Math::CloseEnough(info.mNormal, Vector3(0.0f, 1.0f, 0.0f)))
+        {
+            return false;
+        }
+        // past the cap, but inside the cylinder the caps close
+        if (capsule.RayCast(LineSegment(Vector3(-10.0f, 3.9f, 10.0f), Vector3(10.0f, 3.9f, 10.0f)), &info) == false ||
+            capsule.RayCast(LineSegment(Vector3(-10.0f, 4.1f, 10.0f), Vector3(10.0f, 4.1f, 10.0f))))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// A random vector with each component in [-scale, scale]
+    /// </summary>
+    Vector3 RandomVector(std::mt19937& gen, float scale)
+    {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        return scale * Vector3(dist(gen), dist(gen), dist(gen));
+    }
+
+    /// <summary>
+    /// A g_cubeSoup object scaled by scale + RandomVector(scaleJitter), rotated at random if rotate is set, and moved
+    /// to RandomVector(spread)
+    /// </summary>
+    SoupObj RandomCube(std::mt19937& gen, float scale, float scaleJitter, float spread, bool rotate = true)
+    {
+        Vector3 euler = rotate ? RandomVector(gen, Math::Pi) : Vector3(0.0f, 0.0f, 0.0f);
+        Matrix4 obj2World = Matrix4::CreateScale(Vector3(scale, scale, scale) + RandomVector(gen, scaleJitter));
+        if (rotate)
+        {
+            obj2World = obj2World
+                * Matrix4::CreateRotationX(euler.x)
+                * Matrix4::CreateRotationY(euler.y)
+                * Matrix4::CreateRotationZ(euler.z);
+        }
+        return SoupObj(&g_cubeSoup, obj2World * Matrix4::CreateTranslation(RandomVector(gen, spread)));
+    }
+
+    /// <summary>
+    /// Fill a world with count cubes from RandomCube, the fixture of the World tests
+    /// </summary>
+    void AddRandomCubes(World& world, std::mt19937& gen, int count, float scale, float scaleJitter, float spread, bool rotate = true)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            world.AddObj(RandomCube(gen, scale, scaleJitter, spread, rotate));
+        }
+    }
+
+    /// <summary>
+    /// Fill a world with randomly placed and rotated cubes and cast random lines through it
+    /// A BruteForce world with the same cubes (every object is tested) gives the expected hits. The world is queried
+    /// once while dirty, so the first cast builds it, and again after an explicit Build, and both have to match.
+    /// </summary>
+    bool TestWorldAccel(World::AccelMode mode)
+    {
+        const int NUM_OBJ = 200;
+        const int NUM_LINE = 200;
+        std::mt19937 gen(0x1234);
+        std::mt19937 refGen(0x1234);
+
+        World world(mode);
+        World reference(World::AccelMode::BruteForce);
+        AddRandomCubes(world, gen, NUM_OBJ, 2.0f, 1.0f, 1000.0f);
+        AddRandomCubes(reference, refGen, NUM_OBJ, 2.0f, 1.0f, 1000.0f);
+        std::vector<LineSegment> lines;
+        std::vector<CastInfo> infos(NUM_LINE);
+        std::vector<bool> hits(NUM_LINE);
+        int hitCount = 0;
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            lines.emplace_back(RandomVector(gen, 1000.0f), RandomVector(gen, 1000.0f));
+            hits[i] = reference.RayCast(lines[i], &infos[i]);
+            hitCount += hits[i] ? 1 : 0;
+        }
+        if (hitCount == 0)
+        {   // the test is meaningless if nothing is hit
+            return false;
+        }
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            if (pass == 1)
+            {
+                world.Build();
+            }
+            for (int i = 0; i < NUM_LINE; ++i)
+            {
+                CastInfo info;
+                bool result = world.RayCast(lines[i], &info);
+                if (result != hits[i])
+                {
+                    return false;
+                }
+                if (result)
+                {
+                    if (false == Math::CloseEnough(info.mNormal, infos[i].mNormal))
+                    {
+                        return false;
+                    }
+                    if (false == Math::NearZero(info.mFraction - infos[i].mFraction, 0.00001f))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Move, remove and re-add objects in a world using AccelMode::Dynamic and check it still agrees with
+    /// a world that tests every object, and that the tree under it stays consistent
+    /// </summary>
+    bool TestWorldDynamic()
+    {
+        const int NUM_OBJ = 200;
+        const int NUM_LINE = 100;
+        const int NUM_FRAME = 5;
+        std::mt19937 gen(0x4321);
+
+        World world(World::AccelMode::Dynamic);
+        World reference(World::AccelMode::BruteForce);
+        std::vector<Vector3> pos;
+        for (int i = 0; i < NUM_OBJ; ++i)
+        {
+            SoupObj obj = RandomCube(gen, 1.0f, 0.0f, 1000.0f, false);
+            pos.push_back(obj.GetObj2World().GetTranslation());
+            world.AddObj(obj);
+            reference.AddObj(obj);
+        }
+        world.Build();
+        // an object without a shape stays out of the tree
+        world.AddObj(SoupObj());
+        reference.AddObj(SoupObj());
+
+        for (int frame = 0; frame < NUM_FRAME; ++frame)
+        {
+            for (int i = 0; i < NUM_OBJ; ++i)
+            {   // most objects jitter a little, a few jump across the world
+                pos[i] += (i % 10 == 0) ? RandomVector(gen, 500.0f) : RandomVector(gen, 1.0f);
+                Matrix4 obj2World = Matrix4::CreateTranslation(pos[i]);
+                world.UpdateTransform(i, obj2World);
+                reference.UpdateTransform(i, obj2World);
+            }
+            int id = (frame * 37) % NUM_OBJ;
+            world.RemoveObj(id);
+            reference.RemoveObj(id);
+            if (world.AddObj(SoupObj(&g_cubeSoup, Matrix4::CreateTranslation(pos[id]))) != id ||
+                reference.AddObj(SoupObj(&g_cubeSoup, Matrix4::CreateTranslation(pos[id]))) != id)
+            {   // ids are recycled
+                return false;
+            }
+
+            for (int i = 0; i < NUM_LINE; ++i)
+            {
+                LineSegment line(RandomVector(gen, 1000.0f), RandomVector(gen, 1000.0f));
+                CastInfo info, refInfo;
+                bool result = world.RayCast(line, &info);
+                if (result != reference.RayCast(line, &refInfo))
+                {
+                    return false;
+                }
+                if (result && false == Math::NearZero(info.mFraction - refInfo.mFraction, 0.00001f))
+                {
+                    return false;
+                }
+            }
+        }
+
+        // the tree itself
+        DynamicTree tree;
+        std::vector<int> proxies;
+        for (int i = 0; i < NUM_OBJ; ++i)
+        {
+            Vector3 p = RandomVector(gen, 1000.0f);
+            proxies.push_back(tree.CreateProxy(AABB(p, p + Vector3(10.0f)), i));
+        }
+        for (int i = 0; i < NUM_OBJ; i += 3)
+        {
+            tree.DestroyProxy(proxies[i]);
+        }
+        for (int i = 1; i < NUM_OBJ; i += 3)
+        {
+            Vector3 p = RandomVector(gen, 1000.0f);
+            tree.MoveProxy(proxies[i], AABB(p, p + Vector3(10.0f)));
+        }
+        return tree.Validate() && tree.GetHeight() < 3 * 8;
+    }
+
+    /// <summary>
+    /// ParallelFor hands func one chunk per call on any thread count, covers every item once, can be called from
+    /// inside itself, and reuses the pool's workers rather than starting threads on every call
+    /// </summary>
+    bool TestParallelFor()
+    {
+        const size_t COUNT = 1000;
+        const size_t CHUNK = 64;
+        for (int threadCount : { 1, 3 })
+        {
+            std::vector<std::atomic<int>> visits(COUNT);
+            std::atomic<bool> ok(true);
+            ParallelFor(COUNT, CHUNK, threadCount,
+                [&](size_t begin, size_t end)
+                {
+                    if (begin % CHUNK != 0 || end != std::min(begin + CHUNK, COUNT))
+                    {
+                        ok = false;
+                    }
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        visits[i]++;
+                    }
+                });
+            for (const std::atomic<int>& visit : visits)
+            {
+                ok = ok && visit == 1;
+            }
+            if (false == ok)
+            {
+                return false;
+            }
+        }
+
+        std::atomic<size_t> sum(0);
+        ParallelFor(8, 1, 4,
+            [&](size_t, size_t)
+            {
+                ParallelFor(COUNT, 10, 4,
+                    [&](size_t begin, size_t end)
+                    {
+                        sum += end - begin;
+                    });
+            });
+        int workerCount = ThreadPool::GetInstance().GetWorkerCount();
+        for (int i = 0; i < 100; ++i)
+        {
+            ParallelFor(COUNT, CHUNK, 4, [&](size_t begin, size_t end) { sum += end - begin; });
+        }
+        return sum == 108 * COUNT && workerCount >= 3 && ThreadPool::GetInstance().GetWorkerCount() == workerCount;
+    }
+
+    /// <summary>
+    /// Objects added with AddObjs have to get the ids AddObj would hand out, reused ones first, and the world has to
+    /// build itself once, on the first cast after the change, even with several threads casting at once
+    /// </summary>
+    bool TestWorldBulkLoad()
+    {
+        const int NUM_OBJ = 500;
+        const int NUM_LINE = 2000;
+        std::mt19937 gen(0x5eed);
+
+        std::vector<SoupObj> objs;
+        for (int i = 0; i < NUM_OBJ; ++i)
+        {
+            objs.push_back(RandomCube(gen, 5.0f, 0.0f, 300.0f, false));
+        }
+        std::vector<LineSegment> lines;
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            lines.emplace_back(RandomVector(gen, 400.0f), RandomVector(gen, 400.0f));
+        }
+
+        for (World::AccelMode mode : { World::AccelMode::Bvh, World::AccelMode::Grid, World::AccelMode::Dynamic })
+        {
+            World world(mode);
+            World reference(World::AccelMode::BruteForce);
+            reference.Reserve(NUM_OBJ);
+            for (int i = 0; i < NUM_OBJ / 2; ++i)
+            {
+                reference.AddObj(objs[i]);
+            }
+            std::vector<int> ids(NUM_OBJ);
+            world.AddObjs(objs.data(), NUM_OBJ / 2, ids.data());
+            for (int i = 0; i < NUM_OBJ / 2; ++i)
+            {
+                if (ids[i] != i)
+                {
+                    return false;
+                }
+            }
+
+            // free a few ids, then add the rest: the freed ids come back first, in the order AddObj gives them out
+            for (int id : { 3, 50, 7 })
+            {
+                world.RemoveObj(id);
+                reference.RemoveObj(id);
+            }
+            world.AddObjs(objs.data() + NUM_OBJ / 2, NUM_OBJ / 2, ids.data());
+            for (int i = 0; i < NUM_OBJ / 2; ++i)
+            {
+                if (reference.AddObj(objs[NUM_OBJ / 2 + i]) != ids[i])
+                {
+                    return false;
+                }
+            }
+            if (ids[0] != 7 || ids[2] != 3 || false == world.IsAccelDirty())
+            {
+                return false;
+            }
+
+            // the first casts, on several threads at once, build the world; every thread has to see the same objects
+            std::vector<CastInfo> infos(NUM_LINE);
+            bool hits[NUM_LINE];
+            ParallelFor(NUM_LINE, 16, 4,
+                [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        hits[i] = world.RayCast(lines[i], &infos[i]);
+                    }
+                });
+            if (world.IsAccelDirty())
+            {
+                return false;
+            }
+            int hitCount = 0;
+            for (int i = 0; i < NUM_LINE; ++i)
+            {
+                CastInfo info;
+                bool hit = reference.RayCast(lines[i], &info);
+                if (hit != hits[i] || (hit && (info.mFraction != infos[i].mFraction || false == Math::CloseEnough(info.mPoint, infos[i].mPoint, 0.0f))))
+                {
+                    return false;
+                }
+                hitCount += hit ? 1 : 0;
+            }
+            if (hitCount == 0)
+            {
+                return false;
+            }
+
+            // a move marks the world dirty again, and a single cast builds it
+            world.UpdateTransform(ids[0], Matrix4::CreateTranslation(Vector3(1000.0f, 0.0f, 0.0f)));
+            if (world.IsAccelDirty() != (mode != World::AccelMode::Dynamic) ||
+                false == world.RayCast(LineSegment(Vector3(1000.0f, 0.0f, -10.0f), Vector3(1000.0f, 0.0f, 10.0f))) ||
+                world.IsAccelDirty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Line of sight checks have to agree with RayCast, for every acceleration structure and for short and long lines
+    /// </summary>
+    bool TestWorldOcclusion(World::AccelMode mode)
+    {
+        const int NUM_OBJ = 200;
+        const int NUM_LINE = 400;
+        std::mt19937 gen(0x2468);
+
+        World world(mode);
+        AddRandomCubes(world, gen, NUM_OBJ, 30.0f, 20.0f, 500.0f);
+        world.Build();
+
+        int occludedCount = 0;
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            Vector3 from = RandomVector(gen, 1000.0f);
+            LineSegment line(from, from + RandomVector(gen, i % 2 == 0 ? 100.0f : 2000.0f));
+            bool occluded = world.IsOccluded(line);
+            if (occluded != world.RayCast(line))
+            {
+                return false;
+            }
+            occludedCount += occluded ? 1 : 0;
+        }
+        return occludedCount > 0 && occludedCount < NUM_LINE;
+    }
+
+    /// <summary>
+    /// Gather every hit along lines through a world of cubes. A line crosses the front of a cube at most once,
+    /// so the answer has to be each object's own RayCast hit, sorted and cut down to the closest maxHits
+    /// </summary>
+    bool TestWorldRayCastAll(World::AccelMode mode)
+    {
+        const int NUM_OBJ = 300;
+        const int NUM_LINE = 200;
+        std::mt19937 gen(0x1357);
+
+        World world(mode);
+        AddRandomCubes(world, gen, NUM_OBJ, 40.0f, 20.0f, 500.0f);
+        world.Build();
+
+        int multiHitCount = 0;
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            LineSegment line(RandomVector(gen, 1000.0f), RandomVector(gen, 1000.0f));
+            std::vector<CastHit> expected;
+            for (int id = 0; id < NUM_OBJ; ++id)
+            {
+                CastHit hit;
+                if (world.GetObj(id).RayCast(line, &hit))
+                {
+                    hit.mObjId = id;
+                    expected.push_back(hit);
+                }
+            }
+            std::sort(expected.begin(), expected.end(),
+                [](const CastHit& a, const CastHit& b) { return a.mFraction < b.mFraction || (a.mFraction == b.mFraction && a.mObjId < b.mObjId); });
+            multiHitCount += expected.size() > 1 ? 1 : 0;
+
+            for (int maxHits : { 1, 3, 50 })
+            {
+                CastHit hits[50];
+                int count = world.RayCastAll(line, hits, maxHits);
+                if (count != Math::Min(maxHits, (int)expected.size()))
+                {
+                    return false;
+                }
+                for (int h = 0; h < count; ++h)
+                {
+                    if (hits[h].mObjId != expected[h].mObjId || hits[h].mFraction != expected[h].mFraction ||
+                        false == Math::CloseEnough(hits[h].mNormal, expected[h].mNormal))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // a stack of layers gives one object more hits than World::RayCastAll keeps on the stack per object
+        const int LAYERS = 40;
+        std::vector<int> indices;
+        std::vector<Vector3> verts;
+        for (int layer = 0; layer < LAYERS; ++layer)
+        {
+            int a = (int)verts.size();
+            float z = (float)layer;
+            verts.insert(verts.end(), { Vector3(-1.0f, -1.0f, z), Vector3(1.0f, -1.0f, z), Vector3(1.0f, 1.0f, z), Vector3(-1.0f, 1.0f, z) });
+            int quad[12] = { a, a + 1, a + 2, a, a + 2, a + 3, a, a + 2, a + 1, a, a + 3, a + 2 };
+            indices.insert(indices.end(), quad, quad + 12);
+        }
+        TriangleSoup layers((int)verts.size(), verts.data(), (int)indices.size() / 3, indices.data());
+        World layerWorld(mode);
+        layerWorld.AddObj(SoupObj(&layers, Matrix4::CreateTranslation(Vector3(5.0f, 0.0f, 0.0f))));
+        LineSegment layerLine(Vector3(5.2f, 0.1f, 100.0f), Vector3(5.3f, -0.1f, -100.0f));
+        LineSegment localLine(Vector3(0.2f, 0.1f, 100.0f), Vector3(0.3f, -0.1f, -100.0f));
+        CastHit layerHits[LAYERS];
+        CastInfo localHits[LAYERS];
+        int layerCount = layerWorld.RayCastAll(layerLine, layerHits, LAYERS);
+        if (layerCount != LAYERS || layerCount != layers.RayCastAll(localLine, 1.0f, localHits, LAYERS))
+        {
+            return false;
+        }
+        for (int h = 0; h < layerCount; ++h)
+        {
+            if (layerHits[h].mObjId != 0 || false == Math::NearZero(layerHits[h].mFraction - localHits[h].mFraction, 0.00001f))
+            {
+                return false;
+            }
+        }
+        return multiHitCount > 0;
+    }
+
+    /// <summary>
+    /// The affine, uniform scale and TRS inverses against the general Matrix4::Invert
+    /// </summary>
+    bool TestMatrixInverse()
+    {
+        std::mt19937 gen(0x9753);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        auto closeEnough = [](const Matrix4& a, const Matrix4& b)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    if (false == Math::NearZero(a.mat[i][j] - b.mat[i][j], 0.0001f * Math::Max(1.0f, Math::Abs(b.mat[i][j]))))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+        for (int i = 0; i < 100; ++i)
+        {
+            Vector3 scale(1.0f + 0.5f * dist(gen), 2.0f + dist(gen), 0.7f + 0.5f * dist(gen));
+            Vector3 axis = Vector3::Normalize(Vector3(dist(gen), dist(gen), dist(gen) + 2.0f));
+            Quaternion rotation(axis, Math::Pi * dist(gen));
+            Vector3 trans(100.0f * dist(gen), 100.0f * dist(gen), 100.0f * dist(gen));
+
+            // scale, rotate, a shear and a translation
+            Matrix4 shear = Matrix4::Identity;
+            shear.mat[1][0] = dist(gen);
+            Matrix4 affine = Matrix4::CreateTRS(scale, rotation, trans) * shear;
+            Matrix4 reference = affine;
+            reference.Invert();
+            Matrix4 inverse = affine;
+            inverse.InvertAffine();
+            if (false == affine.IsAffine() || false == closeEnough(inverse, reference))
+            {
+                return false;
+            }
+
+            Matrix4 trs = Matrix4::CreateScale(scale) * Matrix4::CreateFromQuaternion(rotation) * Matrix4::CreateTranslation(trans);
+            if (false == closeEnough(Matrix4::CreateTRS(scale, rotation, trans), trs))
+            {
+                return false;
+            }
+            reference = trs;
+            reference.Invert();
+            if (false == closeEnough(Matrix4::CreateInverseTRS(scale, rotation, trans), reference))
+            {
+                return false;
+            }
+
+            Matrix4 uniform = Matrix4::CreateTRS(Vector3(scale.x, scale.x, scale.x), rotation, trans);
+            reference = uniform;
+            reference.Invert();
+            inverse = uniform;
+            inverse.InvertUniformScale();
+            if (false == closeEnough(inverse, reference))
+            {
+                return false;
+            }
+        }
+        return false == Matrix4::CreatePerspectiveFOV(1.0f, 4.0f, 3.0f, 1.0f, 100.0f).IsAffine();
+    }
+
+    /// <summary>
+    /// Matrix4 multiply and Vector3::Transform/TransformMany (SIMD or not) have to give exactly what the sums
+    /// written out one component at a time give, as the rest of the code relies on them adding up in that order
+    /// </summary>
+    bool TestMathSimd()
+    {
+        std::mt19937 gen(0x3579);
+        std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+        Matrix4 a, b;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                a.mat[i][j] = dist(gen);
+                b.mat[i][j] = dist(gen);
+            }
+        }
+        Matrix4 product = a * b;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                float sum = a.mat[i][0] * b.mat[0][j] + a.mat[i][1] * b.mat[1][j] + a.mat[i][2] * b.mat[2][j] + a.mat[i][3] * b.mat[3][j];
+                if (product.mat[i][j] != sum)
+                {
+                    return false;
+                }
+            }
+        }
+
+        std::vector<Vector3> points;
+        for (int i = 0; i < 11; ++i)
+        {
+            points.emplace_back(dist(gen), dist(gen), dist(gen));
+        }
+        for (float w : { 1.0f, 0.0f })
+        {
+            for (size_t count = 0; count <= points.size(); ++count)
+            {
+                std::vector<Vector3> out(count + 1, Vector3(-1.0f, -1.0f, -1.0f));
+                Vector3::TransformMany(points.data(), out.data(), count, a, w);
+                std::vector<Vector3> inPlace(points.begin(), points.begin() + count);
+                Vector3::TransformMany(inPlace.data(), inPlace.data(), count, a, w);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const Vector3& p = points[i];
+                    Vector3 ref(
+                        p.x * a.mat[0][0] + p.y * a.mat[1][0] + p.z * a.mat[2][0] + w * a.mat[3][0],
+                        p.x * a.mat[0][1] + p.y * a.mat[1][1] + p.z * a.mat[2][1] + w * a.mat[3][1],
+                        p.x * a.mat[0][2] + p.y * a.mat[1][2] + p.z * a.mat[2][2] + w * a.mat[3][2]
+                    );
+                    Vector3 one = Vector3::Transform(p, a, w);
+                    if (one.x != ref.x || one.y != ref.y || one.z != ref.z ||
+                        out[i].x != ref.x || out[i].y != ref.y || out[i].z != ref.z ||
+                        inPlace[i].x != ref.x || inPlace[i].y != ref.y || inPlace[i].z != ref.z)
+                    {
+                        return false;
+                    }
+                }
+                // nothing past the end is written
+                if (out[count].x != -1.0f || out[count].y != -1.0f || out[count].z != -1.0f)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// The World's hot arrays have to start on a cache line, and give exactly the points, normals and hits
+    /// the objects give from their full matrices, including after objects are removed and their slots reused
+    /// </summary>
+    bool TestObjArrays()
+    {
+        std::mt19937 gen(0x1357);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        auto randomMatrix = [&]()
+        {
+            return Matrix4::CreateScale(Vector3(1.0f + dist(gen), 2.0f + dist(gen), 1.5f + dist(gen)))
+                * Matrix4::CreateRotationX(Math::Pi * dist(gen))
+                * Matrix4::CreateRotationZ(Math::Pi * dist(gen))
+                * Matrix4::CreateTranslation(Vector3(100.0f * dist(gen), 100.0f * dist(gen), 100.0f * dist(gen)));
+        };
+
+        ObjArrays arrays;
+        arrays.Resize(3);
+        SoupObj obj(&g_cubeSoup, randomMatrix());
+        arrays.Set(1, obj.GetWorldBounds(), obj.GetWorld2Obj());
+        AlignedVector<float> floats(5);
+        if ((reinterpret_cast<uintptr_t>(floats.data()) % CACHE_LINE_SIZE) != 0)
+        {
+            return false;
+        }
+        Vector3 p(3.0f, -7.0f, 11.0f);
+        Vector3 objP = Vector3::Transform(p, obj.GetWorld2Obj());
+        Vector3 hotP = arrays.PointToObj(1, p);
+        if (objP.x != hotP.x || objP.y != hotP.y || objP.z != hotP.z)
+        {
+            return false;
+        }
+        // empty slots are never hit, whatever the direction
+        for (int i = 0; i < 100; ++i)
+        {
+            Vector3 from(1000.0f * dist(gen), 1000.0f * dist(gen), 1000.0f * dist(gen));
+            Vector3 to(1000.0f * dist(gen), 1000.0f * dist(gen), 1000.0f * dist(gen));
+            if (arrays.RayCastBounds(0, from, Bvh::GetInvDir(to - from), 1.0f))
+            {
+                return false;
+            }
+        }
+
+        // a brute force world against its objects, one at a time
+        World world(World::AccelMode::BruteForce);
+        std::vector<int> ids;
+        for (int i = 0; i < 50; ++i)
+        {
+            ids.push_back(world.AddObj(SoupObj(&g_cubeSoup, randomMatrix())));
+        }
+        for (int i = 0; i < 50; i += 3)
+        {
+            world.RemoveObj(ids[i]);
+        }
+        for (int i = 0; i < 10; ++i)
+        {
+            world.AddObj(SoupObj::CreateSphere(5.0f, randomMatrix()));
+        }
+        for (int i = 1; i < 50; i += 6)
+        {   // only objects still in the world, every third one was removed
+            world.UpdateTransform(ids[i], randomMatrix());
+        }
+        world.Build();
+        for (int i = 0; i < 300; ++i)
+        {
+            LineSegment line(Vector3(150.0f * dist(gen), 150.0f * dist(gen), 150.0f * dist(gen)),
+                Vector3(150.0f * dist(gen), 150.0f * dist(gen), 150.0f * dist(gen)));
+            CastInfo best;
+            best.mFraction = Math::Infinity;
+            for (int id = 0; id < 60; ++id)
+            {
+                CastInfo info;
+                if (world.GetObj(id).RayCast(line, &info) && info.mFraction < best.mFraction)
+                {
+                    best = info;
+                }
+            }
+            CastInfo info;
+            bool hit = world.RayCast(line, &info);
+            if (hit != (best.mFraction != Math::Infinity))
+            {
+                return false;
+            }
+            if (hit && (info.mFraction != best.mFraction || false == Math::CloseEnough(info.mNormal, best.mNormal, 0.0f)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Cast packets of lines through a world of random cubes and check every ray gets exactly what
+    /// World::RayCast gives it on its own. Half the packets are camera like (one origin, close directions),
+    /// the others are random lines, and the packet sizes include ones that do not fill a whole SIMD register.
+    /// </summary>
+    bool TestWorldPacket()
+    {
+        const int NUM_OBJ = 300;
+        const int NUM_PACKET = 100;
+        std::mt19937 gen(0x5678);
+
+        World world(World::AccelMode::Bvh);
+        AddRandomCubes(world, gen, NUM_OBJ, 20.0f, 10.0f, 500.0f);
+        world.Build();
+
+        const int packetSizes[] = { 1, 4, 5, 8, 13, 16 };
+        int hitCount = 0;
+        for (int p = 0; p < NUM_PACKET; ++p)
+        {
+            int count = packetSizes[p % 6];
+            LineSegment lines[RayPacket::MAX_RAYS];
+            Vector3 eye = RandomVector(gen, 1000.0f);
+            Vector3 target = RandomVector(gen, 200.0f);
+            for (int r = 0; r < count; ++r)
+            {
+                lines[r] = (p % 2 == 0)
+                    ? LineSegment(eye, target + RandomVector(gen, 50.0f) + 2.0f * (target - eye))
+                    : LineSegment(RandomVector(gen, 1000.0f), RandomVector(gen, 1000.0f));
+            }
+            CastInfo infos[RayPacket::MAX_RAYS];
+            uint32_t hitMask = world.RayCastPacket(lines, count, infos);
+            for (int r = 0; r < count; ++r)
+            {
+                CastInfo info;
+                bool hit = world.RayCast(lines[r], &info);
+                if (hit != ((hitMask & (1u << r)) != 0))
+                {
+                    return false;
+                }
+                if (hit)
+                {
+                    ++hitCount;
+                    if (info.mFraction != infos[r].mFraction ||
+                        false == Math::CloseEnough(info.mPoint, infos[r].mPoint, 0.0f) ||
+                        false == Math::CloseEnough(info.mNormal, infos[r].mNormal, 0.0f))
+                    {
+                        return false;
+                    }
+                }
+            }
+            if (hitMask >> count)
+            {
+                return false;
+            }
+        }
+        return hitCount > 0;
+    }
+
+    /// <summary>
+    /// Cast a batch of random lines through a world with several thread counts and chunk sizes,
+    /// the results have to be exactly the ones of single RayCast calls every time
+    /// </summary>
+    bool TestWorldBatch()
+    {
+        const int NUM_OBJ = 200;
+        const int NUM_LINE = 1000;
+        std::mt19937 gen(0x9abc);
+
+        World world(World::AccelMode::Bvh);
+        AddRandomCubes(world, gen, NUM_OBJ, 30.0f, 20.0f, 500.0f, false);
+        world.Build();
+
+        std::vector<LineSegment> lines;
+        for (int i = 0; i < NUM_LINE; ++i)
+        {
+            lines.emplace_back(RandomVector(gen, 1000.0f), RandomVector(gen, 1000.0f));
+        }
+
+        const World::BatchOptions options[] = {
+            World::BatchOptions(1, 256),
+            World::BatchOptions(4, 7),
+            World::BatchOptions(0, 64),
+        };
+        for (const World::BatchOptions& option : options)
+        {
+            std::vector<CastInfo> infos(NUM_LINE);
+            bool hits[NUM_LINE];
+            world.RayCastBatch(lines.data(), lines.size(), infos.data(), hits, option);
+            for (int i = 0; i < NUM_LINE; ++i)
+            {
+                CastInfo info;
+                bool hit = world.RayCast(lines[i], &info);
+                if (hit != hits[i])
+                {
+                    return false;
+                }
+                if (hit && (info.mFraction != infos[i].mFraction || false == Math::CloseEnough(info.mNormal, infos[i].mNormal, 0.0f)))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+#if defined(__cpp_impl_coroutine)
+    /// <summary>
+    /// A coroutine nobody waits on, enough to co_await RayCastService::Async from a test
+    /// </summary>
+    struct DetachedTask {
+        struct promise_type {
+            DetachedTask get_return_object() { return DetachedTask(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    DetachedTask CastAsync(RayCastService& service, LineSegment line, RayCastResult* pResult, std::promise<void>* pDone)
+    {
+        *pResult = co_await service.Async(line);
+        pDone->set_value();
+    }
+#endif
+
+    /// <summary>
+    /// Several threads submit casts to a RayCastService at once, half waiting on futures and half on callbacks,
+    /// then (in C++20) a few more are co_awaited, and every result has to match a plain World::RayCast
+    /// </summary>
+    bool TestRayCastService()
+    {
+        const int NUM_OBJ = 200;
+        const int NUM_PRODUCER = 4;
+        const int NUM_LINE = 300;
+        std::mt19937 gen(0xdef0);
+
+        World world(World::AccelMode::Bvh);
+        AddRandomCubes(world, gen, NUM_OBJ, 30.0f, 20.0f, 500.0f, false);
+        world.Build();
+
+        std::vector<LineSegment> lines;
+        for (int i = 0; i < NUM_PRODUCER * NUM_LINE; ++i)
+        {
+            lines.emplace_back(RandomVector(gen, 1000.0f), RandomVector(gen, 1000.0f));
+        }
+
+        std::vector<RayCastResult> results(lines.size());
+        std::atomic<int> callbackCount(0);
+        {
+            RayCastService service(world, 3);
+            std::vector<std::thread> producers;
+            for (int p = 0; p < NUM_PRODUCER; ++p)
+            {
+                producers.emplace_back([&, p]()
+                    {
+                        std::vector<std::future<RayCastResult>> futures;
+                        for (int i = p * NUM_LINE; i < (p + 1) * NUM_LINE; ++i)
+                        {
+                            if (i % 2 == 0)
+                            {
+                                futures.push_back(service.Submit(lines[i]));
+                            }
+                            else
+                            {
+                                service.Submit(lines[i], [&results, &callbackCount, i](const RayCastResult& result)
+                                    {
+                                        results[i] = result;
+                                        callbackCount.fetch_add(1);
+                                    });
+                            }
+                        }
+                        for (int i = 0; i < (int)futures.size(); ++i)
+                        {
+                            results[p * NUM_LINE + 2 * i] = futures[i].get();
+                        }
+                    });
+            }
+            for (std::thread& producer : producers)
+            {
+                producer.join();
+            }
+
+#if defined(__cpp_impl_coroutine)
+            // a coroutine resumes on a worker with the same result as a plain cast
+            for (int i = 0; i < NUM_LINE; i += 10)
+            {
+                RayCastResult result;
+                std::promise<void> done;
+                std::future<void> finished = done.get_future();
+                CastAsync(service, lines[i], &result, &done);
+                finished.wait();
+                CastInfo info;
+                bool hit = world.RayCast(lines[i], &info);
+                if (hit != result.mHit || (hit && info.mFraction != result.mInfo.mFraction))
+                {
+                    return false;
+                }
+            }
+#endif
+        }   // the service finishes every request before it goes away
+
+        if (callbackCount.load() != NUM_PRODUCER * NUM_LINE / 2)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            CastInfo info;
+            bool hit = world.RayCast(lines[i], &info);
+            if (hit != results[i].mHit)
+            {
+                return false;
+            }
+            if (hit && info.mFraction != results[i].mInfo.mFraction)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Append value to a file being written, in the given byte order
+    /// </summary>
+    template <typename T>
+    void AppendValue(std::vector<char>& bytes, T value, bool bigEndian)
+    {
+        char valueBytes[sizeof(T)];
+        std::memcpy(valueBytes, &value, sizeof(T));
+        const uint16_t one = 1;
+        if (bigEndian == (*reinterpret_cast<const char*>(&one) == 1))
+        {
+            std::reverse(valueBytes, valueBytes + sizeof(T));
+        }
+        bytes.insert(bytes.end(), valueBytes, valueBytes + sizeof(T));
+    }
+
+    bool WriteFile(const char* path, const std::vector<char>& bytes)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), (std::streamsize)bytes.size());
+        return file.good();
+    }
+
+    /// <summary>
+    /// The same square and triangle as an OBJ file (with the things an OBJ file may have that are skipped, relative
+    /// indices, CRLF and no last end of line) and as binary PLY files of both byte orders, with other property types,
+    /// properties and elements. All of them have to come out exactly the same, read through big and small chunks.
+    /// </summary>
+    bool TestMeshImporter()
+    {
+        const Vector3 verts[] = {
+            Vector3(0.0f, 0.0f, 0.0f), Vector3(1.5f, 0.0f, 0.0f), Vector3(1.5f, 1.5f, 0.0f), Vector3(0.0f, 1.5f, 0.0f),
+            Vector3(-2.5f, -0.25f, 12.5f), Vector3(-1.0f, -0.5f, 12.5f), Vector3(-1.5f, -2.0f, 12.5f),
+        };
+        const int indices[] = { 0, 1, 2, 0, 2, 3, 4, 5, 6 };
+        const char* obj =
+            "# a square and a triangle\r\n"
+            "mtllib none.mtl\r\n"
+            "v 0 0 0\r\n"
+            "v 1.5 0 0\r\n"
+            "  v 1.5 1.5 0.0\r\n"
+            "v 0 1.5 0\r\n"
+            "vt 0 0\r\n"
+            "vn 0 0 1\r\n"
+            "\r\n"
+            "g square\r\n"
+            "f 1/1/1 2/1/1 3/1/1 4/1/1 # the quad\r\n"
+            "v -2.5e0 -0.25 1.25E+1\r\n"
+            "v -1 -.5 12.5\r\n"
+            "v -1.5 -2 +125e-1\r\n"
+            "f -3//1 -2//1 -1//1";
+
+        // the same in PLY, the little endian one plain, the big endian one with everything that can be skipped
+        std::vector<char> plys[2];
+        for (int big = 0; big < 2; ++big)
+        {
+            std::vector<char>& ply = plys[big];
+            const char* header = big ?
+                "ply\nformat binary_big_endian 1.0\ncomment skipped\nelement vertex 7\nproperty short flags\n"
+                "property double z\nproperty double x\nproperty double y\nelement edge 1\nproperty int vertex1\nproperty int vertex2\n"
+                "element face 2\nproperty uchar flags\nproperty list uchar float texcoord\nproperty list ushort uint vertex_index\nend_header\n" :
+                "ply\nformat binary_little_endian 1.0\nelement vertex 7\nproperty float x\nproperty float y\nproperty float z\n"
+                "element face 2\nproperty list uchar int vertex_indices\nend_header\n";
+            ply.assign(header, header + std::strlen(header));
+            for (const Vector3& v : verts)
+            {
+                if (big)
+                {
+                    AppendValue(ply, (int16_t)-1, true);
+                    AppendValue(ply, (double)v.z, true);
+                    AppendValue(ply, (double)v.x, true);
+                    AppendValue(ply, (double)v.y, true);
+                }
+                else
+                {
+                    AppendValue(ply, v.x, false);
+                    AppendValue(ply, v.y, false);
+                    AppendValue(ply, v.z, false);
+                }
+            }
+            if (big)
+            {
+                AppendValue(ply, (int32_t)0, true);
+                AppendValue(ply, (int32_t)1, true);
+            }
+            const int faces[2][5] = { { 4, 0, 1, 2, 3 }, { 3, 4, 5, 6 } };
+            for (const int* pFace : faces)
+            {
+                if (big)
+                {
+                    AppendValue(ply, (uint8_t)7, true);
+                    AppendValue(ply, (uint8_t)2, true);
+                    AppendValue(ply, 0.5f, true);
+                    AppendValue(ply, 0.5f, true);
+                    AppendValue(ply, (uint16_t)pFace[0], true);
+                }
+                else
+                {
+                    AppendValue(ply, (uint8_t)pFace[0], false);
+                }
+                for (int c = 1; c <= pFace[0]; ++c)
+                {
+                    if (big)
+                    {
+                        AppendValue(ply, (uint32_t)pFace[c], true);
+                    }
+                    else
+                    {
+                        AppendValue(ply, (int32_t)pFace[c], false);
+                    }
+                }
+            }
+        }
+
+        const char* paths[] = { "TestMesh.obj", "TestMesh.ply", "TestMeshBig.PLY" };
+        bool ret = WriteFile(paths[0], std::vector<char>(obj, obj + std::strlen(obj))) && WriteFile(paths[1], plys[0]) && WriteFile(paths[2], plys[1]);
+        for (size_t chunkSize : { MeshImporter::DEFAULT_CHUNK_SIZE, (size_t)48 })
+        {
+            MeshImporter importer(chunkSize);
+            for (const char* path : paths)
+            {
+                Mesh mesh;
+                ret = ret && importer.Load(path, &mesh) && importer.GetBytesRead() > 0 &&
+                    mesh.mIndices == std::vector<int>(indices, indices + ARRAY_SIZE(indices)) && mesh.mVerts.size() == ARRAY_SIZE(verts);
+                for (size_t i = 0; ret && i < ARRAY_SIZE(verts); ++i)
+                {
+                    ret = Math::CloseEnough(mesh.mVerts[i], verts[i], 0.0f);
+                }
+            }
+        }
+
+        // straight into a soup
+        std::unique_ptr<TriangleSoup> soup = MeshImporter().ImportSoup(paths[1], TriangleSoup::Format::Indexed);
+        CastInfo info;
+        ret = ret && soup && soup->GetTriCount() == 3 && soup->RayCast(LineSegment(Vector3(0.5f, 0.5f, 5.0f), Vector3(0.5f, 0.5f, -5.0f)), &info) &&
+            info.mFraction == 0.5f && Math::CloseEnough(info.mNormal, Vector3(0.0f, 0.0f, 1.0f), 0.0f);
+
+        // files that have to be refused: a line longer than the chunk, a missing vertex, a bad vertex, ascii and cut short
+        Mesh mesh;
+        ret = ret && false == MeshImporter(16).Load(paths[0], &mesh);
+        const char* badObj = "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4\n";
+        const char* ascii = "ply\nformat ascii 1.0\nelement vertex 0\nend_header\n";
+        ret = ret && WriteFile(paths[0], std::vector<char>(badObj, badObj + std::strlen(badObj))) && false == MeshImporter().Load(paths[0], &mesh);
+        const char* badVertex = "v 0 0 0\nv 1 oops 0\n";
+        ret = ret && WriteFile(paths[0], std::vector<char>(badVertex, badVertex + std::strlen(badVertex))) && false == MeshImporter().Load(paths[0], &mesh) &&
+            mesh.mVerts.size() == 1;
+        ret = ret && WriteFile(paths[1], std::vector<char>(ascii, ascii + std::strlen(ascii))) && false == MeshImporter().Load(paths[1], &mesh);
+        plys[1].resize(plys[1].size() - 3);
+        ret = ret && WriteFile(paths[2], plys[1]) && false == MeshImporter().Load(paths[2], &mesh);
+        ret = ret && false == MeshImporter().Load("TestMeshMissing.obj", &mesh);
+        for (const char* path : paths)
+        {
+            std::remove(path);
+        }
+        return ret;
+    }
+
+    /// <summary>
+    /// A World saved to a SceneCache and loaded back has to hit exactly what the original hits, with soups in every
+    /// format, analytic shapes and a removed object. Files that are cut short or of another version have to be refused.
+    /// </summary>
+    bool TestSceneCache(World::AccelMode mode)
+    {
+        const char* PATH = "TestSceneCache.bin";
+        const int SIDE = 40;
+        std::vector<Vector3> verts;
+        std::vector<int> indices;
+        MakeHeightField(SIDE, verts, indices);
+        int triCount = (int)indices.size() / 3;
+        TriangleSoup precomputed((int)verts.size(), verts.data(), triCount, indices.data());
+        TriangleSoup indexed((int)verts.size(), verts.data(), triCount, indices.data(), TriangleSoup::Format::Indexed);
+        TriangleSoup view((int)verts.size(), verts.data(), triCount, indices.data(), TriangleSoup::Format::View);
+        indexed.CompressBvh();
+        const TriangleSoup* soups[] = { &precomputed, &indexed, &view, &g_cubeSoup };
+
+        std::mt19937 gen(0x5ca1e);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        World world(mode);
+        for (int i = 0; i < 120; ++i)
+        {
+            Matrix4 obj2World = Matrix4::CreateRotationZ(Math::Pi * dist(gen)) * Matrix4::CreateTranslation(RandomVector(gen, 300.0f));
+            switch (i % 6)
+            {
+            case 4:
+                world.AddObj(SoupObj::CreateBox(Vector3(5.0f, 3.0f, 1.0f), obj2World));
+                break;
+            case 5:
+                world.AddObj(SoupObj::CreateSphere(6.0f, obj2World));
+                break;
+            default:
+                world.AddObj(SoupObj(soups[i % 6], Matrix4::CreateScale(Vector3(4.0f, 4.0f, 4.0f)) * obj2World));
+                break;
+            }
+        }
+        world.RemoveObj(7);
+        world.Build();
+        if (false == SceneCache::Save(PATH, world))
+        {
+            return false;
+        }
+
+        bool ret = true;
+        {
+            SceneCache cache;
+            ret = cache.Load(PATH) && cache.GetSoupCount() == 4 && cache.GetWorld().GetAccelMode() == mode;
+            int hitCount = 0;
+            for (int i = 0; i < 500 && ret; ++i)
+            {
+                LineSegment line(RandomVector(gen, 400.0f), RandomVector(gen, 400.0f));
+                CastInfo info;
+                CastInfo cacheInfo;
+                bool hit = world.RayCast(line, &info);
+                ret = cache.GetWorld().RayCast(line, &cacheInfo) == hit && cache.GetWorld().IsOccluded(line) == hit;
+                if (hit && ret)
+                {
+                    ret = cacheInfo.mFraction == info.mFraction && Math::CloseEnough(cacheInfo.mNormal, info.mNormal, 0.0f);
+                    ++hitCount;
+                }
+            }
+            ret = ret && hitCount > 0;
+
+            // a loaded world can still change, it builds over the same soups
+            if (ret)
+            {
+                World& loaded = cache.GetWorld();
+                int id = loaded.AddObj(SoupObj::CreateSphere(1.0f, Matrix4::CreateTranslation(Vector3(0.0f, 0.0f, 1000.0f))));
+                loaded.Build();
+                CastInfo info;
+                ret = id == 7 && loaded.RayCast(LineSegment(Vector3(0.0f, 0.0f, 1100.0f), Vector3(0.0f, 0.0f, 900.0f)), &info) &&
+                    Math::NearZero(info.mFraction - 0.495f, 0.0001f);
+            }
+        }
+
+        // damaged files are refused
+        std::vector<char> bytes;
+        {
+            std::ifstream file(PATH, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        std::vector<char> truncated(bytes.begin(), bytes.end() - bytes.size() / 3);
+        std::vector<char> otherVersion(bytes);
+        otherVersion[8] += 1;
+        for (const std::vector<char>* pBytes : { &truncated, &otherVersion })
+        {
+            {
+                std::ofstream file(PATH, std::ios::binary | std::ios::trunc);
+                file.write(pBytes->data(), (std::streamsize)pBytes->size());
+            }
+            SceneCache cache;
+            ret = ret && false == cache.Load(PATH) && false == cache.IsLoaded();
+        }
+        std::remove(PATH);
+        return ret;
+    }
+
+    /// <summary>
+    /// This is the master unit test for the Physics Ray Casting
+    /// </summary>
+    /// <returns>true if the tests all pass or false if any fails</returns>
+    bool UnitTest()
+    {
+        bool result = true;
+        {   // line vs plane
+            for (const LineVsPlane& test : s_lineVsPlane)
+            {
+                bool ret = TestLineVsPlane(test);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // triangle 2 plane
+            for (const Tri2Plane& test : s_testTri2Plane)
+            {
+                Plane p = test.mTriangle.GetPlane();
+                bool ret = Math::CloseEnough(p.mNormal, test.mPlane.mNormal);
+                ret |= Math::NearZero(p.mD - test.mPlane.mD);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // point in triangle
+            for (const PointInTri& test : s_testPointInTri)
+            {
+                bool ret = test.mTriangle.IsPointInside(test.mPoint);
+                ret = ret == test.mIsInside;
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // line vs triangle
+            for (const LineVsTri& test : s_testLineVTri)
+            {
+                bool ret = TestLineVsTri(test);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // line vs soup
+            for (const LineVsSoup& test : s_lineVSoup)
+            {
+                bool ret = TestLineVsSoup(test);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // line vs large soup
+            bool ret = TestLargeSoup();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // hierarchy built on several threads
+            bool ret = TestBvhParallelBuild();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // hierarchy built from Morton codes
+            bool ret = TestLinearBvh();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // compressed hierarchy
+            bool ret = TestQuantizedBvh();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // box soups and analytic shapes
+            bool ret = TestBoxSoup();
+            assert(ret);
+            result &= ret;
+            ret = TestShapes();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // indexed soups
+            bool ret = TestIndexedSoup();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // soups over the caller's buffers
+            bool ret = TestSoupView();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // mesh files
+            bool ret = TestMeshImporter();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // compile time soup data
+            bool ret = TestSoupData();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // line vs obj
+            for (const ObjTest& test : s_objTest)
+            {
+                bool ret = TestLineVsObj(test);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // line vs world
+            for (World::AccelMode mode : { World::AccelMode::Bvh, World::AccelMode::QuantizedBvh, World::AccelMode::Grid, World::AccelMode::Dynamic, World::AccelMode::Lbvh })
+            {
+                bool ret = TestWorldAccel(mode);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // line of sight
+            for (World::AccelMode mode : { World::AccelMode::BruteForce, World::AccelMode::Bvh, World::AccelMode::QuantizedBvh, World::AccelMode::Grid, World::AccelMode::Dynamic, World::AccelMode::Lbvh })
+            {
+                bool ret = TestWorldOcclusion(mode);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // every hit along a line
+            for (World::AccelMode mode : { World::AccelMode::BruteForce, World::AccelMode::Bvh, World::AccelMode::QuantizedBvh, World::AccelMode::Grid, World::AccelMode::Dynamic, World::AccelMode::Lbvh })
+            {
+                bool ret = TestWorldRayCastAll(mode);
+                assert(ret);
+                result &= ret;
+            }
+        }
+
+        {   // moving objects
+            bool ret = TestWorldDynamic();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // ParallelFor
+            bool ret = TestParallelFor();
+            assert(ret);
+            result &= ret;
+        }
+        {   // bulk loading
+            bool ret = TestWorldBulkLoad();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // matrix inverses
+            bool ret = TestMatrixInverse();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // SIMD math
+            bool ret = TestMathSimd();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // hot object arrays
+            bool ret = TestObjArrays();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // ray packets
+            bool ret = TestWorldPacket();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // batches across threads
+            bool ret = TestWorldBatch();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // asynchronous casts
+            bool ret = TestRayCastService();
+            assert(ret);
+            result &= ret;
+        }
+
+        {   // scene cache files
+            for (World::AccelMode mode : { World::AccelMode::BruteForce, World::AccelMode::Bvh, World::AccelMode::QuantizedBvh, World::AccelMode::Grid, World::AccelMode::Lbvh })
+            {
+                bool ret = TestSceneCache(mode);
                 assert(ret);
                 result &= ret;
             }